@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BACKEND_H
+#define __BACKEND_H
+
+#include "database.h"
+
+//Storage of the entries of a database. The functions of database.h
+//call these for the basic operations, the rest are built on SQL and
+//only work with the SQLite backend. Backend of a database is chosen
+//by the header of its file, see db_connect().
+typedef struct Db_backend {
+
+	const char *name;
+
+	//Returns true if the file in path belongs to this backend
+	bool (*is_file)(const char *path);
+
+	//Create a new empty database in path
+	bool (*create)(const char *path);
+
+	//Get the database in path ready to be encrypted on close
+	bool (*prepare_close)(const char *path);
+
+	//Connect db to the database in db->path
+	bool (*open)(Db_t *db);
+	void (*close)(Db_t *db);
+
+	//Entries with the wanted ids, or all of them in the order of
+	//their ids. The head of the list only contains initialization data.
+	Entry_t *(*get)(Db_t *db, const int *ids, int count);
+	Entry_t *(*scan)(Db_t *db);
+
+	//Add a new entry with the next free id
+	bool (*put)(Db_t *db, Entry_t *entry);
+
+	//Same as db_update_fields() and db_delete_entry_by_id()
+	bool (*update)(Db_t *db, int id, const char **fields,
+		const char **values, int count, bool *success);
+	bool (*remove)(Db_t *db, int id, bool *success);
+
+	int (*next_id)(Db_t *db);
+
+	bool (*begin)(Db_t *db);
+	bool (*commit)(Db_t *db);
+	bool (*rollback)(Db_t *db);
+
+} Db_backend_t;
+
+//Append-only log with an in-memory index, see logdb.c
+extern const Db_backend_t db_log_backend;
+
+#endif
@@ -74,7 +74,7 @@ bool backup_export(const char *source, const char *dest)
 		return false;
 	}
 	
-	if(!is_file_encrypted(source)) {
+	if(!is_file_encrypted(source) && !is_file_paged(source)) {
 		fprintf(stdout, "Encrypt the file first before taking a backup.\n");
 		return false;
 	}
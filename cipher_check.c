@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+//Cross-check of the in-tree cipher against libmcrypt, run with
+//"make check". Data of random length is encrypted and decrypted with
+//random keys and IVs by both, each in chunks of random size, and the
+//results must match byte for byte. An optional argument is the seed,
+//the one used is printed so failures can be repeated.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mcrypt.h>
+
+#include "rijndael.h"
+
+#define CHECK_ROUNDS (200)
+#define CHECK_MAX_LEN (20000)
+
+static void fill_rand(char *data, long len)
+{
+	for(long i = 0; i < len; i++)
+		data[i] = rand() & 0xff;
+}
+
+//Run the in-tree cipher over len bytes of data in chunks of random size
+static void rijndael_run(const char *key, const char *iv, char *data,
+		long len, bool decrypt)
+{
+	Rijndael_cfb_t cfb;
+	long done = 0;
+
+	rijndael_cfb_init(&cfb, key, iv);
+
+	while(done < len) {
+
+		long chunk = 1 + rand() % (len - done);
+
+		if(decrypt)
+			rijndael_cfb_decrypt(&cfb, data + done, chunk);
+		else
+			rijndael_cfb_encrypt(&cfb, data + done, chunk);
+
+		done += chunk;
+	}
+
+	memset(&cfb, 0, sizeof(cfb));
+}
+
+//Run libmcrypt over len bytes of data in chunks of random size.
+//Returns false on failure.
+static bool mcrypt_run(const char *key, const char *iv, char *data,
+		long len, bool decrypt)
+{
+	MCRYPT td;
+	long done = 0;
+	int ret = 0;
+
+	td = mcrypt_module_open("rijndael-256", NULL, "cfb", NULL);
+
+	if(td == MCRYPT_FAILED) {
+		fprintf(stderr, "Failed to open libmcrypt\n");
+		return false;
+	}
+
+	if(mcrypt_generic_init(td, (char *)key, RIJNDAEL_KEY_SIZE,
+		(char *)iv) < 0) {
+		fprintf(stderr, "Failed to initialize libmcrypt\n");
+		mcrypt_module_close(td);
+		return false;
+	}
+
+	while(ret == 0 && done < len) {
+
+		long chunk = 1 + rand() % (len - done);
+
+		if(decrypt)
+			ret = mdecrypt_generic(td, data + done, chunk);
+		else
+			ret = mcrypt_generic(td, data + done, chunk);
+
+		done += chunk;
+	}
+
+	mcrypt_generic_deinit(td);
+	mcrypt_module_close(td);
+
+	if(ret != 0)
+		fprintf(stderr, "libmcrypt failed\n");
+
+	return ret == 0;
+}
+
+//Encrypt and decrypt len bytes of random data with both ciphers.
+//Returns false if they differ.
+static bool check_round(long len)
+{
+	char key[RIJNDAEL_KEY_SIZE];
+	char iv[RIJNDAEL_BLOCK_SIZE];
+	char *plain = malloc(len + 1);
+	char *ours = malloc(len + 1);
+	char *theirs = malloc(len + 1);
+	bool success = false;
+
+	if(plain == NULL || ours == NULL || theirs == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		goto out;
+	}
+
+	fill_rand(key, sizeof(key));
+	fill_rand(iv, sizeof(iv));
+	fill_rand(plain, len);
+
+	memcpy(ours, plain, len);
+	memcpy(theirs, plain, len);
+
+	rijndael_run(key, iv, ours, len, false);
+
+	if(!mcrypt_run(key, iv, theirs, len, false))
+		goto out;
+
+	if(memcmp(ours, theirs, len) != 0) {
+		fprintf(stderr, "Ciphertext of %ld bytes differs\n", len);
+		goto out;
+	}
+
+	//Each decrypts the ciphertext of the other
+	rijndael_run(key, iv, theirs, len, true);
+
+	if(!mcrypt_run(key, iv, ours, len, true))
+		goto out;
+
+	if(memcmp(ours, plain, len) != 0 || memcmp(theirs, plain, len) != 0) {
+		fprintf(stderr, "Plaintext of %ld bytes differs\n", len);
+		goto out;
+	}
+
+	success = true;
+
+out:
+	free(plain);
+	free(ours);
+	free(theirs);
+
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int seed = (argc > 1) ? strtoul(argv[1], NULL, 10) :
+		(unsigned int)time(NULL);
+
+	if(!rijndael_available()) {
+		printf("AES-NI is not available, libmcrypt is always used. " \
+			"Skipped.\n");
+		return 0;
+	}
+
+	printf("Seed %u\n", seed);
+	srand(seed);
+
+	for(int i = 0; i < CHECK_ROUNDS; i++) {
+
+		//Short data too, which is within the first block
+		long len = (i % 4 == 0) ? rand() % 64 : rand() % CHECK_MAX_LEN;
+
+		if(!check_round(len)) {
+			fprintf(stderr, "Cipher check failed\n");
+			return 1;
+		}
+	}
+
+	printf("Cipher check passed, %d rounds\n", CHECK_ROUNDS);
+
+	return 0;
+}
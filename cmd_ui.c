@@ -26,15 +26,35 @@
 #include <stdbool.h>
 #include <string.h>
 #include <termios.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
 #include "database.h"
 #include "crypto.h"
 #include "cmd_ui.h"
 #include "status.h"
 #include "backup.h"
+#include "output.h"
+#include "format.h"
+#include "snapshot.h"
+#include "inbox.h"
+#include "rekey.h"
 
 //cmd_ui.c implements simple interface for command line version
 //of Steel. All functions in here are only called from main()
 
+//Connection shared by all the commands in batch mode,
+//NULL when every command opens the database itself.
+static Db_t *batch_db = NULL;
+
+//Entries of a batch run against a closed database with an inbox,
+//sealed into the inbox together at the end. Head is not an entry.
+static Entry_t *inbox_batch = NULL;
+
+//Passphrases are read from this stream instead of the terminal
+//when --passphrase-fd is given.
+static FILE *passphrase_stream = NULL;
+
 //Function works like strstr, but ignores the case.
 //There's a function strcasestr, but it's nonstandard
 //GNU extension, so let's not use that.
@@ -85,6 +105,19 @@ static char *my_strcasestr(const char *str, const char *str2)
 	return retval;
 }
 
+//Tell the user that entry with id was not found. Machine readable
+//output must stay parseable, so then the message goes to stderr.
+static void print_not_found(int id)
+{
+	//Keep the message in order with the buffered output
+	output_flush();
+	
+	if(output_get_mode() == OUTPUT_TEXT)
+		printf("No entry found with id %d.\n", id);
+	else
+		fprintf(stderr, "No entry found with id %d.\n", id);
+}
+
 //Simple helper function to check if there's an open database
 //available.
 static bool open_db_exist(const char *message)
@@ -109,6 +142,189 @@ static bool open_db_exist(const char *message)
 	return false;
 }
 
+//Read passphrase from passphrase_stream, one per line.
+//Returns false if there's no more lines.
+static bool read_passphrase_line(char *pass, size_t size)
+{
+	if(fgets(pass, size, passphrase_stream) == NULL) {
+		fprintf(stderr, "No passphrase available from --passphrase-fd.\n");
+		return false;
+	}
+
+	pass[strcspn(pass, "\r\n")] = '\0';
+
+	return true;
+}
+
+//Ask passphrase to pass. If retry prompt is given, passphrase is asked
+//twice and the two must match. When --passphrase-fd is in use, the
+//passphrase is read once from there without prompts.
+//Returns false on failure.
+static bool ask_passphrase(const char *prompt, const char *retry,
+	char *pass, size_t size)
+{
+	size_t pwdlen = size;
+	char *ptr = pass;
+	char pass2[size];
+	char *ptr2 = pass2;
+
+	if(passphrase_stream != NULL)
+		return read_passphrase_line(pass, size);
+
+	//Commands come from stdin, there's no terminal to ask from
+	if(batch_db != NULL) {
+		fprintf(stderr, "Use --passphrase-fd to give passphrases " \
+		"in batch mode.\n");
+		return false;
+	}
+
+	my_getpass((char *)prompt, &ptr, &pwdlen, stdin);
+
+	if(retry == NULL)
+		return true;
+
+	my_getpass((char *)retry, &ptr2, &pwdlen, stdin);
+
+	if(strcmp(pass, pass2) != 0) {
+		fprintf(stderr, "Passphrases do not match.\n");
+		return false;
+	}
+
+	return true;
+}
+
+//Read passphrases from file descriptor fd instead of the terminal.
+//Returns false if fd can't be used.
+bool set_passphrase_fd(int fd)
+{
+	passphrase_stream = fdopen(fd, "r");
+
+	if(passphrase_stream == NULL) {
+		fprintf(stderr, "Cannot read passphrases from fd %d: %s\n",
+			fd, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+//Paged database is decrypted page by page as it's used, so there's
+//no need to keep it open, but its passphrase is asked before the first
+//connection. Returns false on failure.
+static bool unlock_database()
+{
+	size_t pwdlen = 255;
+	char passphrase[pwdlen];
+	char *path = NULL;
+	bool ok = true;
+
+	path = db_get_path();
+
+	if(path == NULL)
+		return true;
+
+	if(db_is_locked(path)) {
+		ok = ask_passphrase(MASTER_PWD_PROMPT, NULL, passphrase, pwdlen) &&
+			db_unlock(path, passphrase);
+	}
+
+	free(path);
+
+	return ok;
+}
+
+//Get connection to the open database for a command.
+//Returns NULL on failure.
+static Db_t *get_connection()
+{
+	if(batch_db != NULL)
+		return batch_db;
+
+	if(!unlock_database())
+		return NULL;
+
+	return db_connect();
+}
+
+//Release connection got with get_connection(). The batch connection
+//is kept for the next command, which reads all the secrets again.
+static void release_connection(Db_t *db)
+{
+	if(db != batch_db)
+		db_disconnect(db);
+	else
+		db_read_secrets(db, DB_SECRET_PASSPHRASE | DB_SECRET_NOTES);
+}
+
+//Make sure the sealed ones of the wanted fields can be read and
+//written through db, asking the master passphrase if needed.
+//Returns false on failure.
+static bool unlock_secrets(Db_t *db, bool passphrase, bool notes)
+{
+	size_t pwdlen = 255;
+	char pass[pwdlen];
+
+	if(!(passphrase && db_is_sealed(db, "passphrase")) &&
+		!(notes && db_is_sealed(db, "notes")))
+		return true;
+
+	if(db_secrets_unlocked(db))
+		return true;
+
+	if(!ask_passphrase(MASTER_PWD_PROMPT, NULL, pass, pwdlen))
+		return false;
+
+	if(!db_unlock_secrets(db, pass)) {
+		fprintf(stderr, "Invalid passphrase\n");
+		return false;
+	}
+
+	return true;
+}
+
+//Get connection for a command printing entries with format, or with
+//the current output if format is NULL. Secret fields are read, and
+//unlocked if sealed, only if they are printed. Returns NULL on failure.
+static Db_t *get_print_connection(Format_t *format)
+{
+	Db_t *db = get_connection();
+	bool all = false;
+	bool passphrase;
+	bool notes;
+
+	if(db == NULL)
+		return NULL;
+
+	if(format == NULL && output_get_mode() != OUTPUT_FORMAT)
+		all = true;
+	else if(format == NULL)
+		format = output_get_format();
+
+	passphrase = all || format_uses_field(format, FIELD_PASSPHRASE);
+	notes = all || format_uses_field(format, FIELD_NOTES);
+
+	if(!unlock_secrets(db, passphrase, notes)) {
+		release_connection(db);
+		return NULL;
+	}
+
+	db_read_secrets(db, (passphrase ? DB_SECRET_PASSPHRASE : 0) |
+		(notes ? DB_SECRET_NOTES : 0));
+
+	return db;
+}
+
+//Returns true if field is one of the count fields
+static bool has_field(const char **fields, int count, const char *field)
+{
+	for(int i = 0; i < count; i++) {
+		if(strcmp(fields[i], field) == 0)
+			return true;
+	}
+
+	return false;
+}
+
 //Simple helper function to check if the steel_dbs file used for
 //tracking databases exists.
 static bool steel_tracker_file_exists()
@@ -135,15 +351,104 @@ static bool steel_tracker_file_exists()
 	return true;	
 }
 
-//Initialize new database and encrypt it.
+//Returns the path of the database if it's closed but has an inbox,
+//so that new entries are sealed into the inbox instead, or NULL.
+//Caller must free the return value.
+static char *get_inbox_path()
+{
+	char *path = db_get_path();
+
+	if(path != NULL && inbox_exists(path) &&
+		(is_file_encrypted(path) || db_is_locked(path)))
+		return path;
+
+	free(path);
+
+	return NULL;
+}
+
+//Add the entries of the inbox of the database in path to it, with the
+//master passphrase which opened it. Returns false on failure.
+static bool merge_inbox(const char *path, const char *passphrase)
+{
+	Db_t *db = NULL;
+	int count;
+	bool ok;
+
+	if(!inbox_exists(path))
+		return true;
+
+	db = db_connect();
+
+	if(db == NULL)
+		return false;
+
+	ok = db_unlock_secrets(db, passphrase) && inbox_merge(path, db, &count);
+	db_disconnect(db);
+
+	if(!ok) {
+		fprintf(stderr, "Adding the entries of the inbox failed.\n");
+		return false;
+	}
+
+	if(count > 0)
+		printf("Added %d %s from the inbox.\n", count,
+			count == 1 ? "entry" : "entries");
+
+	return true;
+}
+
+//Create the inbox of the open database, so that entries can be added
+//to it while it's closed. Returns false on failure.
+bool create_inbox()
+{
+	if(!steel_tracker_file_exists())
+		return false;
+
+	unsigned char public_key[BOX_KEY_SIZE];
+	Db_t *db = NULL;
+	bool ok;
+
+	db = get_connection();
+
+	if(db == NULL)
+		return false;
+
+	ok = db_init_inbox(db, public_key) && inbox_create(db->path, public_key);
+
+	if(ok)
+		printf("Entries can be added to %s while it's closed.\n", db->path);
+	else
+		fprintf(stderr, "Creating the inbox failed.\n");
+
+	release_connection(db);
+
+	return ok;
+}
+
+//Initialize new database and encrypt it. If paged is true, the
+//passphrase is asked now and the database is never decrypted. If log
+//is true, the entries are kept in an append-only log instead of SQLite.
 //Return false on failure, true on success.
 //Path must be a path to a file that does not exists.
-bool init_database(const char *path)
+bool init_database(const char *path, bool paged, bool log)
 {
+	size_t pwdlen = 255;
+	char passphrase[pwdlen];
+
 	if(open_db_exist("creating"))
 		return false;
+
+	if(paged && log) {
+		fprintf(stderr, "Log databases can't be paged.\n");
+		return false;
+	}
 	
-	if(!db_init(path)) {
+	if(paged && !ask_passphrase(MASTER_PWD_PROMPT, MASTER_PWD_PROMPT_RETRY,
+		passphrase, pwdlen))
+		return false;
+
+	if(!db_init(path, paged ? passphrase : NULL, log)) {
 		fprintf(stderr, "Database initialization unsuccessful\n");
 		return false;
 	}
@@ -163,93 +468,140 @@ bool open_database(const char *path)
 	//Max passphrase length. Should be enough, really.
 	size_t pwdlen = 255;
 	char passphrase[pwdlen];
-	char *ptr = passphrase;
 	
 	if(open_db_exist("opening"))
 		return false;
 
-	my_getpass(MASTER_PWD_PROMPT, &ptr, &pwdlen, stdin);
+	if(!ask_passphrase(MASTER_PWD_PROMPT, NULL, passphrase, pwdlen))
+		return false;
 	
 	if(!db_open(path, passphrase)) {
 		fprintf(stderr, "Database opening unsuccessful.\n");
 		return false;
 	}
 		
-	return true;
+	return merge_inbox(path, passphrase);
 }
 
 //Encrypt the database. We don't need the path of the database,
 //as it's read from the steel_open file. Only one database can be
-//open at once.
-void close_database()
+//open at once. If paged is true, the database is converted into a
+//paged database. Passphrase of a paged database is only checked.
+void close_database(bool paged)
 {
 	if(!steel_tracker_file_exists())
 		return;
 	
 	size_t pwdlen = 255;
 	char passphrase[pwdlen];
-	char *ptr = passphrase;
-	char pass2[pwdlen];
-	char *ptr2 = pass2;
-	
-	my_getpass(MASTER_PWD_PROMPT, &ptr, &pwdlen, stdin);
-	my_getpass(MASTER_PWD_PROMPT_RETRY, &ptr2, &pwdlen, stdin);
+	char *path = NULL;
+	const char *retry = MASTER_PWD_PROMPT_RETRY;
+
+	path = read_path_from_lockfile();
+
+	if(path != NULL && is_file_paged(path))
+		retry = NULL;
+
+	free(path);
 	
-	if(strcmp(passphrase, pass2) != 0) {
-		fprintf(stderr, "Passphrases do not match.\n");
+	if(!ask_passphrase(MASTER_PWD_PROMPT, retry, passphrase, pwdlen))
 		return;
-	}
 	
-	db_close(passphrase);
+	db_close(passphrase, paged);
 }
 
-//This is called from main. Adds new entry to the database.
-void add_new_entry(char *title, char *user, char *url, char *note)
+//This is called from main. Adds new entry to the database. If the
+//database is closed but has an inbox, the entry is sealed into it.
+//Returns false on failure.
+bool add_new_entry(char *title, char *user, char *url, char *note)
 {
 	if(!steel_tracker_file_exists())
-		return;
+		return false;
 	
 	int id;
+	bool ok;
 	//Should be enough...
 	size_t pwdlen = 255;
 	char pass[pwdlen];
-	char *ptr = pass;
-	char pass2[pwdlen];
-	char *ptr2 = pass2;
+	Db_t *db = NULL;
+	char *inbox = NULL;
+	
+	if(!ask_passphrase(ENTRY_PWD_PROMPT, ENTRY_PWD_PROMPT_RETRY,
+		pass, pwdlen))
+		return false;
+
+	if(inbox_batch != NULL)
+		return list_add(inbox_batch, title, user, pass, url, note, 0) != NULL;
+
+	//Closed database, seal the entry into its inbox
+	if(batch_db == NULL && (inbox = get_inbox_path()) != NULL) {
+
+		Entry_t *entry = list_create(title, user, pass, url, note, 0, NULL);
+
+		ok = entry != NULL && inbox_add(inbox, entry);
+
+		if(!ok)
+			fprintf(stderr, "Failed to add a new entry.\n");
+
+		list_free(entry);
+		free(inbox);
+
+		return ok;
+	}
 	
-	id = db_get_next_id();
+	db = get_connection();
 	
-	if(id == -1) {
+	if(db == NULL) {
 		fprintf(stderr, "Failed to add a new entry.\n");
-		return;
+		return false;
+	}
+	
+	if(!unlock_secrets(db, true, true)) {
+		fprintf(stderr, "Failed to add a new entry.\n");
+		release_connection(db);
+		return false;
 	}
 	
-	my_getpass(ENTRY_PWD_PROMPT, &ptr, &pwdlen, stdin);
-	my_getpass(ENTRY_PWD_PROMPT_RETRY, &ptr2, &pwdlen, stdin);
+	id = db_get_next_id(db);
 	
-	if(strcmp(pass, pass2) != 0) {
-		fprintf(stderr, "Passphrases do not match.\n");
-		return;
+	if(id == -1) {
+		fprintf(stderr, "Failed to add a new entry.\n");
+		release_connection(db);
+		return false;
 	}
 		
 	Entry_t *entry = list_create(title, user, pass, url, note, id, NULL);
 
-	if(!db_add_entry(entry)) {
+	ok = db_add_entry(db, entry);
+	
+	if(!ok)
 		fprintf(stderr, "Failed to add a new entry.\n");
-		return;
-	}
 	
 	list_free(entry);
+	release_connection(db);
+	
+	return ok;
 }
 
-//Print all available entries to stdin.
-//Database must not be encrypted.
-void show_all_entries()
+//Print all available entries to stdin, or only the entries tagged
+//with tag if it's not NULL. Database must not be encrypted.
+void show_all_entries(const char *tag)
 {
 	if(!steel_tracker_file_exists())
 		return;
 	
-	Entry_t *list = db_get_all_entries();
+	Db_t *db = get_print_connection(NULL);
+	Entry_t *list = NULL;
+	
+	if(db == NULL)
+		return;
+	
+	if(tag != NULL)
+		list = db_get_entries_by_tag(db, tag);
+	else
+		list = db_get_all_entries(db);
+	
+	release_connection(db);
 	
 	if(list != NULL) {
 		list_print(list);
@@ -257,89 +609,322 @@ void show_all_entries()
 	}
 }
 
-//Print one entry by id to stdin, if found.
-//Database must not be encrypted.
-void show_one_entry(int id)
+//Add id parsed from token to the dynamically growing ids array.
+//Returns false if token is not a valid id or on memory failure.
+static bool append_id(int **ids, int *count, int *size, const char *token)
 {
-	if(!steel_tracker_file_exists())
-		return;
-	
-	Entry_t *entry = db_get_entry_by_id(id);
-	
-	if(entry == NULL) {
-		fprintf(stderr, "Cannot show entry with id %d.\n", id);
-		return;
+	char *end = NULL;
+	long id;
+	int *tmp = NULL;
+
+	id = strtol(token, &end, 10);
+
+	if(end == token || *end != '\0' || id < 0 || id > INT_MAX) {
+		fprintf(stderr, "Invalid id %s.\n", token);
+		return false;
 	}
-	
-	Entry_t *head = entry;
-	Entry_t *next;
-	
-	if(head != NULL) {
-		//Skip the first one, it only has our initialization data.
-		next = head->next;
-		
-		if(next != NULL) {
-			list_print_one(next);
-		}
-		else {
-			printf("No entry found with id %d.\n", id);
+
+	if(*count == *size) {
+
+		*size = (*size == 0) ? 16 : *size * 2;
+		tmp = realloc(*ids, *size * sizeof(int));
+
+		if(tmp == NULL) {
+			fprintf(stderr, "Malloc failed.\n");
+			return false;
 		}
+
+		*ids = tmp;
 	}
-	
-	list_free(entry);
+
+	(*ids)[(*count)++] = (int)id;
+
+	return true;
 }
 
-//Delete entry by id from the database.
-//Database must not be encrypted.
-void delete_entry(int id)
+//Split str to tokens separated by any of delim and add them to ids.
+//Str is modified. Returns false on failure.
+static bool append_ids(int **ids, int *count, int *size, char *str,
+		const char *delim)
 {
-	if(!steel_tracker_file_exists())
-		return;
-	
-	bool success = false;
-	
-	if(!db_delete_entry_by_id(id, &success)) {
-		fprintf(stderr, "Entry deletion failed.\n");
-	}
-	else {
-		if(!success)
-			fprintf(stderr, "No entry found with id %d.\n", id);
+	char *token = strtok(str, delim);
+
+	while(token != NULL) {
+
+		if(!append_id(ids, count, size, token))
+			return false;
+
+		token = strtok(NULL, delim);
 	}
+
+	return true;
 }
 
-//Print all entries to stdin which has data matching with search.
-//Database must not be encrypted.
-void find_entries(const char *search)
+//Parse comma separated list of ids, for example "3,7,12".
+//Returns the ids or NULL on failure, number of ids is stored to count.
+//Caller must free the return value.
+int *parse_id_list(const char *str, int *count)
 {
-	if(!steel_tracker_file_exists())
-		return;
-	
-	Entry_t *list = db_get_all_entries();
-	char *title = NULL;
-	char *user = NULL;
-	char *url = NULL;
-	char *notes = NULL;
-	
-	if(list == NULL) {
-		fprintf(stderr, "Cannot perform the search operation.\n");
-		return;
+	int *ids = NULL;
+	int size = 0;
+	char *tmp = NULL;
+
+	*count = 0;
+	tmp = strdup(str);
+
+	if(tmp == NULL) {
+		fprintf(stderr, "Strdup failed\n");
+		return NULL;
 	}
-	
-	Entry_t *new_head = list->next;
-	
-	while(new_head != NULL) {
-		
-		//Search for matching data
-		title = my_strcasestr(new_head->title, search);
-		user = my_strcasestr(new_head->user, search);
-		url = my_strcasestr(new_head->url, search);
-		notes = my_strcasestr(new_head->notes, search);
+
+	if(!append_ids(&ids, count, &size, tmp, ",")) {
+		free(ids);
+		free(tmp);
+		return NULL;
+	}
+
+	free(tmp);
+
+	if(*count == 0) {
+		fprintf(stderr, "No ids given.\n");
+		free(ids);
+		return NULL;
+	}
+
+	return ids;
+}
+
+//Read ids from file pointed by path, or from stdin if path is "-".
+//Ids can be separated by white space or commas.
+//Returns the ids or NULL on failure, number of ids is stored to count.
+//Caller must free the return value.
+int *read_id_list(const char *path, int *count)
+{
+	FILE *fp = stdin;
+	int *ids = NULL;
+	int size = 0;
+	char *line = NULL;
+	size_t len = 0;
+	bool ok = true;
+
+	*count = 0;
+
+	if(strcmp(path, "-") != 0) {
+
+		fp = fopen(path, "r");
+
+		if(fp == NULL) {
+			fprintf(stderr, "Failed to open %s.\n", path);
+			return NULL;
+		}
+	}
+
+	while(ok && getline(&line, &len, fp) != -1)
+		ok = append_ids(&ids, count, &size, line, ", \t\r\n");
+
+	free(line);
+
+	if(fp != stdin)
+		fclose(fp);
+
+	if(!ok) {
+		free(ids);
+		return NULL;
+	}
+
+	if(*count == 0) {
+		fprintf(stderr, "No ids given.\n");
+		free(ids);
+		return NULL;
+	}
+
+	return ids;
+}
+
+//qsort comparison function for sorting entries by id.
+static int compare_entry_ids(const void *a, const void *b)
+{
+	const Entry_t *first = *(Entry_t * const *)a;
+	const Entry_t *second = *(Entry_t * const *)b;
+
+	return (first->id > second->id) - (first->id < second->id);
+}
+
+//Find entry with id from entries, an array of count entries
+//sorted by id. Returns NULL if there's no such entry.
+static Entry_t *lookup_entry(Entry_t **entries, int count, int id)
+{
+	int low = 0;
+	int high = count - 1;
+	int mid;
+
+	while(low <= high) {
+
+		mid = low + (high - low) / 2;
+
+		if(entries[mid]->id == id)
+			return entries[mid];
+
+		if(entries[mid]->id < id)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return NULL;
+}
+
+//Fetch all the entries with wanted ids from the database at once,
+//to be printed with format or the current output if it's NULL.
+//Entries are also indexed by id into *index, so that they can be
+//printed in the same order as the ids were given. Number of entries
+//found is stored to found. Returns the list or NULL on failure.
+//Caller must free the list and the index.
+static Entry_t *fetch_entries(const int *ids, int count, Format_t *format,
+			Entry_t ***index, int *found)
+{
+	Entry_t *list = NULL;
+	Db_t *db = NULL;
+	int i = 0;
+
+	db = get_print_connection(format);
+
+	if(db == NULL)
+		return NULL;
+
+	list = db_get_entries_by_ids(db, ids, count);
+	release_connection(db);
+
+	if(list == NULL)
+		return NULL;
+
+	*found = 0;
+
+	for(Entry_t *cursor = list->next; cursor != NULL; cursor = cursor->next)
+		(*found)++;
+
+	*index = malloc((*found + 1) * sizeof(Entry_t *));
+
+	if(*index == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		list_free(list);
+		return NULL;
+	}
+
+	for(Entry_t *cursor = list->next; cursor != NULL; cursor = cursor->next)
+		(*index)[i++] = cursor;
+
+	qsort(*index, *found, sizeof(Entry_t *), compare_entry_ids);
+
+	return list;
+}
+
+//Print entries by ids to stdout, in the same order as the ids are
+//given. All entries are read from the database at once.
+//Database must not be encrypted.
+void show_entries(const int *ids, int count)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	Entry_t **index = NULL;
+	Entry_t *entry = NULL;
+	int found;
+	Entry_t *list = fetch_entries(ids, count, NULL, &index, &found);
+	
+	if(list == NULL) {
+		fprintf(stderr, "Cannot show the entries.\n");
+		return;
+	}
+	
+	if(list_print_begin()) {
+		
+		for(int i = 0; i < count; i++) {
+			
+			entry = lookup_entry(index, found, ids[i]);
+			
+			if(entry != NULL)
+				list_print_next(entry);
+			else
+				print_not_found(ids[i]);
+		}
+		
+		list_print_end();
+	}
+	
+	free(index);
+	list_free(list);
+}
+
+//Delete entry by id from the database. Returns false on failure
+//or if there's no such entry. Database must not be encrypted.
+bool delete_entry(int id)
+{
+	if(!steel_tracker_file_exists())
+		return false;
+	
+	bool success = false;
+	Db_t *db = get_connection();
+	
+	if(db == NULL || !db_delete_entry_by_id(db, id, &success)) {
+		fprintf(stderr, "Entry deletion failed.\n");
+	}
+	else {
+		if(!success)
+			fprintf(stderr, "No entry found with id %d.\n", id);
+	}
+	
+	if(db != NULL)
+		release_connection(db);
+	
+	return success;
+}
+
+//Print all entries to stdin which has data matching with search.
+//Database must not be encrypted.
+void find_entries(const char *search)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	Db_t *db = get_print_connection(NULL);
+	
+	if(db == NULL)
+		return;
+	
+	//Notes are searched even if they are not printed
+	db_read_secrets(db, db->secrets | DB_SECRET_NOTES);
+	
+	Entry_t *list = db_get_all_entries(db);
+	
+	release_connection(db);
+	char *title = NULL;
+	char *user = NULL;
+	char *url = NULL;
+	char *notes = NULL;
+	
+	if(list == NULL) {
+		fprintf(stderr, "Cannot perform the search operation.\n");
+		return;
+	}
+	
+	Entry_t *new_head = list->next;
+	
+	list_print_begin();
+	
+	while(new_head != NULL) {
+		
+		//Search for matching data
+		title = my_strcasestr(new_head->title, search);
+		user = my_strcasestr(new_head->user, search);
+		url = my_strcasestr(new_head->url, search);
+		notes = my_strcasestr(new_head->notes, search);
 		
 		//Check if we found something
 		if(title != NULL || user != NULL || url != NULL || 
 			notes != NULL) {
 			
-			list_print_one(new_head);
+			list_print_next(new_head);
 		}
 		
 		if(title != NULL)
@@ -357,6 +942,7 @@ void find_entries(const char *search)
 		new_head = new_head->next;
 	}
 	
+	list_print_end();
 	list_free(list);
 }
 
@@ -398,14 +984,8 @@ size_t my_getpass(char *prompt, char **lineptr, size_t *n, FILE *stream)
 	return nread;
 }
 
-//Replace part of an entry pointed by id. "What" tells the function what to replace
-//with the new data. What can be "passphrase", "user", "title", "url" or "notes".
-//Database must not be encrypted.
-void replace_part(int id, const char *what, const char *new_data)
+static bool is_replaceable(const char *what)
 {
-	if(!steel_tracker_file_exists())
-		return;
-	
 	if(strcmp(what,"passphrase") != 0 && strcmp(what, "user") != 0
 		&& strcmp(what, "title") != 0 && strcmp(what, "url") != 0
 		&& strcmp(what, "notes") !=0) {
@@ -413,123 +993,495 @@ void replace_part(int id, const char *what, const char *new_data)
 		fprintf(stderr, "Only title, user, passphrase, url or notes" \
 		" can be replaced.\n");
 	
-		return;
-	}
-	
-	Entry_t *entry = NULL;
-	Entry_t *head = NULL;
-	
-	entry = db_get_entry_by_id(id);
-	
-	if(entry == NULL) {
-		fprintf(stderr, "Cannot replace %s from entry %d.\n",
-			what, id);
-		return;
-	}
-	
-	//Skip the initialization data
-	head = entry->next;
-	
-	if(head == NULL) {
-		fprintf(stderr, "No entry found with id %d.\n", id);
-		return;
+		return false;
 	}
-	
-	size_t pwdlen = 255;
-	char pass[pwdlen];
-	char *ptr = pass;
-	char pass2[pwdlen];
-	char *ptr2 = pass2;
-	
-	if(strcmp(what, "passphrase") == 0) {
+
+	return true;
+}
+
+//A NULL value for "passphrase" in values means it is asked from the
+//user. The passphrase is stored to pass. Returns false on failure.
+static bool ask_missing_passphrase(const char **fields, const char **values,
+	int count, char *pass, size_t size)
+{
+	for(int i = 0; i < count; i++) {
 		
-		//Ok, user want's to replace passphrase.
-		//Ask it, and verify it.
-		my_getpass(ENTRY_PWD_PROMPT, &ptr, &pwdlen, stdin);
-		my_getpass(ENTRY_PWD_PROMPT_RETRY, &ptr2, &pwdlen, stdin);
-	
-		if(strcmp(pass, pass2) != 0) {
-			fprintf(stderr, "Passphrases do not match.\n");
-			return;
+		if(strcmp(fields[i], "passphrase") == 0 && values[i] == NULL) {
+			
+			if(!ask_passphrase(ENTRY_PWD_PROMPT, ENTRY_PWD_PROMPT_RETRY,
+				pass, size))
+				return false;
+			
+			values[i] = pass;
 		}
 	}
-	
-	if(strcmp(what, "title") == 0) {
-		free(head->title);
-		head->title = strdup(new_data);
-	}
-	if(strcmp(what, "user") == 0) {
-		free(head->user);
-		head->user = strdup(new_data);
-	}
-	if(strcmp(what, "passphrase") == 0) {
-		free(head->pwd);
-		head->pwd = strdup(pass);
-	}
-	if(strcmp(what, "url") == 0) {
-		free(head->url);
-		head->url = strdup(new_data);
+
+	return true;
+}
+
+//Write the given fields of entry id with a single update.
+//A NULL value for "passphrase" means it is asked from the user.
+//Returns false on failure or if there's no such entry.
+static bool replace_fields(int id, const char **fields, const char **values,
+	int count)
+{
+	Db_t *db = NULL;
+	bool success = false;
+	size_t pwdlen = 255;
+	char pass[pwdlen];
+
+	if(!ask_missing_passphrase(fields, values, count, pass, pwdlen))
+		return false;
+
+	db = get_connection();
+
+	if(db == NULL) {
+		fprintf(stderr, "Cannot replace data of entry %d.\n", id);
+		return false;
 	}
-	if(strcmp(what, "notes") == 0) {
-		free(head->notes);
-		head->notes = strdup(new_data);
+
+	if(!unlock_secrets(db, has_field(fields, count, "passphrase"),
+		has_field(fields, count, "notes"))) {
+		fprintf(stderr, "Cannot replace data of entry %d.\n", id);
+		release_connection(db);
+		return false;
 	}
+
+	if(!db_update_fields(db, id, fields, values, count, &success))
+		fprintf(stderr, "Cannot replace data of entry %d.\n", id);
+	else if(!success)
+		fprintf(stderr, "No entry found with id %d.\n", id);
+
+	release_connection(db);
+
+	return success;
+}
+
+//Replace part of an entry pointed by id. "What" tells the function what to replace
+//with the new data. What can be "passphrase", "user", "title", "url" or "notes".
+//Returns false on failure. Database must not be encrypted.
+bool replace_part(int id, const char *what, const char *new_data)
+{
+	if(!steel_tracker_file_exists())
+		return false;
 	
-	db_update_entry(id, head);
+	if(!is_replaceable(what))
+		return false;
 	
-	list_free(entry);
+	//Passphrase is always asked, never taken from the command line
+	if(strcmp(what, "passphrase") == 0)
+		new_data = NULL;
+
+	return replace_fields(id, &what, &new_data, 1);
 }
 
-//Function generates new password and prints it to stdout.
-//Does not use the database, so this function can be called
-//even if the database is encrypted.
-void generate_password(int length, int count)
+//Split assignments in form "field=value", for example "user=john",
+//to fields and values. Plain "passphrase" gets a NULL value, meaning
+//that it's asked later. Assignments are modified.
+//Returns false if any of them is invalid.
+static bool parse_assignments(char **assignments, int count,
+	const char **fields, const char **values)
 {
-	if(length < 6) {
-		fprintf(stderr, "Minimum length is 6 characters.\n");
-		return;
-	}
-	
 	for(int i = 0; i < count; i++) {
-		
-		char *pass = generate_pass(length);
-		
-		if(pass == NULL) {
-			fprintf(stderr, "Generating new password failed.\n");
-			return;
+
+		char *value = strchr(assignments[i], '=');
+
+		if(value == NULL) {
+
+			if(strcmp(assignments[i], "passphrase") != 0) {
+				fprintf(stderr, "Missing value for %s, use %s=<value>.\n",
+					assignments[i], assignments[i]);
+				return false;
+			}
+
+			fields[i] = assignments[i];
+			values[i] = NULL;
+			continue;
 		}
-		
-		printf("%s\n", pass);
-		
-		free(pass);
+
+		//Split "field=value" in place
+		*value = '\0';
+		value++;
+
+		if(!is_replaceable(assignments[i]))
+			return false;
+
+		if(strcmp(assignments[i], "passphrase") == 0) {
+			fprintf(stderr, "Passphrase is asked separately, " \
+			"use plain passphrase.\n");
+			return false;
+		}
+
+		for(int j = 0; j < i; j++) {
+			if(strcmp(fields[j], assignments[i]) == 0) {
+				fprintf(stderr, "Field %s given more than once.\n",
+					assignments[i]);
+				return false;
+			}
+		}
+
+		fields[i] = assignments[i];
+		values[i] = value;
 	}
+
+	return true;
 }
 
-//Show all tracked databases, including their encryption status and last
-//modified date.
-void show_database_statuses()
+//Replace several parts of an entry pointed by id at once. Each assignment
+//is in form "field=value", for example "user=john". Plain "passphrase"
+//asks a new passphrase. Returns false on failure.
+//Database must not be encrypted.
+bool replace_parts(int id, char **assignments, int count)
 {
-	int count;
-	FILE *fp = NULL;
-	//char *line = NULL;
-	
 	if(!steel_tracker_file_exists())
-		return;
+		return false;
 
-	fp = status_get_file_ptr("r");
+	const char *fields[count];
+	const char *values[count];
 
-	if(fp == NULL)
-		return;
+	if(!parse_assignments(assignments, count, fields, values))
+		return false;
 
-	count = status_count_file_lines(fp);
+	return replace_fields(id, fields, values, count);
+}
 
-	if(count == -2) {
-		fprintf(stdout, "No databases found.\n");
-		fclose(fp);
-		return;
-	}
+//Parse id range "10-20" or a single id "10" of a condition.
+static bool parse_id_range(const char *str, Db_condition_t *cond)
+{
+	char *end = NULL;
+	long first;
+	long last;
 
-	rewind(fp);
+	first = strtol(str, &end, 10);
+	last = first;
+
+	if(end != str && *end == '-') {
+		const char *second = end + 1;
+		last = strtol(second, &end, 10);
+
+		if(end == second)
+			end = (char *)str;
+	}
+
+	if(end == str || *end != '\0' || first < 0 || last < first
+		|| last > INT_MAX) {
+		fprintf(stderr, "Invalid id range %s.\n", str);
+		return false;
+	}
+
+	cond->match = DB_MATCH_ID_RANGE;
+	cond->first = (int)first;
+	cond->last = (int)last;
+
+	return true;
+}
+
+//Days from 1970-01-01 to the date in the proleptic Gregorian calendar.
+static long long days_from_civil(int year, int month, int day)
+{
+	long long era;
+	int yoe;
+	int doy;
+
+	year -= (month <= 2);
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+//Parse time given as seconds since the epoch or as an UTC date
+//"YYYY-MM-DD" optionally followed by " HH:MM[:SS]" or "THH:MM[:SS]".
+//Returns false if str is not a valid time.
+static bool parse_time(const char *str, long long *time)
+{
+	int year, month, day;
+	int hour = 0, min = 0, sec = 0;
+	int len = 0;
+	char *end = NULL;
+
+	if(isdigit((unsigned char)str[0]) && strchr(str, '-') == NULL) {
+
+		*time = strtoll(str, &end, 10);
+
+		if(*end == '\0')
+			return true;
+	}
+	else if(sscanf(str, "%4d-%2d-%2d%n", &year, &month, &day, &len) == 3) {
+
+		const char *rest = str + len;
+
+		if(*rest == ' ' || *rest == 'T') {
+
+			len = 0;
+
+			if(sscanf(rest + 1, "%2d:%2d%n:%2d%n", &hour, &min, &len,
+				&sec, &len) < 2)
+				len = -1;
+			else
+				rest += len + 1;
+		}
+
+		if(len >= 0 && *rest == '\0' && month >= 1 && month <= 12
+			&& day >= 1 && day <= 31 && hour <= 23 && min <= 59
+			&& sec <= 60) {
+
+			*time = days_from_civil(year, month, day) * 86400
+				+ hour * 3600 + min * 60 + sec;
+
+			return true;
+		}
+	}
+
+	fprintf(stderr, "Invalid time %s, use YYYY-MM-DD[ HH:MM[:SS]] " \
+		"or seconds since the epoch.\n", str);
+
+	return false;
+}
+
+//Parse a condition to cond. Condition is either "field=text", matching
+//entries whose field is exactly text, "field~text", matching entries
+//whose field contains text ignoring the case, "id=<first>-<last>" or
+//"modified<time". Str is modified. Returns false if str is not a valid
+//condition.
+static bool parse_condition(char *str, Db_condition_t *cond)
+{
+	char *op = strpbrk(str, "=~<");
+	char kind;
+
+	if(op == NULL) {
+		fprintf(stderr, "Invalid condition %s, use field=text, " \
+		"field~text, id=<first>-<last> or modified<time.\n", str);
+		return false;
+	}
+
+	kind = *op;
+	memset(cond, 0, sizeof(Db_condition_t));
+	cond->match = (kind == '=') ? DB_MATCH_EQUALS : DB_MATCH_CONTAINS;
+	*op = '\0';
+	cond->field = str;
+	cond->text = op + 1;
+
+	if(strcmp(str, "modified") == 0 || kind == '<') {
+
+		if(strcmp(str, "modified") != 0 || kind != '<') {
+			fprintf(stderr, "Use modified<time to match " \
+			"modification times.\n");
+			return false;
+		}
+
+		cond->match = DB_MATCH_MODIFIED_BEFORE;
+
+		return parse_time(cond->text, &cond->time);
+	}
+
+	if(strcmp(str, "id") == 0) {
+
+		if(cond->match != DB_MATCH_EQUALS) {
+			fprintf(stderr, "Use id=<first>-<last> to match ids.\n");
+			return false;
+		}
+
+		return parse_id_range(cond->text, cond);
+	}
+
+	if(strcmp(str, "passphrase") != 0 && strcmp(str, "user") != 0
+		&& strcmp(str, "title") != 0 && strcmp(str, "url") != 0
+		&& strcmp(str, "notes") != 0) {
+		fprintf(stderr, "Unknown field %s in condition.\n", str);
+		return false;
+	}
+
+	//Empty text would be contained in every entry
+	if(cond->match == DB_MATCH_CONTAINS && *cond->text == '\0') {
+		fprintf(stderr, "Missing text after %s~.\n", str);
+		return false;
+	}
+
+	return true;
+}
+
+//Parse count conditions from predicates to conditions.
+static bool parse_conditions(char **predicates, int count,
+	Db_condition_t *conditions)
+{
+	if(count < 1) {
+		fprintf(stderr, "No conditions given.\n");
+		return false;
+	}
+
+	for(int i = 0; i < count; i++) {
+		if(!parse_condition(predicates[i], &conditions[i]))
+			return false;
+	}
+
+	return true;
+}
+
+//Delete or update, when count > 0, all the entries matching every
+//condition with a single statement in a transaction. Prints the number
+//of affected entries. Returns false on failure.
+static bool write_where(const Db_condition_t *conditions, int ncond,
+	const char **fields, const char **values, int count)
+{
+	Db_t *db = get_connection();
+	bool own_transaction = (db != batch_db);
+	bool passphrase = has_field(fields, count, "passphrase");
+	bool notes = has_field(fields, count, "notes");
+	int changes;
+	bool ok;
+
+	if(db == NULL)
+		return false;
+
+	//Conditions on sealed fields compare the decrypted values
+	for(int i = 0; i < ncond; i++) {
+
+		if(conditions[i].field == NULL)
+			continue;
+
+		passphrase |= strcmp(conditions[i].field, "passphrase") == 0;
+		notes |= strcmp(conditions[i].field, "notes") == 0;
+	}
+
+	if(!unlock_secrets(db, passphrase, notes)) {
+		release_connection(db);
+		return false;
+	}
+
+	if(own_transaction && !db_begin(db)) {
+		release_connection(db);
+		return false;
+	}
+
+	if(count > 0)
+		ok = db_update_where(db, conditions, ncond, fields, values, count,
+			&changes);
+	else
+		ok = db_delete_where(db, conditions, ncond, &changes);
+
+	if(own_transaction) {
+
+		if(ok)
+			ok = db_commit(db);
+
+		if(!ok)
+			db_rollback(db);
+	}
+
+	release_connection(db);
+
+	if(!ok) {
+		fprintf(stderr, "Cannot %s the entries.\n",
+			(count > 0) ? "update" : "delete");
+		return false;
+	}
+
+	printf("%d %s %s.\n", changes, (changes == 1) ? "entry" : "entries",
+		(count > 0) ? "updated" : "deleted");
+
+	return true;
+}
+
+//Delete all the entries matching every predicate, for example
+//"url~old.example.com" and "id=100-200". Returns false on failure.
+//Database must not be encrypted.
+bool delete_where(char **predicates, int count)
+{
+	if(!steel_tracker_file_exists())
+		return false;
+
+	Db_condition_t conditions[count > 0 ? count : 1];
+
+	if(!parse_conditions(predicates, count, conditions))
+		return false;
+
+	return write_where(conditions, count, NULL, NULL, 0);
+}
+
+//Replace fields of all the entries matching every predicate.
+//Assignments are "field=value" like with replace_parts().
+//Returns false on failure. Database must not be encrypted.
+bool update_where(char **predicates, int count, char **assignments,
+	int nassign)
+{
+	if(!steel_tracker_file_exists())
+		return false;
+
+	Db_condition_t conditions[count > 0 ? count : 1];
+	const char *fields[nassign > 0 ? nassign : 1];
+	const char *values[nassign > 0 ? nassign : 1];
+	size_t pwdlen = 255;
+	char pass[pwdlen];
+
+	if(!parse_conditions(predicates, count, conditions))
+		return false;
+
+	if(nassign < 1) {
+		fprintf(stderr, "Nothing to update, use --set <field>=<value>.\n");
+		return false;
+	}
+
+	if(!parse_assignments(assignments, nassign, fields, values))
+		return false;
+
+	if(!ask_missing_passphrase(fields, values, nassign, pass, pwdlen))
+		return false;
+
+	return write_where(conditions, count, fields, values, nassign);
+}
+
+//Function generates new password and prints it to stdout.
+//Does not use the database, so this function can be called
+//even if the database is encrypted.
+void generate_password(int length, int count)
+{
+	if(length < 6) {
+		fprintf(stderr, "Minimum length is 6 characters.\n");
+		return;
+	}
+	
+	for(int i = 0; i < count; i++) {
+		
+		char *pass = generate_pass(length);
+		
+		if(pass == NULL) {
+			fprintf(stderr, "Generating new password failed.\n");
+			return;
+		}
+		
+		printf("%s\n", pass);
+		
+		free(pass);
+	}
+}
+
+//Show all tracked databases, including their encryption status and last
+//modified date.
+void show_database_statuses()
+{
+	int count;
+	FILE *fp = NULL;
+	//char *line = NULL;
+	
+	if(!steel_tracker_file_exists())
+		return;
+
+	fp = status_get_file_ptr("r");
+
+	if(fp == NULL)
+		return;
+
+	count = status_count_file_lines(fp);
+
+	if(count == -2) {
+		fprintf(stdout, "No databases found.\n");
+		fclose(fp);
+		return;
+	}
+
+	rewind(fp);
 	
 	while(count >= 0) {
 		char *line = NULL;
@@ -555,6 +1507,9 @@ void show_database_statuses()
 		if(is_file_encrypted(line))
 			fprintf(stdout, "%s\t%s\t%s\n", "[Encrypted]", 
 				db_last_modified(line), line);
+		else if(is_file_paged(line))
+			fprintf(stdout, "%s\t%s\t%s\n", "[Paged]", 
+				db_last_modified(line), line);
 		else
 			fprintf(stdout, "%s\t%s\t%s\n", "[Decrypted]", 
 				db_last_modified(line), line);
@@ -622,94 +1577,928 @@ void backup_import_database(const char *source, const char *dest)
 	}
 }
 
-void show_passphrase_only(int id)
+//Print only some fields of entries, in the same order as the ids
+//are given. Layout is the format used for printing, for example
+//"{passphrase}".
+static void show_fields_only(const int *ids, int count, const char *layout)
 {
 	if(!steel_tracker_file_exists())
 		return;
 	
-	Entry_t *entry = db_get_entry_by_id(id);
+	Entry_t **index = NULL;
+	Entry_t *entry = NULL;
+	int found;
+	Format_t *format = format_compile(layout);
 	
-	if(entry == NULL) {
-		fprintf(stderr, "Cannot process entry with id %d.\n", id);
+	if(format == NULL)
 		return;
-	}
 	
-	//Skip the first one, it's initialization data.
-	Entry_t *next = entry->next;
+	Entry_t *list = fetch_entries(ids, count, format, &index, &found);
 	
-	if(next != NULL)
-		fprintf(stdout, "%s\n", next->pwd);
-	else
-		printf("No entry found with id %d.\n", id);
-
-	list_free(entry);	
-}
-
-void show_username_only(int id)
-{
-	if(!steel_tracker_file_exists())
+	if(list == NULL) {
+		fprintf(stderr, "Cannot process the entries.\n");
+		format_free(format);
 		return;
+	}
 	
-	Entry_t *entry = db_get_entry_by_id(id);
-	
-	if(entry == NULL) {
-		fprintf(stderr, "Cannot process entry with id %d.\n", id);
-		return;
+	for(int i = 0; i < count; i++) {
+		
+		entry = lookup_entry(index, found, ids[i]);
+		
+		if(entry != NULL)
+			list_print_format(entry, format);
+		else
+			print_not_found(ids[i]);
 	}
 	
-	//Skip the first one, it's initialization data.
-	Entry_t *next = entry->next;
+	output_flush();
 	
-	if(next != NULL)
-		fprintf(stdout, "%s\n", next->user);
-	else
-		printf("No entry found with id %d.\n", id);
+	free(index);
+	list_free(list);
+	format_free(format);
+}
 
-	list_free(entry);
+void show_passphrase_only(const int *ids, int count)
+{
+	show_fields_only(ids, count, "{passphrase}");
 }
 
-void show_url_only(int id)
+void show_username_only(const int *ids, int count)
 {
-	if(!steel_tracker_file_exists())
-		return;
-	
-	Entry_t *entry = db_get_entry_by_id(id);
-	
-	if(entry == NULL) {
-		fprintf(stderr, "Cannot process entry with id %d.\n", id);
-		return;
+	show_fields_only(ids, count, "{user}");
+}
+
+void show_url_only(const int *ids, int count)
+{
+	show_fields_only(ids, count, "{url}");
+}
+
+void show_notes_only(const int *ids, int count)
+{
+	show_fields_only(ids, count, "{notes}");
+}
+
+//Maximum number of words on one line in batch mode
+#define BATCH_MAX_WORDS (64)
+
+//Split line to at most max words in place. Words are separated by
+//white space, quotes group words and backslash escapes the next
+//character, like in the shell. Rest of the line after # is a comment.
+//Returns number of words or -1 on error.
+static int split_batch_line(char *line, char **words, int max)
+{
+	char *src = line;
+	char *dst = line;
+	char quote;
+	int count = 0;
+
+	while(true) {
+
+		while(isspace((unsigned char)*src))
+			src++;
+
+		if(*src == '\0' || *src == '#')
+			break;
+
+		if(count == max) {
+			fprintf(stderr, "Too many words.\n");
+			return -1;
+		}
+
+		words[count++] = dst;
+		quote = '\0';
+
+		while(*src != '\0') {
+
+			if(quote == '\0' && isspace((unsigned char)*src))
+				break;
+
+			if(quote == '\0' && (*src == '"' || *src == '\'')) {
+				quote = *src++;
+				continue;
+			}
+
+			if(quote != '\0' && *src == quote) {
+				quote = '\0';
+				src++;
+				continue;
+			}
+
+			if(*src == '\\' && quote != '\'' && src[1] != '\0')
+				src++;
+
+			*dst++ = *src++;
+		}
+
+		if(quote != '\0') {
+			fprintf(stderr, "Missing closing quote.\n");
+			return -1;
+		}
+
+		if(*src != '\0')
+			src++;
+
+		*dst++ = '\0';
 	}
-	
-	//Skip the first one, it's initialization data.
-	Entry_t *next = entry->next;
-	
-	if(next != NULL)
-		fprintf(stdout, "%s\n", next->url);
-	else
-		printf("No entry found with id %d.\n", id);
-	
-	list_free(entry);
+
+	return count;
 }
 
-void show_notes_only(int id)
+//Parse id of a batch command. Returns false if str is not a single id.
+static bool parse_batch_id(const char *str, int *id)
 {
-	if(!steel_tracker_file_exists())
-		return;
-	
-	Entry_t *entry = db_get_entry_by_id(id);
-	
-	if(entry == NULL) {
-		fprintf(stderr, "Cannot process entry with id %d.\n", id);
-		return;
+	int count;
+	int *ids = parse_id_list(str, &count);
+
+	if(ids == NULL)
+		return false;
+
+	*id = ids[0];
+	free(ids);
+
+	if(count != 1) {
+		fprintf(stderr, "Only one id expected.\n");
+		return false;
+	}
+
+	return true;
+}
+
+//Run one batch command. Returns false on failure.
+static bool run_batch_command(char **words, int count)
+{
+	const char *command = words[0];
+	int *ids = NULL;
+	int id;
+
+	if(strcmp(command, "add") == 0 && count >= 2 && count <= 5) {
+		return add_new_entry(words[1], count > 2 ? words[2] : "",
+			count > 3 ? words[3] : "", count > 4 ? words[4] : "");
+	}
+
+	if(strcmp(command, "delete") == 0 && count == 2) {
+
+		if(!parse_batch_id(words[1], &id))
+			return false;
+
+		return delete_entry(id);
+	}
+
+	if(strcmp(command, "replace") == 0 && count >= 3) {
+
+		if(!parse_batch_id(words[1], &id))
+			return false;
+
+		//Old form: replace <id> <what> <content>
+		if(count == 4 && strchr(words[2], '=') == NULL
+			&& strcmp(words[2], "passphrase") != 0)
+			return replace_part(id, words[2], words[3]);
+
+		return replace_parts(id, &words[2], count - 2);
+	}
+
+	if(strcmp(command, "show") == 0 && count == 2) {
+
+		ids = parse_id_list(words[1], &id);
+
+		if(ids == NULL)
+			return false;
+
+		show_entries(ids, id);
+		free(ids);
+
+		return true;
+	}
+
+	fprintf(stderr, "Unknown command or wrong number of arguments: %s\n",
+		command);
+
+	return false;
+}
+
+//Run add commands read from stdin against the closed database in path,
+//which has an inbox. Entries are sealed into the inbox with one write
+//at the end, all of them or none. Returns false on failure.
+static bool run_inbox_batch(const char *path)
+{
+	char *line = NULL;
+	size_t len = 0;
+	char *words[BATCH_MAX_WORDS];
+	int count;
+	int lineno = 0;
+	bool ok = true;
+
+	inbox_batch = list_create("", "", "", "", "", -1, NULL);
+
+	if(inbox_batch == NULL)
+		return false;
+
+	while(getline(&line, &len, stdin) != -1) {
+
+		lineno++;
+		count = split_batch_line(line, words, BATCH_MAX_WORDS);
+
+		if(count == 0)
+			continue;
+
+		if(count > 0 && strcmp(words[0], "add") != 0) {
+			fprintf(stderr, "Only add can be used while %s is closed.\n",
+				path);
+			ok = false;
+			break;
+		}
+
+		if(count < 0 || !run_batch_command(words, count)) {
+			ok = false;
+			break;
+		}
+	}
+
+	free(line);
+
+	if(ok)
+		ok = inbox_add(path, inbox_batch->next);
+	else
+		fprintf(stderr, "Batch failed on line %d, no changes were made.\n",
+			lineno);
+
+	list_free(inbox_batch);
+	inbox_batch = NULL;
+
+	return ok;
+}
+
+//Run commands read from stdin, one per line, against the open database.
+//Commands are add, replace, delete and show, taking the same arguments
+//as the corresponding options. All the commands run in one transaction,
+//so the changes are written with a single sync at the end. If any
+//command fails, nothing is written. If the database is closed but has
+//an inbox, only add can be used. Returns false on failure.
+bool run_batch()
+{
+	char *line = NULL;
+	size_t len = 0;
+	char *words[BATCH_MAX_WORDS];
+	int count;
+	int lineno = 0;
+	bool ok = true;
+	char *inbox = NULL;
+
+	if(!steel_tracker_file_exists())
+		return false;
+
+	if(passphrase_stream != NULL && fileno(passphrase_stream) == 0) {
+		fprintf(stderr, "Commands are read from stdin, use another fd " \
+		"for the passphrases.\n");
+		return false;
+	}
+
+	inbox = get_inbox_path();
+
+	if(inbox != NULL) {
+		ok = run_inbox_batch(inbox);
+		free(inbox);
+		return ok;
+	}
+
+	//Commands come from stdin, there's no terminal to ask the
+	//passphrase of a paged database from
+	if(passphrase_stream == NULL) {
+		char *path = db_get_path();
+		bool locked = path != NULL && db_is_locked(path);
+
+		free(path);
+
+		if(locked) {
+			fprintf(stderr, "Use --passphrase-fd to give passphrases " \
+			"in batch mode.\n");
+			return false;
+		}
+	}
+
+	if(!unlock_database())
+		return false;
+
+	batch_db = db_connect();
+
+	if(batch_db == NULL)
+		return false;
+
+	//Sealed fields are unlocked up front, so the master passphrase
+	//always comes before the passphrases of the entries
+	if(!unlock_secrets(batch_db, true, true) || !db_begin(batch_db)) {
+		db_disconnect(batch_db);
+		batch_db = NULL;
+		return false;
+	}
+
+	while(getline(&line, &len, stdin) != -1) {
+
+		lineno++;
+		count = split_batch_line(line, words, BATCH_MAX_WORDS);
+
+		if(count == 0)
+			continue;
+
+		if(count < 0 || !run_batch_command(words, count)) {
+			ok = false;
+			break;
+		}
+	}
+
+	free(line);
+
+	if(ok)
+		ok = db_commit(batch_db);
+	else
+		fprintf(stderr, "Batch failed on line %d, no changes were made.\n",
+			lineno);
+
+	if(!ok)
+		db_rollback(batch_db);
+
+	db_disconnect(batch_db);
+	batch_db = NULL;
+
+	return ok;
+}
+
+//Print entries inserted or modified at or after time, given as
+//an UTC date or seconds since the epoch. Database must not be
+//encrypted.
+void show_changed_since(const char *time)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	long long since;
+	Db_t *db = NULL;
+	Entry_t *list = NULL;
+	
+	if(!parse_time(time, &since))
+		return;
+	
+	db = get_print_connection(NULL);
+	
+	if(db == NULL)
+		return;
+	
+	list = db_get_entries_changed_since(db, since);
+	release_connection(db);
+	
+	if(list != NULL) {
+		list_print(list);
+		list_free(list);
+	}
+}
+
+//Print ids of entries deleted at or after time, one per line.
+//Database must not be encrypted.
+void show_deleted_since(const char *time)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	long long since;
+	int count;
+	int *ids = NULL;
+	Db_t *db = NULL;
+	
+	if(!parse_time(time, &since))
+		return;
+	
+	db = get_connection();
+	
+	if(db == NULL)
+		return;
+	
+	ids = db_get_deleted_since(db, since, &count);
+	release_connection(db);
+	
+	if(ids == NULL)
+		return;
+	
+	for(int i = 0; i < count; i++) {
+		output_int(ids[i]);
+		output_char('\n');
+	}
+	
+	output_flush();
+	free(ids);
+}
+
+//Print revision history of entry id, newest revision first.
+//Only the fields changed by each revision are printed, with the
+//values they had before the change. Database must not be encrypted.
+void show_history(int id)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	static const char *labels[] = {
+		"Title\t\t", "Username\t", "Passphrase\t", "Address\t\t",
+		"Notes\t\t"
+	};
+	Revision_t *history = NULL;
+	Db_t *db = get_connection();
+	char date[64];
+	time_t changed;
+	
+	if(db == NULL)
+		return;
+	
+	if(!unlock_secrets(db, true, true)) {
+		release_connection(db);
+		return;
+	}
+	
+	if(!db_get_history(db, id, &history)) {
+		fprintf(stderr, "Cannot read history of entry %d.\n", id);
+		release_connection(db);
+		return;
+	}
+	
+	release_connection(db);
+	
+	if(history == NULL) {
+		printf("No history for entry %d.\n", id);
+		return;
+	}
+	
+	for(Revision_t *rev = history; rev != NULL; rev = rev->next) {
+		
+		changed = (time_t)rev->time;
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S UTC",
+			gmtime(&changed));
+		
+		OUTPUT_LITERAL("\nChanged\t\t");
+		output_str(date);
+		
+		if(rev->deleted)
+			OUTPUT_LITERAL(" (deleted)");
+		
+		output_char('\n');
+		
+		for(int i = 0; i < 5; i++) {
+			
+			if(rev->values[i] == NULL)
+				continue;
+			
+			output_str(labels[i]);
+			output_str(rev->values[i]);
+			output_char('\n');
+		}
+		
+		output_repeat('-', 40);
+		output_char('\n');
+	}
+	
+	output_flush();
+	db_free_history(history);
+}
+
+//Set how many revisions are kept for each entry.
+//Database must not be encrypted.
+void set_history_limit(int limit)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	Db_t *db = NULL;
+	
+	if(limit < 0) {
+		fprintf(stderr, "History limit can't be negative.\n");
+		return;
+	}
+	
+	db = get_connection();
+	
+	if(db == NULL)
+		return;
+	
+	if(!db_set_history_limit(db, limit))
+		fprintf(stderr, "Cannot set the history limit.\n");
+	
+	release_connection(db);
+}
+
+//Seal fields, "passphrase", "notes" or both separated by a comma, of
+//all the entries. Sealed fields stay encrypted even when the database
+//is open, and reading them needs the master passphrase. Sealing the
+//notes seals the passphrases too. Returns false on failure.
+bool seal_fields(const char *fields)
+{
+	if(!steel_tracker_file_exists())
+		return false;
+	
+	size_t pwdlen = 255;
+	char pass[pwdlen];
+	int mask = 0;
+	const char *ptr = fields;
+	size_t len;
+	Db_t *db = NULL;
+	bool ok;
+	
+	while(*ptr != '\0') {
+		
+		len = strcspn(ptr, ",");
+		
+		if(len == strlen("passphrase") &&
+			strncmp(ptr, "passphrase", len) == 0)
+			mask |= DB_SECRET_PASSPHRASE;
+		else if(len == strlen("notes") && strncmp(ptr, "notes", len) == 0)
+			mask |= DB_SECRET_NOTES;
+		else {
+			fprintf(stderr, "Only passphrase and notes can be sealed.\n");
+			return false;
+		}
+		
+		ptr += len;
+		
+		if(*ptr == ',')
+			ptr++;
+	}
+	
+	if(mask == 0) {
+		fprintf(stderr, "Only passphrase and notes can be sealed.\n");
+		return false;
 	}
 	
-	//Skip the first one, it's initialization data.
-	Entry_t *next = entry->next;
-	
-	if(next != NULL)
-		fprintf(stdout, "%s\n", next->notes);
+	db = get_connection();
+	
+	if(db == NULL)
+		return false;
+	
+	//Sealing the first time chooses the master passphrase of the
+	//sealed fields
+	if(db->sealed == 0)
+		ok = ask_passphrase(MASTER_PWD_PROMPT, MASTER_PWD_PROMPT_RETRY,
+			pass, pwdlen);
 	else
-		printf("No entry found with id %d.\n", id);
+		ok = unlock_secrets(db, true, true);
 	
-	list_free(entry);
-}
\ No newline at end of file
+	if(ok && db_begin(db)) {
+		
+		ok = db_seal_fields(db, pass, mask);
+		
+		if(ok)
+			ok = db_commit(db);
+		
+		if(!ok)
+			db_rollback(db);
+	}
+	else
+		ok = false;
+	
+	if(ok)
+		printf("Sealed %s.\n", (db->sealed & DB_SECRET_NOTES) ?
+			"passphrases and notes" : "passphrases");
+	else
+		fprintf(stderr, "Cannot seal the fields.\n");
+	
+	release_connection(db);
+	
+	return ok;
+}
+
+//Compile a snapshot of all the entries of the open database to path,
+//for hosts which only look entries up. Returns false on failure.
+bool compile_snapshot(const char *path)
+{
+	if(!steel_tracker_file_exists())
+		return false;
+	
+	Db_t *db = get_connection();
+	Entry_t *list = NULL;
+	bool ok;
+	
+	if(db == NULL)
+		return false;
+	
+	if(!unlock_secrets(db, true, true)) {
+		release_connection(db);
+		return false;
+	}
+	
+	list = db_get_all_entries(db);
+	release_connection(db);
+	
+	if(list == NULL) {
+		fprintf(stderr, "Cannot compile the snapshot.\n");
+		return false;
+	}
+	
+	ok = snapshot_compile(list, path);
+	list_free(list);
+	
+	if(ok)
+		printf("Snapshot written to %s.\n", path);
+	
+	return ok;
+}
+
+//Show the entries of the snapshot in path matching query, which is
+//"id:<id>", "title:<title>" or "host:<host>". No database is needed.
+//Returns false if there's no such entry.
+bool show_snapshot_entries(const char *path, const char *query)
+{
+	static const char *prefixes[] = {
+		[SNAPSHOT_ID] = "id:",
+		[SNAPSHOT_TITLE] = "title:",
+		[SNAPSHOT_HOST] = "host:"
+	};
+	Snapshot_key_t kind = SNAPSHOT_ID;
+	const char *value = NULL;
+	Entry_t *list = NULL;
+	bool found;
+	
+	for(int i = SNAPSHOT_ID; i <= SNAPSHOT_HOST; i++) {
+		
+		if(strncmp(query, prefixes[i], strlen(prefixes[i])) == 0) {
+			kind = i;
+			value = query + strlen(prefixes[i]);
+		}
+	}
+	
+	if(value == NULL || value[0] == '\0' || (kind == SNAPSHOT_ID &&
+		strspn(value, "0123456789") != strlen(value))) {
+		fprintf(stderr, "Invalid query %s. Use id:<id>, title:<title> " \
+			"or host:<host>.\n", query);
+		return false;
+	}
+	
+	list = snapshot_lookup(path, kind, value);
+	
+	if(list == NULL)
+		return false;
+	
+	found = (list->next != NULL);
+	
+	if(found)
+		list_print(list);
+	else if(kind == SNAPSHOT_ID)
+		print_not_found(atoi(value));
+	else
+		fprintf(stderr, "No entries found for %s.\n", query);
+	
+	list_free(list);
+	
+	return found;
+}
+
+//Returns true if path can be rekeyed: it's a closed database, or a
+//paged one which is not open. Otherwise explains why.
+static bool can_rekey(const char *path, const char *open_path)
+{
+	if(open_path != NULL && strcmp(open_path, path) == 0) {
+		fprintf(stderr, "Close %s first before changing its " \
+			"passphrase.\n", path);
+		return false;
+	}
+
+	if(!db_file_exists(path)) {
+		fprintf(stderr, "Database file %s does not exist.\n", path);
+		return false;
+	}
+
+	if(!is_file_encrypted(path) && !is_file_paged(path)) {
+		fprintf(stderr, "%s is not a closed database.\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+//Change the master passphrase of the closed database in path, or of
+//all the tracked closed databases if path is NULL, in one pass over
+//each without decrypting it on disk. Tracked databases which are open
+//are skipped. Returns false if any of them fails.
+bool change_passphrase(const char *path)
+{
+	if(!steel_tracker_file_exists())
+		return false;
+	
+	size_t pwdlen = 255;
+	char old_passphrase[pwdlen];
+	char new_passphrase[pwdlen];
+	char *open_path = NULL;
+	char **paths = NULL;
+	bool *results = NULL;
+	char *line = NULL;
+	int count = 0;
+	bool ok = false;
+	FILE *fp = NULL;
+	
+	open_path = read_path_from_lockfile();
+	
+	if(path != NULL) {
+		
+		if(!can_rekey(path, open_path)) {
+			free(open_path);
+			return false;
+		}
+		
+		paths = malloc(sizeof(char *));
+		
+		if(paths != NULL)
+			paths[count++] = strdup(path);
+	}
+	else if((fp = status_get_file_ptr("r")) != NULL) {
+		
+		while((line = status_read_file_line(fp)) != NULL) {
+			char **tmp = NULL;
+			
+			if(!can_rekey(line, open_path)) {
+				free(line);
+				continue;
+			}
+			
+			tmp = realloc(paths, (count + 1) * sizeof(char *));
+			
+			if(tmp == NULL) {
+				free(line);
+				break;
+			}
+			
+			paths = tmp;
+			paths[count++] = line;
+		}
+		
+		fclose(fp);
+	}
+	
+	free(open_path);
+	
+	if(count == 0) {
+		fprintf(stderr, "No closed databases found.\n");
+		free(paths);
+		return false;
+	}
+	
+	results = calloc(count, sizeof(bool));
+	
+	if(results == NULL)
+		fprintf(stderr, "Malloc failed\n");
+	else if(ask_passphrase(MASTER_PWD_PROMPT, NULL, old_passphrase, pwdlen) &&
+		ask_passphrase(NEW_MASTER_PWD_PROMPT, NEW_MASTER_PWD_PROMPT_RETRY,
+			new_passphrase, pwdlen)) {
+		
+		ok = rekey_databases(paths, count, old_passphrase, new_passphrase,
+			results);
+		
+		for(int i = 0; i < count; i++) {
+			
+			if(!results[i])
+				fprintf(stderr, "Changing the passphrase of %s " \
+					"failed.\n", paths[i]);
+		}
+		
+		memset(new_passphrase, 0, pwdlen);
+	}
+	
+	memset(old_passphrase, 0, pwdlen);
+	
+	for(int i = 0; i < count; i++)
+		free(paths[i]);
+	
+	free(paths);
+	free(results);
+	
+	return ok;
+}
+
+//Add or remove tag of entries with ids in one transaction.
+static void change_tags(const char *tag, const int *ids, int count,
+	bool untag)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	Db_t *db = NULL;
+	bool own_transaction;
+	int changes;
+	bool ok;
+	
+	if(tag[0] == '\0') {
+		fprintf(stderr, "Tag can't be empty.\n");
+		return;
+	}
+	
+	db = get_connection();
+	
+	if(db == NULL)
+		return;
+	
+	own_transaction = (db != batch_db);
+	
+	if(own_transaction && !db_begin(db)) {
+		release_connection(db);
+		return;
+	}
+	
+	if(untag)
+		ok = db_untag_entries(db, tag, ids, count, &changes);
+	else
+		ok = db_tag_entries(db, tag, ids, count, &changes);
+	
+	if(own_transaction) {
+		
+		if(ok)
+			ok = db_commit(db);
+		
+		if(!ok)
+			db_rollback(db);
+	}
+	
+	release_connection(db);
+	
+	if(!ok) {
+		fprintf(stderr, "Cannot %s the entries.\n", untag ? "untag" : "tag");
+		return;
+	}
+	
+	printf("%s %d %s.\n", untag ? "Untagged" : "Tagged", changes,
+		(changes == 1) ? "entry" : "entries");
+}
+
+//Tag entries with ids. Database must not be encrypted.
+void tag_entries(const char *tag, const int *ids, int count)
+{
+	change_tags(tag, ids, count, false);
+}
+
+//Remove tag from entries with ids. Database must not be encrypted.
+void untag_entries(const char *tag, const int *ids, int count)
+{
+	change_tags(tag, ids, count, true);
+}
+
+//Print entries for host, including the entries of its parent domains,
+//most specific host first. Database must not be encrypted.
+void show_entries_for_host(const char *host)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	Db_t *db = get_print_connection(NULL);
+	Entry_t *list = NULL;
+	
+	if(db == NULL)
+		return;
+	
+	list = db_get_entries_for_host(db, host);
+	release_connection(db);
+	
+	if(list != NULL) {
+		list_print(list);
+		list_free(list);
+	}
+}
+
+//Print one page of entries sorted by sort, which can be "id", "title",
+//"url" or "modified". The page starts after the entry with id after,
+//if it's not negative, and has at most limit entries, or all the rest
+//if limit is negative. Database must not be encrypted.
+void show_entries_page(const char *sort, int after, int limit)
+{
+	if(!steel_tracker_file_exists())
+		return;
+	
+	static const char *names[] = {
+		[DB_SORT_ID] = "id",
+		[DB_SORT_TITLE] = "title",
+		[DB_SORT_URL] = "url",
+		[DB_SORT_MODIFIED] = "modified"
+	};
+	Db_sort_t order = DB_SORT_ID;
+	bool known = false;
+	Db_t *db = NULL;
+	Entry_t *list = NULL;
+	
+	for(int i = 0; sort != NULL && i <= DB_SORT_MODIFIED; i++) {
+		
+		if(strcmp(names[i], sort) == 0) {
+			order = i;
+			known = true;
+		}
+	}
+	
+	if(sort != NULL && !known) {
+		fprintf(stderr, "Unknown sort %s. Use id, title, url or " \
+			"modified.\n", sort);
+		return;
+	}
+	
+	db = get_print_connection(NULL);
+	
+	if(db == NULL)
+		return;
+	
+	list = db_get_entries_page(db, order, after, limit);
+	release_connection(db);
+	
+	if(list != NULL) {
+		list_print(list);
+		list_free(list);
+	}
+}
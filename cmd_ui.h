@@ -23,27 +23,50 @@
 
 #define MASTER_PWD_PROMPT "Master passphrase: "
 #define MASTER_PWD_PROMPT_RETRY "Retype master passphrase: "
+#define NEW_MASTER_PWD_PROMPT "New master passphrase: "
+#define NEW_MASTER_PWD_PROMPT_RETRY "Retype new master passphrase: "
 #define ENTRY_PWD_PROMPT "Enter new passphrase: "
 #define ENTRY_PWD_PROMPT_RETRY "Retype new passphrase: "
 
-void add_new_entry(char *title, char *user, char *url, char *note);
-bool init_database(const char *path);
+bool add_new_entry(char *title, char *user, char *url, char *note);
+bool init_database(const char *path, bool paged, bool log);
 bool open_database(const char *path);
-void close_database();
-void show_all_entries();
-void show_one_entry(int id);
-void delete_entry(int id);
+void close_database(bool paged);
+void show_all_entries(const char *tag);
+void show_entries_page(const char *sort, int after, int limit);
+void show_entries(const int *ids, int count);
+bool delete_entry(int id);
 void find_entries(const char *search);
+void show_entries_for_host(const char *host);
+void show_changed_since(const char *time);
+void show_deleted_since(const char *time);
+void show_history(int id);
+void set_history_limit(int limit);
+bool seal_fields(const char *fields);
+bool compile_snapshot(const char *path);
+bool create_inbox();
+bool change_passphrase(const char *path);
+bool show_snapshot_entries(const char *path, const char *query);
+void tag_entries(const char *tag, const int *ids, int count);
+void untag_entries(const char *tag, const int *ids, int count);
 size_t my_getpass(char *prompt, char **lineptr, size_t *n, FILE *stream);
-void replace_part(int id, const char *what, const char *new_data);
+bool replace_part(int id, const char *what, const char *new_data);
+bool replace_parts(int id, char **assignments, int count);
+bool delete_where(char **predicates, int count);
+bool update_where(char **predicates, int count, char **assignments,
+	int nassign);
 void generate_password(int length, int count);
 void show_database_statuses();
 void remove_database(const char *path);
 void backup_database(const char *source, const char *dest);
 void backup_import_database(const char *source, const char *dest);
-void show_passphrase_only(int id);
-void show_username_only(int id);
-void show_url_only(int id);
-void show_notes_only(int id);
+void show_passphrase_only(const int *ids, int count);
+void show_username_only(const int *ids, int count);
+void show_url_only(const int *ids, int count);
+void show_notes_only(const int *ids, int count);
+int *parse_id_list(const char *str, int *count);
+int *read_id_list(const char *path, int *count);
+bool set_passphrase_fd(int fd);
+bool run_batch();
 
 #endif
@@ -21,11 +21,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mcrypt.h>
 #include <stdint.h>
 #include <mhash.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 
 #ifdef __MACH__
 #include <mach/clock.h>
@@ -34,12 +36,39 @@
 
 #include "crypto.h"
 #include "bcrypt/bcrypt.h"
+#include "x25519.h"
+#include "rijndael.h"
 
 //Our magic number that's written into the
 //encrypted file. Used to determine if the file
 //is encrypted.
 static const int MAGIC_HEADER = 0x33497545;
 
+//Size of the header of files encrypted with encrypt_file(): bcrypt
+//hash, magic, IV and salt of the key. Data and HMAC follow it.
+#define REKEY_HEADER_SIZE (BCRYPT_HASHSIZE + sizeof(int) + IV_SIZE + \
+	BCRYPT_HASHSIZE)
+
+//Size of the chunks files are encrypted and decrypted in
+#define CRYPT_CHUNK_SIZE (65536)
+
+//Size of the ranges decrypted concurrently by decrypt_data()
+#define CRYPT_RANGE_SIZE (1048576)
+
+//Cipher of the files, Rijndael-256 in 8-bit CFB mode. The in-tree
+//implementation is used if the CPU supports it, libmcrypt otherwise or
+//if Steel is built with -DMCRYPT_CIPHER. The two produce the same data.
+typedef struct Cipher
+{
+	Rijndael_cfb_t cfb;
+	MCRYPT td; //MCRYPT_FAILED when cfb is used
+
+} Cipher_t;
+
+//Magic number of paged files. Paged files are never decrypted as a
+//whole, their content is encrypted in pages by the caller.
+static const int PAGED_MAGIC_HEADER = 0x33497546;
+
 //Function appends ext to the orig string.
 //Returns new string on success, NULL on failure.
 //Caller must free the return value.
@@ -93,15 +122,15 @@ static char *generate_random_data(int size)
 	return data;
 }
 
-//Function generates bcrypt hash from passphrase and writes it
-//to the current cursor location of fOut file pointer.
-//Return true on success, false on failure.
-static bool write_bcrypt_hash(FILE *fOut, const char *passphrase)
+//Function generates bcrypt hash of BCRYPT_HASHSIZE bytes from
+//passphrase to hash. Return true on success, false on failure.
+static bool get_bcrypt_hash(const char *passphrase, char *hash)
 {
 	char salt[BCRYPT_HASHSIZE];
-	char hash[BCRYPT_HASHSIZE] = {0};
 	int ret;
 
+	memset(hash, 0, BCRYPT_HASHSIZE);
+
 	ret = bcrypt_gensalt(BCRYPT_WORK_FACTOR, salt);
 
 	if(ret != 0) {
@@ -116,6 +145,19 @@ static bool write_bcrypt_hash(FILE *fOut, const char *passphrase)
 		return false;
 	}
 
+	return true;
+}
+
+//Function generates bcrypt hash from passphrase and writes it
+//to the current cursor location of fOut file pointer.
+//Return true on success, false on failure.
+static bool write_bcrypt_hash(FILE *fOut, const char *passphrase)
+{
+	char hash[BCRYPT_HASHSIZE];
+
+	if(!get_bcrypt_hash(passphrase, hash))
+		return false;
+
 	fwrite(hash, 1, BCRYPT_HASHSIZE, fOut);
 
 	return true;
@@ -125,12 +167,12 @@ static bool write_bcrypt_hash(FILE *fOut, const char *passphrase)
 //depending if the function was successful or not.
 //Note that Key is always returned, but on failure there might not
 //be data and/or salt. Only use the key is success is true.
-static Key_t generate_key(const char *passphrase, bool *success)
+Key_t generate_key(const char *passphrase, bool *success)
 {
 	int ret;
 	char *keybytes = NULL;
 	Key_t key;
-	char salt[BCRYPT_HASHSIZE];
+	char salt[BCRYPT_HASHSIZE] = {0};
 	char hash[BCRYPT_HASHSIZE] = {0};
 
 	keybytes = calloc(1, KEY_SIZE);
@@ -181,7 +223,7 @@ static Key_t generate_key(const char *passphrase, bool *success)
 
 //Generates new key from existing salt. Otherwise function works similary as the
 //one above.
-static Key_t generate_key_salt(const char *passphrase, char *salt, bool *success)
+Key_t generate_key_salt(const char *passphrase, char *salt, bool *success)
 {
 	int ret;
 	char *keybytes = NULL;
@@ -342,6 +384,504 @@ bool hmac_file_content(const char *path, Key_t key)
 	return true;
 }
 
+//Stream of /dev/urandom, opened once by fill_random()
+static FILE *frnd = NULL;
+static pthread_once_t frnd_once = PTHREAD_ONCE_INIT;
+
+static void open_random()
+{
+	frnd = fopen("/dev/urandom", "r");
+}
+
+//Fill data with size bytes of random data from /dev/urandom.
+//The device is kept open, as this is called for every page written
+//to a paged file. Safe to call from several threads.
+//Returns false on failure.
+bool fill_random(char *data, int size)
+{
+	pthread_once(&frnd_once, open_random);
+
+	if(frnd == NULL) {
+		fprintf(stderr, "Cannot open /dev/urandom\n");
+		return false;
+	}
+
+	if(fread(data, 1, size, frnd) != (size_t)size) {
+		fprintf(stderr, "Cannot read /dev/urandom\n");
+		return false;
+	}
+
+	return true;
+}
+
+//Initialize cipher for key and IV_SIZE bytes of iv.
+//Returns false on failure.
+static bool cipher_init(Cipher_t *cipher, Key_t key, const char *iv)
+{
+	int ret;
+
+#ifndef MCRYPT_CIPHER
+	if(rijndael_available()) {
+		cipher->td = MCRYPT_FAILED;
+		rijndael_cfb_init(&cipher->cfb, key.data, iv);
+		return true;
+	}
+#endif
+
+	cipher->td = mcrypt_module_open("rijndael-256", NULL, "cfb", NULL);
+
+	if(cipher->td == MCRYPT_FAILED) {
+		fprintf(stderr, "Opening mcrypt module failed\n");
+		return false;
+	}
+
+	ret = mcrypt_generic_init(cipher->td, key.data, KEY_SIZE, (char *)iv);
+
+	if(ret < 0) {
+		mcrypt_perror(ret);
+		mcrypt_module_close(cipher->td);
+		return false;
+	}
+
+	return true;
+}
+
+//Encrypt or decrypt len bytes of data in place. Data can be given in
+//pieces, the cipher continues from the end of the previous one.
+//Returns false on failure.
+static bool cipher_crypt(Cipher_t *cipher, char *data, long len,
+	bool decrypt)
+{
+	if(cipher->td == MCRYPT_FAILED) {
+
+		if(decrypt)
+			rijndael_cfb_decrypt(&cipher->cfb, data, len);
+		else
+			rijndael_cfb_encrypt(&cipher->cfb, data, len);
+
+		return true;
+	}
+
+	if(decrypt)
+		return mdecrypt_generic(cipher->td, data, len) == 0;
+
+	return mcrypt_generic(cipher->td, data, len) == 0;
+}
+
+static void cipher_close(Cipher_t *cipher)
+{
+	if(cipher->td != MCRYPT_FAILED) {
+		mcrypt_generic_deinit(cipher->td);
+		mcrypt_module_close(cipher->td);
+	}
+	else
+		memset(&cipher->cfb, 0, sizeof(cipher->cfb));
+}
+
+//Encrypt or decrypt len bytes of data in place with key and
+//IV_SIZE bytes of iv, using the same cipher as encrypt_file().
+//Returns false on failure.
+bool crypt_data(char *data, long len, const char *iv, Key_t key,
+	bool decrypt)
+{
+	Cipher_t cipher;
+	bool success;
+
+	if(!cipher_init(&cipher, key, iv))
+		return false;
+
+	success = cipher_crypt(&cipher, data, len, decrypt);
+	cipher_close(&cipher);
+
+	return success;
+}
+
+//Seal len bytes of data with key: encrypt it with a new IV and
+//authenticate IV and ciphertext. Sealed data is the IV, ciphertext and
+//HMAC, its length is stored to sealed_len. Returns NULL on failure.
+//Caller must free the return value.
+char *seal_data(const char *data, long len, Key_t key, long *sealed_len)
+{
+	char *sealed = NULL;
+	unsigned char *mac = NULL;
+
+	sealed = malloc(IV_SIZE + len + HMAC_SIZE);
+
+	if(sealed == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return NULL;
+	}
+
+	memcpy(sealed + IV_SIZE, data, len);
+
+	if(!fill_random(sealed, IV_SIZE) ||
+		!crypt_data(sealed + IV_SIZE, len, sealed, key, false)) {
+		free(sealed);
+		return NULL;
+	}
+
+	mac = get_data_hmac(sealed, IV_SIZE + len, key);
+
+	if(mac == NULL) {
+		free(sealed);
+		return NULL;
+	}
+
+	memcpy(sealed + IV_SIZE + len, mac, HMAC_SIZE);
+	free(mac);
+
+	*sealed_len = IV_SIZE + len + HMAC_SIZE;
+
+	return sealed;
+}
+
+//Open data sealed with seal_data(). Returns the data with a
+//terminating null byte, or NULL if key is wrong or the data was
+//tampered. Length of the data is stored to len.
+//Caller must free the return value.
+char *unseal_data(const char *sealed, long sealed_len, Key_t key, long *len)
+{
+	char *data = NULL;
+	unsigned char *mac = NULL;
+	bool match;
+
+	if(sealed_len < IV_SIZE + HMAC_SIZE)
+		return NULL;
+
+	*len = sealed_len - IV_SIZE - HMAC_SIZE;
+
+	mac = get_data_hmac(sealed, IV_SIZE + *len, key);
+
+	if(mac == NULL)
+		return NULL;
+
+	match = verify_hmac((const unsigned char *)sealed + IV_SIZE + *len, mac);
+	free(mac);
+
+	if(!match)
+		return NULL;
+
+	data = malloc(*len + 1);
+
+	if(data == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return NULL;
+	}
+
+	memcpy(data, sealed + IV_SIZE, *len);
+	data[*len] = '\0';
+
+	if(!crypt_data(data, *len, sealed, key, true)) {
+		free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+//Derive the key of a sealed box from the shared secret of the
+//ephemeral and the recipient's key, bound to both public keys.
+//Returns false if shared is zero, the public key was of low order.
+static bool box_key(const unsigned char *shared,
+	const unsigned char *ephemeral, const unsigned char *public_key,
+	Key_t *key)
+{
+	unsigned char keys[BOX_KEY_SIZE * 2];
+	unsigned char zero = 0;
+	unsigned char *mac = NULL;
+
+	for(int i = 0; i < BOX_KEY_SIZE; i++)
+		zero |= shared[i];
+
+	if(zero == 0)
+		return false;
+
+	memcpy(key->data, shared, KEY_SIZE);
+	memcpy(keys, ephemeral, BOX_KEY_SIZE);
+	memcpy(keys + BOX_KEY_SIZE, public_key, BOX_KEY_SIZE);
+
+	mac = get_data_hmac((char *)keys, sizeof(keys), *key);
+
+	if(mac == NULL)
+		return false;
+
+	memcpy(key->data, mac, KEY_SIZE);
+	free(mac);
+
+	return true;
+}
+
+//Generate a new X25519 key pair for sealed boxes.
+//Returns false on failure.
+bool box_keypair(unsigned char *public_key, unsigned char *secret_key)
+{
+	if(!fill_random((char *)secret_key, BOX_KEY_SIZE))
+		return false;
+
+	x25519_base(public_key, secret_key);
+
+	return true;
+}
+
+//Agree on a key with public_key for box_seal(), using a new ephemeral
+//key pair. Data sealed with one box can only be told apart by the
+//recipient, so a box can seal several values sent together.
+//Returns false on failure.
+bool box_seal_init(Box_t *box, const unsigned char *public_key)
+{
+	unsigned char secret[BOX_KEY_SIZE];
+	unsigned char shared[BOX_KEY_SIZE];
+	bool success;
+
+	if(!box_keypair(box->ephemeral, secret))
+		return false;
+
+	x25519(shared, secret, public_key);
+	success = box_key(shared, box->ephemeral, public_key, &box->key);
+	box->ready = success;
+
+	memset(secret, 0, sizeof(secret));
+	memset(shared, 0, sizeof(shared));
+
+	if(!success)
+		fprintf(stderr, "Invalid public key\n");
+
+	return success;
+}
+
+//Seal len bytes of data so that only the holder of the secret key of
+//the public key of box can open it. No secret is needed: data is sealed
+//with seal_data() under the key of box and the ephemeral public key is
+//prepended to it. Length is stored to sealed_len. Returns NULL on
+//failure. Caller must free the return value.
+char *box_seal(Box_t *box, const char *data, long len, long *sealed_len)
+{
+	char *sealed = NULL;
+	char *out = NULL;
+	long len_out;
+
+	sealed = seal_data(data, len, box->key, &len_out);
+
+	if(sealed == NULL)
+		return NULL;
+
+	out = malloc(BOX_KEY_SIZE + len_out);
+
+	if(out == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		free(sealed);
+		return NULL;
+	}
+
+	memcpy(out, box->ephemeral, BOX_KEY_SIZE);
+	memcpy(out + BOX_KEY_SIZE, sealed, len_out);
+	free(sealed);
+
+	*sealed_len = BOX_KEY_SIZE + len_out;
+
+	return out;
+}
+
+//Open data sealed with box_seal() to the public key of secret_key.
+//Key agreed with the ephemeral key is kept in box, which must be
+//zeroed before the first call, and reused while it stays the same.
+//Returns the data with a terminating null byte, or NULL if it was not
+//sealed to this key or was tampered. Length is stored to len.
+//Caller must free the return value.
+char *box_open(Box_t *box, const char *sealed, long sealed_len,
+	const unsigned char *secret_key, long *len)
+{
+	unsigned char public_key[BOX_KEY_SIZE];
+	unsigned char shared[BOX_KEY_SIZE];
+	bool success;
+
+	if(sealed_len < BOX_KEY_SIZE)
+		return NULL;
+
+	if(!box->ready || memcmp(box->ephemeral, sealed, BOX_KEY_SIZE) != 0) {
+
+		x25519_base(public_key, secret_key);
+		x25519(shared, secret_key, (const unsigned char *)sealed);
+		memcpy(box->ephemeral, sealed, BOX_KEY_SIZE);
+
+		success = box_key(shared, box->ephemeral, public_key, &box->key);
+		memset(shared, 0, sizeof(shared));
+
+		box->ready = success;
+
+		if(!success)
+			return NULL;
+	}
+
+	return unseal_data(sealed + BOX_KEY_SIZE, sealed_len - BOX_KEY_SIZE,
+		box->key, len);
+}
+
+//Create a new paged file to path. Only the header is written: bcrypt
+//hash of the passphrase, magic and the salt of the key, in the same
+//layout as in files encrypted with encrypt_file(). Key of the pages is
+//stored to key. Returns false on failure.
+bool init_paged_file(const char *path, const char *passphrase, Key_t *key)
+{
+	FILE *fOut = NULL;
+	bool success;
+
+	*key = generate_key(passphrase, &success);
+
+	if(!success) {
+		fprintf(stderr, "Failed to get new key\n");
+		return false;
+	}
+
+	fOut = fopen(path, "w");
+
+	if(!fOut) {
+		fprintf(stderr, "Failed to open output file\n");
+		return false;
+	}
+
+	if(!write_bcrypt_hash(fOut, passphrase)) {
+		fprintf(stderr, "Bcrypt failed\n");
+		fclose(fOut);
+		remove(path);
+		return false;
+	}
+
+	fwrite((void *)&PAGED_MAGIC_HEADER, sizeof(PAGED_MAGIC_HEADER), 1, fOut);
+	fwrite(key->salt, 1, BCRYPT_HASHSIZE, fOut);
+
+	if(fclose(fOut) != 0) {
+		fprintf(stderr, "Failed to write %s\n", path);
+		remove(path);
+		return false;
+	}
+
+	return true;
+}
+
+//Returns true if file pointed by path is a paged file created
+//with init_paged_file(). Missing file is not an error here.
+bool is_file_paged(const char *path)
+{
+	FILE *fp = NULL;
+	int data = 0;
+
+	fp = fopen(path, "r");
+
+	if(fp == NULL)
+		return false;
+
+	fseek(fp, BCRYPT_HASHSIZE, SEEK_SET);
+
+	fread((void *)&data, sizeof(PAGED_MAGIC_HEADER), 1, fp);
+	fclose(fp);
+
+	return data == PAGED_MAGIC_HEADER;
+}
+
+//Returns true if key belongs to the paged file which has header,
+//PAGED_HEADER_SIZE bytes from the beginning of the file.
+bool is_paged_key(const char *header, Key_t key)
+{
+	int magic;
+
+	memcpy(&magic, header + BCRYPT_HASHSIZE, sizeof(magic));
+
+	return magic == PAGED_MAGIC_HEADER &&
+		memcmp(header + BCRYPT_HASHSIZE + sizeof(magic), key.salt,
+			BCRYPT_HASHSIZE) == 0;
+}
+
+//Verify passphrase against the header of the paged file pointed by
+//path and derive the key of the pages to key.
+//Returns false on failure.
+bool get_paged_key(const char *path, const char *passphrase, Key_t *key)
+{
+	FILE *fIn = NULL;
+	char hash[BCRYPT_HASHSIZE];
+	char salt[BCRYPT_HASHSIZE];
+	bool success;
+
+	if(!is_file_paged(path)) {
+		fprintf(stderr, "%s: is not a paged database\n", path);
+		return false;
+	}
+
+	fIn = fopen(path, "r");
+
+	if(!fIn) {
+		fprintf(stderr, "Failed to open file\n");
+		return false;
+	}
+
+	fread(hash, BCRYPT_HASHSIZE, 1, fIn);
+	fseek(fIn, sizeof(PAGED_MAGIC_HEADER), SEEK_CUR);
+
+	if(fread(salt, BCRYPT_HASHSIZE, 1, fIn) != 1) {
+		fprintf(stderr, "Failed to read file\n");
+		fclose(fIn);
+		return false;
+	}
+
+	fclose(fIn);
+
+	if(!verify_passphrase(passphrase, hash)) {
+		fprintf(stderr, "Invalid passphrase\n");
+		return false;
+	}
+
+	*key = generate_key_salt(passphrase, salt, &success);
+
+	if(!success) {
+		fprintf(stderr, "Failed to get new key\n");
+		return false;
+	}
+
+	return true;
+}
+
+//Verify old_passphrase against header of a paged file and derive the
+//key of its pages to old_key. A header for a new key from
+//new_passphrase is made to new_header and the key to new_key.
+//Returns false on failure.
+bool rekey_paged_header(const char *header, const char *old_passphrase,
+	const char *new_passphrase, char *new_header, Key_t *old_key,
+	Key_t *new_key)
+{
+	char salt[BCRYPT_HASHSIZE];
+	bool success;
+
+	if(!verify_passphrase(old_passphrase, header)) {
+		fprintf(stderr, "Invalid passphrase\n");
+		return false;
+	}
+
+	memcpy(salt, header + BCRYPT_HASHSIZE + sizeof(PAGED_MAGIC_HEADER),
+		BCRYPT_HASHSIZE);
+
+	*old_key = generate_key_salt(old_passphrase, salt, &success);
+
+	if(success)
+		*new_key = generate_key(new_passphrase, &success);
+
+	if(!success) {
+		fprintf(stderr, "Failed to get new key\n");
+		return false;
+	}
+
+	if(!get_bcrypt_hash(new_passphrase, new_header)) {
+		fprintf(stderr, "Bcrypt failed\n");
+		return false;
+	}
+
+	memcpy(new_header + BCRYPT_HASHSIZE, &PAGED_MAGIC_HEADER,
+		sizeof(PAGED_MAGIC_HEADER));
+	memcpy(new_header + BCRYPT_HASHSIZE + sizeof(PAGED_MAGIC_HEADER),
+		new_key->salt, BCRYPT_HASHSIZE);
+
+	return true;
+}
+
 //Function reads our magic from the beginning of the file
 //and compares it to the original one. If they match,
 //file is encrypted with Steel. If this is the case, returns true.
@@ -369,6 +909,20 @@ bool is_file_encrypted(const char *path)
 	return true;
 }
 
+//Returns true if data, the first len bytes of a decrypted database,
+//has the application id of databases with sealed fields.
+bool is_sealed_database(const char *data, long len)
+{
+	//Big-endian in the header of SQLite
+	const unsigned char *id = (const unsigned char *)data + 68;
+
+	if(len < 72)
+		return false;
+
+	return ((unsigned long)id[0] << 24 | id[1] << 16 | id[2] << 8 | id[3]) ==
+		SEALED_APPLICATION_ID;
+}
+
 //Verify bcrypt hash agaist passphrase. If the passphrase matches
 //returns true, otherwise false.
 bool verify_passphrase(const char *passphrase, const char *hash)
@@ -387,11 +941,11 @@ bool verify_passphrase(const char *passphrase, const char *hash)
 //On successful encryption, return true, otherwise false.
 bool encrypt_file(const char *path, const char *passphrase)
 {
-	MCRYPT td;
+	Cipher_t cipher;
 	Key_t key;
-	char block;
+	char block[CRYPT_CHUNK_SIZE];
+	size_t count;
 	char *IV = NULL;
-	int ret;
 	FILE *fIn = NULL;
 	FILE *fOut = NULL;
 	char *output_filename = NULL;
@@ -409,32 +963,15 @@ bool encrypt_file(const char *path, const char *passphrase)
 		return false;
 	}
 
-	td = mcrypt_module_open("rijndael-256", NULL, "cfb", NULL);
-
-	if(td == MCRYPT_FAILED) {
-		fprintf(stderr, "Opening mcrypt module failed\n");
-		return false;
-	}
-
 	IV = generate_random_data(IV_SIZE);
 
 	if(IV == NULL) {
 		fprintf(stderr, "Could not create IV\n");
-		mcrypt_generic_deinit(td);
-		mcrypt_module_close(td);
-
 		return false;
 	}
 
-	//Initialize mcrypt
-	ret = mcrypt_generic_init(td, key.data, KEY_SIZE, IV);
-
-	if(ret < 0) {
-		mcrypt_perror(ret);
+	if(!cipher_init(&cipher, key, IV)) {
 		free(IV);
-		mcrypt_generic_deinit(td);
-		mcrypt_module_close(td);
-
 		return false;
 	}
 
@@ -443,8 +980,7 @@ bool encrypt_file(const char *path, const char *passphrase)
 	if(!fIn) {
 		fprintf(stderr, "Failed to open file\n");
 		free(IV);
-		mcrypt_generic_deinit(td);
-		mcrypt_module_close(td);
+		cipher_close(&cipher);
 
 		return false;
 	}
@@ -458,8 +994,7 @@ bool encrypt_file(const char *path, const char *passphrase)
 		fclose(fIn);
 		free(IV);
 		free(output_filename);
-		mcrypt_generic_deinit(td);
-		mcrypt_module_close(td);
+		cipher_close(&cipher);
 
 		return false;
 	}
@@ -471,8 +1006,7 @@ bool encrypt_file(const char *path, const char *passphrase)
 		fclose(fOut);
 		free(IV);
 		free(output_filename);
-		mcrypt_generic_deinit(td);
-		mcrypt_module_close(td);
+		cipher_close(&cipher);
 
 		return false;
 	}
@@ -484,18 +1018,41 @@ bool encrypt_file(const char *path, const char *passphrase)
 
 	//Encrypt rest of the file content (the actual data,
 	//that needs to be protected)
-	while(fread(&block, 1, 1, fIn) == 1) {
-		mcrypt_generic(td, &block, 1);
-		fwrite(&block, 1, 1, fOut);
+	success = true;
+
+	while(success && (count = fread(block, 1, sizeof(block), fIn)) > 0) {
+
+		success = cipher_crypt(&cipher, block, count, false);
+
+		if(!success)
+			fprintf(stderr, "Failed to encrypt data\n");
+		else if(fwrite(block, 1, count, fOut) != count) {
+			fprintf(stderr, "Failed to write output file\n");
+			success = false;
+		}
+	}
+
+	if(success && (ferror(fIn) || ferror(fOut))) {
+		fprintf(stderr, "Failed to read or write file\n");
+		success = false;
 	}
 
-	mcrypt_generic_deinit(td);
-	mcrypt_module_close(td);
+	cipher_close(&cipher);
+	memset(block, 0, sizeof(block));
 
 	free(IV);
 
 	fclose(fIn);
-	fclose(fOut);
+
+	if(fclose(fOut) != 0)
+		success = false;
+
+	//Original file is left as it is
+	if(!success) {
+		remove(output_filename);
+		free(output_filename);
+		return false;
+	}
 
 	remove(path);
 	rename(output_filename, path);
@@ -506,23 +1063,135 @@ bool encrypt_file(const char *path, const char *passphrase)
 	//into the end of the file.
 	if(!hmac_file_content(path, key)) {
 		fprintf(stderr, "Failed to write hmac\n");
-		free(output_filename);
 		return false;
 	}
 
 	return true;
 }
 
+//Range of the data decrypted by a worker of decrypt_data(), with the
+//ciphertext before it as the IV
+typedef struct Crypt_range
+{
+	char *data;
+	long len;
+	char iv[IV_SIZE];
+
+} Crypt_range_t;
+
+//Ranges shared by the workers of decrypt_data(). Each worker takes
+//the next range until all are done.
+typedef struct Crypt_pool
+{
+	Crypt_range_t *ranges;
+	int count;
+	int next;
+	Key_t key;
+	bool failed;
+	pthread_mutex_t lock;
+
+} Crypt_pool_t;
+
+static void *decrypt_worker(void *arg)
+{
+	Crypt_pool_t *pool = arg;
+	Crypt_range_t *range = NULL;
+	Cipher_t cipher;
+	bool success;
+	int i;
+
+	while(true) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if(i >= pool->count)
+			break;
+
+		range = &pool->ranges[i];
+		success = cipher_init(&cipher, pool->key, range->iv);
+
+		if(success) {
+			success = cipher_crypt(&cipher, range->data, range->len, true);
+			cipher_close(&cipher);
+		}
+
+		if(!success) {
+			pthread_mutex_lock(&pool->lock);
+			pool->failed = true;
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+
+	return NULL;
+}
+
+//Decrypt len bytes of data encrypted with key and iv in place. In CFB
+//mode the register of each byte is the ciphertext before it, so the
+//data is split into ranges of CRYPT_RANGE_SIZE, each decrypted on its
+//own with the IV_SIZE bytes before it as the IV, on as many threads as
+//there are CPUs. Returns false on failure.
+static bool decrypt_data(char *data, long len, const char *iv, Key_t key)
+{
+	Crypt_pool_t pool;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int count = (len + CRYPT_RANGE_SIZE - 1) / CRYPT_RANGE_SIZE;
+	int workers = cpus < 1 ? 1 : (cpus < count ? cpus : count);
+	int started = 0;
+
+	if(workers <= 1)
+		return crypt_data(data, len, iv, key, true);
+
+	pthread_t threads[workers];
+
+	pool.ranges = calloc(count, sizeof(Crypt_range_t));
+
+	if(pool.ranges == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return false;
+	}
+
+	//IVs are copied before the ciphertext is overwritten
+	for(int i = 0; i < count; i++) {
+		Crypt_range_t *range = &pool.ranges[i];
+
+		range->data = data + (long)i * CRYPT_RANGE_SIZE;
+		range->len = i < count - 1 ? CRYPT_RANGE_SIZE :
+			len - (long)i * CRYPT_RANGE_SIZE;
+		memcpy(range->iv, i == 0 ? iv : range->data - IV_SIZE, IV_SIZE);
+	}
+
+	pool.count = count;
+	pool.next = 0;
+	pool.key = key;
+	pool.failed = false;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	//This thread is one of the workers
+	while(started < workers - 1 &&
+		pthread_create(&threads[started], NULL, decrypt_worker, &pool) == 0)
+		started++;
+
+	decrypt_worker(&pool);
+
+	for(int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&pool.lock);
+	memset(&pool.key, 0, sizeof(pool.key));
+	free(pool.ranges);
+
+	return !pool.failed;
+}
+
 //Decrypt file pointed by path, using passphrase.
 //On success return true, otherwise false
 bool decrypt_file(const char *path, const char *passphrase)
 {
-	MCRYPT td;
 	Key_t key;
-	char block;
 	char *IV = NULL;
 	char *salt = NULL;
-	int ret;
+	long data_start;
 	FILE *fIn = NULL;
 	FILE *fOut = NULL;
 	char *output_filename = NULL;
@@ -530,6 +1199,7 @@ bool decrypt_file(const char *path, const char *passphrase)
 	bool decryption_failed = false;
 	char hash[BCRYPT_HASHSIZE];
 	long filesize;
+	size_t count;
 
 	if(!is_file_encrypted(path)) {
 		fprintf(stderr, "File is not encrypted with Steel\n");
@@ -566,8 +1236,17 @@ bool decrypt_file(const char *path, const char *passphrase)
 
 	//Read the whole file into a buffer(except hmac) and verify the hmac
 	long len_before_hmac = (filesize - HMAC_SIZE) + 1;
-	char buffer[len_before_hmac];
+	char *buffer = malloc(len_before_hmac);
 	unsigned char mac[HMAC_SIZE];
+
+	if(buffer == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		free(IV);
+		free(salt);
+		fclose(fIn);
+		return false;
+	}
+
 	fread(buffer, len_before_hmac - 1, 1, fIn);
 	fread(mac, HMAC_SIZE, 1, fIn);
 	fseek(fIn, 0, SEEK_SET);
@@ -585,6 +1264,7 @@ bool decrypt_file(const char *path, const char *passphrase)
 		fprintf(stderr, "Invalid passphrase\n");
 		free(IV);
 		free(salt);
+		free(buffer);
 		fclose(fIn);
 
 		return false;
@@ -600,6 +1280,7 @@ bool decrypt_file(const char *path, const char *passphrase)
 		free(new_mac);
 		free(IV);
 		free(salt);
+		free(buffer);
 		fclose(fIn);
 
 		return false;
@@ -611,34 +1292,11 @@ bool decrypt_file(const char *path, const char *passphrase)
 		fprintf(stderr, "Failed to get new key\n");
 		free(IV);
 		free(salt);
+		free(buffer);
 		fclose(fIn);
 		return false;
 	}
 
-	td = mcrypt_module_open("rijndael-256", NULL, "cfb", NULL);
-
-	if(td == MCRYPT_FAILED) {
-		fprintf(stderr, "Opening mcrypt module failed\n");
-		free(IV);
-		free(salt);
-		fclose(fIn);
-
-		return false;
-	}
-
-	ret = mcrypt_generic_init(td, key.data, KEY_SIZE, IV);
-
-	if(ret < 0) {
-		mcrypt_perror(ret);
-		free(IV);
-		free(salt);
-		fclose(fIn);
-		mcrypt_generic_deinit(td);
-		mcrypt_module_close(td);
-
-		return false;
-	}
-
 	output_filename = get_output_filename(path, ".plain");
 
 	fOut = fopen(output_filename, "w");
@@ -648,50 +1306,248 @@ bool decrypt_file(const char *path, const char *passphrase)
 		fclose(fIn);
 		free(IV);
 		free(salt);
+		free(buffer);
 		free(output_filename);
-		mcrypt_generic_deinit(td);
-		mcrypt_module_close(td);
 
 		return false;
 	}
 
-	while(fread(&block, 1, 1, fIn) == 1) {
+	//Data until the hmac is already in the buffer
+	data_start = ftell(fIn);
 
-		//Decrypt data until the hmac
-		if(ftell(fIn) == len_before_hmac)
-			break;
+	if(decrypt_data(buffer + data_start, len_before_hmac - 1 - data_start,
+		IV, key)) {
+		count = len_before_hmac - 1 - data_start;
 
-		if(mdecrypt_generic(td, &block, 1) != 0) {
-			//If decryption fails, abort and remove output file
-			fprintf(stderr, "Decryption failed\n");
-			remove(output_filename);
+		if(fwrite(buffer + data_start, 1, count, fOut) != count) {
+			fprintf(stderr, "Failed to write output file\n");
 			decryption_failed = true;
-			break;
 		}
-
-		fwrite(&block, 1, 1, fOut);
+	}
+	else {
+		fprintf(stderr, "Decryption failed\n");
+		decryption_failed = true;
 	}
 
-	mcrypt_generic_deinit(td);
-	mcrypt_module_close(td);
+	memset(buffer, 0, len_before_hmac);
+	free(buffer);
 
 	free(IV);
 	free(salt);
 
 	fclose(fIn);
-	fclose(fOut);
 
-	//Only remove original file if decryption was successful
-	if(!decryption_failed) {
-		remove(path);
-		rename(output_filename, path);
+	if(fclose(fOut) != 0) {
+		fprintf(stderr, "Failed to write output file\n");
+		decryption_failed = true;
 	}
 
+	//Original file is left as it is
+	if(decryption_failed) {
+		remove(output_filename);
+		free(output_filename);
+		return false;
+	}
+
+	remove(path);
+	rename(output_filename, path);
+
 	free(output_filename);
 
 	return true;
 }
 
+//Re-encrypt file fIn, encrypted with encrypt_file() using
+//old_passphrase, to fOut with a new key from new_passphrase. The file
+//is read once: as the cipher runs in CFB mode, data is decrypted and
+//encrypted again chunk by chunk in memory and never written decrypted.
+//HMAC of fIn is verified at the end, fOut must be thrown away if this
+//fails. Returns false on failure.
+bool rekey_file(FILE *fIn, FILE *fOut, const char *old_passphrase,
+	const char *new_passphrase)
+{
+	Cipher_t old_cipher;
+	Cipher_t new_cipher;
+	bool old_ready = false;
+	bool new_ready = false;
+	MHASH mac_old = MHASH_FAILED;
+	MHASH mac_new = MHASH_FAILED;
+	unsigned char *old_digest = NULL;
+	unsigned char *new_digest = NULL;
+	unsigned char mac[HMAC_SIZE];
+	char header[REKEY_HEADER_SIZE];
+	char new_header[REKEY_HEADER_SIZE];
+	char salt[BCRYPT_HASHSIZE];
+	char *buffer = NULL;
+	Key_t old_key;
+	Key_t new_key;
+	long remaining;
+	long total;
+	size_t chunk;
+	bool success = false;
+	int magic;
+
+	fseek(fIn, 0, SEEK_END);
+	remaining = ftell(fIn) - (long)REKEY_HEADER_SIZE - HMAC_SIZE;
+	fseek(fIn, 0, SEEK_SET);
+
+	if(remaining < 0 || fread(header, REKEY_HEADER_SIZE, 1, fIn) != 1) {
+		fprintf(stderr, "File is not encrypted with Steel\n");
+		return false;
+	}
+
+	memcpy(&magic, header + BCRYPT_HASHSIZE, sizeof(magic));
+
+	if(magic != MAGIC_HEADER) {
+		fprintf(stderr, "File is not encrypted with Steel\n");
+		return false;
+	}
+
+	if(!verify_passphrase(old_passphrase, header)) {
+		fprintf(stderr, "Invalid passphrase\n");
+		return false;
+	}
+
+	memcpy(salt, header + REKEY_HEADER_SIZE - BCRYPT_HASHSIZE,
+		BCRYPT_HASHSIZE);
+
+	old_key = generate_key_salt(old_passphrase, salt, &success);
+
+	if(success)
+		new_key = generate_key(new_passphrase, &success);
+
+	if(!success) {
+		fprintf(stderr, "Failed to get new key\n");
+		return false;
+	}
+
+	success = false;
+
+	//New header has the same layout: bcrypt hash, magic, IV and salt
+	if(!get_bcrypt_hash(new_passphrase, new_header) ||
+		!fill_random(new_header + BCRYPT_HASHSIZE + sizeof(magic), IV_SIZE)) {
+		fprintf(stderr, "Failed to create header\n");
+		return false;
+	}
+
+	memcpy(new_header + BCRYPT_HASHSIZE, &magic, sizeof(magic));
+	memcpy(new_header + REKEY_HEADER_SIZE - BCRYPT_HASHSIZE, new_key.salt,
+		BCRYPT_HASHSIZE);
+
+	buffer = malloc(CRYPT_CHUNK_SIZE);
+
+	if(buffer == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return false;
+	}
+
+	old_ready = cipher_init(&old_cipher, old_key,
+		header + BCRYPT_HASHSIZE + sizeof(magic));
+	new_ready = cipher_init(&new_cipher, new_key,
+		new_header + BCRYPT_HASHSIZE + sizeof(magic));
+
+	if(!old_ready || !new_ready)
+		goto out;
+
+	//HMAC covers everything before it, header included
+	mac_old = mhash_hmac_init(MHASH_SHA256, old_key.data, KEY_SIZE,
+		mhash_get_hash_pblock(MHASH_SHA256));
+	mac_new = mhash_hmac_init(MHASH_SHA256, new_key.data, KEY_SIZE,
+		mhash_get_hash_pblock(MHASH_SHA256));
+
+	if(mac_old == MHASH_FAILED || mac_new == MHASH_FAILED) {
+		fprintf(stderr, "Failed to initialize mhash\n");
+		goto out;
+	}
+
+	mhash(mac_old, header, REKEY_HEADER_SIZE);
+	mhash(mac_new, new_header, REKEY_HEADER_SIZE);
+	fwrite(new_header, 1, REKEY_HEADER_SIZE, fOut);
+	total = remaining;
+
+	while(remaining > 0) {
+		chunk = remaining < CRYPT_CHUNK_SIZE ? remaining : CRYPT_CHUNK_SIZE;
+
+		if(fread(buffer, 1, chunk, fIn) != chunk) {
+			fprintf(stderr, "Failed to read file\n");
+			goto out;
+		}
+
+		mhash(mac_old, buffer, chunk);
+
+		if(!cipher_crypt(&old_cipher, buffer, chunk, true)) {
+			fprintf(stderr, "Encryption failed\n");
+			goto out;
+		}
+
+		//First chunk has the header of the database
+		if(remaining == total && is_sealed_database(buffer, chunk)) {
+			fprintf(stderr, "Database has sealed fields, which can't " \
+				"be rekeyed\n");
+			goto out;
+		}
+
+		if(!cipher_crypt(&new_cipher, buffer, chunk, false)) {
+			fprintf(stderr, "Encryption failed\n");
+			goto out;
+		}
+
+		mhash(mac_new, buffer, chunk);
+		fwrite(buffer, 1, chunk, fOut);
+
+		remaining -= chunk;
+	}
+
+	if(fread(mac, HMAC_SIZE, 1, fIn) != 1) {
+		fprintf(stderr, "Failed to read file\n");
+		goto out;
+	}
+
+	old_digest = mhash_hmac_end(mac_old);
+	new_digest = mhash_hmac_end(mac_new);
+	mac_old = MHASH_FAILED;
+	mac_new = MHASH_FAILED;
+
+	if(old_digest == NULL || new_digest == NULL) {
+		fprintf(stderr, "Failed to compute hmac\n");
+		goto out;
+	}
+
+	if(!verify_hmac(mac, old_digest)) {
+		fprintf(stderr, "Data was tampered. Aborting\n");
+		goto out;
+	}
+
+	fwrite(new_digest, 1, HMAC_SIZE, fOut);
+
+	success = !ferror(fOut);
+
+	if(!success)
+		fprintf(stderr, "Failed to write file\n");
+
+out:
+	if(mac_old != MHASH_FAILED)
+		free(mhash_hmac_end(mac_old));
+
+	if(mac_new != MHASH_FAILED)
+		free(mhash_hmac_end(mac_new));
+
+	if(old_ready)
+		cipher_close(&old_cipher);
+
+	if(new_ready)
+		cipher_close(&new_cipher);
+
+	memset(buffer, 0, CRYPT_CHUNK_SIZE);
+	memset(&old_key, 0, sizeof(old_key));
+	memset(&new_key, 0, sizeof(new_key));
+	free(buffer);
+	free(old_digest);
+	free(new_digest);
+
+	return success;
+}
+
 //Generate passphrase. Param count is there
 //length of the passphrase. Actually, at the moment
 //this function does not generate passphrases, but just passwords.
@@ -25,6 +25,12 @@
 #define IV_SIZE (32) //256 bits
 #define HMAC_SIZE (32) //256 bits
 #define BCRYPT_WORK_FACTOR (12)
+#define PAGED_HEADER_SIZE (132) //bcrypt hash, magic and salt
+#define BOX_KEY_SIZE (32) //X25519
+
+//SQLite application id of databases with sealed fields. Their key
+//is not the one of the file, so they can't be rekeyed.
+#define SEALED_APPLICATION_ID (0x53746c53)
 
 typedef struct Key
 {
@@ -36,6 +42,18 @@ typedef struct Key
 
 } Key_t;
 
+//Key agreed between an ephemeral key pair and the recipient of sealed
+//boxes, see box_seal()
+typedef struct Box
+{
+	unsigned char ephemeral[BOX_KEY_SIZE];
+	Key_t key;
+	bool ready;
+
+} Box_t;
+
+Key_t generate_key(const char *passphrase, bool *success);
+Key_t generate_key_salt(const char *passphrase, char *salt, bool *success);
 unsigned char *get_data_hmac(const char *data, long datalen, Key_t key);
 bool hmac_file_content(const char *path, Key_t key);
 bool verify_hmac(const unsigned char *old, const unsigned char *new);
@@ -43,6 +61,26 @@ bool encrypt_file(const char *path, const char *passphrase);
 bool decrypt_file(const char *path, const char *passphrase);
 bool verify_passphrase(const char *passphrase, const char *hash);
 bool is_file_encrypted(const char *path);
+bool is_sealed_database(const char *data, long len);
 char *generate_pass(int length);
+bool fill_random(char *data, int size);
+bool crypt_data(char *data, long len, const char *iv, Key_t key,
+	bool decrypt);
+char *seal_data(const char *data, long len, Key_t key, long *sealed_len);
+char *unseal_data(const char *sealed, long sealed_len, Key_t key, long *len);
+bool box_keypair(unsigned char *public_key, unsigned char *secret_key);
+bool box_seal_init(Box_t *box, const unsigned char *public_key);
+char *box_seal(Box_t *box, const char *data, long len, long *sealed_len);
+char *box_open(Box_t *box, const char *sealed, long sealed_len,
+	const unsigned char *secret_key, long *len);
+bool init_paged_file(const char *path, const char *passphrase, Key_t *key);
+bool is_file_paged(const char *path);
+bool is_paged_key(const char *header, Key_t key);
+bool get_paged_key(const char *path, const char *passphrase, Key_t *key);
+bool rekey_paged_header(const char *header, const char *old_passphrase,
+	const char *new_passphrase, char *new_header, Key_t *old_key,
+	Key_t *new_key);
+bool rekey_file(FILE *fIn, FILE *fOut, const char *old_passphrase,
+	const char *new_passphrase);
 
 #endif
@@ -24,21 +24,52 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
 #include <sqlite3.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <time.h>
 
 #include "database.h"
+#include "backend.h"
 #include "crypto.h"
+#include "vfs.h"
+#include "x25519.h"
+#include "inbox.h"
 
 //File implements basic interface for using database operations
 //needed by Steel. It's designed in a way that it should be easy
 //to use from a gui too.
 
 //Database callback prototypes
-static int cb_get_entries(void *list, int argc, char **argv, char **column_name);
+static int cb_get_entries(void *tail, int argc, char **argv, char **column_name);
 static int cb_get_next_id(void *id, int argc, char **argv, char **column_name);
-static int cb_get_by_id(void *list, int argc, char **argv, char **column_name);
+static bool db_exec(Db_t *db, const char *sql);
+static bool db_has_sql(Db_t *db);
+
+static const Db_backend_t db_sqlite_backend;
+
+//Backends a database can be stored in, see db_backend_of()
+static const Db_backend_t *db_backends[] = {
+	&db_sqlite_backend,
+	&db_log_backend,
+	NULL
+};
+
+//Column of entry_secrets read with an entry, or an empty string if
+//the command doesn't want it, see db_read_secrets(). Case is evaluated
+//lazily, so pages of the unwanted secrets are never read.
+#define DB_SECRET_COLUMN(column) \
+	"(case when steel_wanted('" column "') then " \
+	"(select steel_unseal(" column ") from entry_secrets " \
+	"where entry_secrets.id = entries.id) else '' end)"
+
+//Columns of the entries table read into Entry_t, in the order of its
+//fields. Secrets are read and decrypted only for the rows selected.
+#define DB_ENTRY_COLUMNS \
+	"entries.title, entries.user, " DB_SECRET_COLUMN("passphrase") ", " \
+	"entries.url, " DB_SECRET_COLUMN("notes") ", entries.id"
 
 //Returns true is file exists and false if not.
 //Function should be portable.
@@ -86,7 +117,37 @@ char *get_lockfile_path()
 	return path;
 }
 
-//Remove the lock file if found.
+//Get path of the key cache file. While a paged database is open,
+//the key of its pages is kept there, so that the commands don't need
+//the master passphrase. Returns NULL on failure. Caller must free the
+//return value.
+static char *get_keyfile_path()
+{
+	char *path = NULL;
+	char *env = NULL;
+
+	env = getenv("HOME");
+
+	if(env == NULL) {
+		fprintf(stderr, "Failed to get home path\n");
+		return NULL;
+	}
+
+	// +12 for /.steel_key filename
+	path = malloc((strlen(env) + 12) * sizeof(char));
+
+	if(path == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return NULL;
+	}
+
+	strcpy(path, env);
+	strcat(path, "/.steel_key");
+
+	return path;
+}
+
+//Remove the lock file and the key cache if found.
 void db_remove_lockfile()
 {
 	char *path = get_lockfile_path();
@@ -99,6 +160,68 @@ void db_remove_lockfile()
 	}
 
 	free(path);
+
+	path = get_keyfile_path();
+
+	if(path != NULL && db_file_exists(path))
+		remove(path);
+
+	free(path);
+}
+
+//Write the key of the unlocked paged database to the key cache,
+//readable only by the user.
+static void create_keyfile()
+{
+	Key_t key;
+	char *path = NULL;
+	int fd;
+
+	if(!vfs_get_key(&key))
+		return;
+
+	path = get_keyfile_path();
+
+	if(path == NULL)
+		return;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+	if(fd < 0 || write(fd, &key, sizeof(key)) != sizeof(key))
+		fprintf(stderr, "Failed to create key cache\n");
+
+	if(fd >= 0)
+		close(fd);
+
+	free(path);
+}
+
+//Unlock the paged database in path with the key cache.
+//Returns false if there's no cached key for it.
+static bool read_keyfile(const char *path)
+{
+	Key_t key;
+	char *keyfile = NULL;
+	bool success = false;
+	int fd;
+
+	keyfile = get_keyfile_path();
+
+	if(keyfile == NULL)
+		return false;
+
+	fd = open(keyfile, O_RDONLY);
+	free(keyfile);
+
+	if(fd < 0)
+		return false;
+
+	if(read(fd, &key, sizeof(key)) == sizeof(key))
+		success = vfs_unlock_key(path, key);
+
+	close(fd);
+
+	return success;
 }
 
 //Creates the lock file and writes content to it.
@@ -173,6 +296,50 @@ char *read_path_from_lockfile()
 	return line;
 }
 
+//Database given with db_set_path(), used instead of the open one.
+static char *db_path = NULL;
+
+//Make db_connect() use the database in path instead of the open one.
+//A paged database doesn't need to be opened, its pages are decrypted
+//in memory only as they are read, so looking up one entry costs a few
+//pages however big the database is. An encrypted database can only be
+//given if it has an inbox, to add entries to it. Returns false if path
+//is an encrypted database which must be opened first.
+bool db_set_path(const char *path)
+{
+	if(!db_file_exists(path)) {
+		fprintf(stderr, "%s: does not exists\n", path);
+		return false;
+	}
+
+	if(is_file_encrypted(path) && !inbox_exists(path)) {
+		fprintf(stderr, "%s: is encrypted. Open it first, or close it " \
+		"with --paged to use it without opening.\n", path);
+		return false;
+	}
+
+	free(db_path);
+	db_path = strdup(path);
+
+	if(db_path == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return false;
+	}
+
+	return true;
+}
+
+//Returns the path of the database db_connect() uses, the one given
+//with db_set_path() or else the open one. Returns NULL on failure.
+//Caller must free the return value.
+char *db_get_path()
+{
+	if(db_path == NULL)
+		return read_path_from_lockfile();
+
+	return strdup(db_path);
+}
+
 //This function is used of to make basic checks before operating with there
 //database. Does the file exists? Is it encrypted? If the database is
 //available for writing or reading returns true, otherwise false.
@@ -204,413 +371,2648 @@ static bool db_make_sanity_check(char *path)
 	return true;
 }
 
-//Initializes new Steel database to the path given.
-//After creation, the database is encrypted with the passphrase.
-//Returns true on success, false on failure. Function does not override
-//existing database in the path.
-bool db_init(const char *path)
+//Schema migrations. Migration n upgrades the database from
+//user_version n to n + 1, so the version of a database tells which
+//migrations it already has. Never change a migration once released,
+//append a new one instead.
+static const char *db_migrations[] = {
+
+	//1: Creation and modification times of entries, kept current
+	//by triggers. Existing entries get the time of the migration.
+	"alter table entries add column created_at integer not null default 0;" \
+	"alter table entries add column modified_at integer not null default 0;" \
+	"update entries set created_at=strftime('%s','now')," \
+		"modified_at=strftime('%s','now');" \
+	"create trigger entries_created after insert on entries begin " \
+		"update entries set created_at=strftime('%s','now')," \
+		"modified_at=strftime('%s','now') where id=new.id; end;" \
+	"create trigger entries_modified after update of " \
+		"title,user,passphrase,url,notes on entries begin " \
+		"update entries set modified_at=strftime('%s','now') " \
+		"where id=new.id; end;",
+
+	//2: Lookups by title and url
+	"create index entries_title on entries(title);" \
+	"create index entries_url on entries(url);",
+
+	//3: Incremental exports. Ids of deleted entries are kept
+	//as tombstones, ids are never reused.
+	"create index entries_modified on entries(modified_at);" \
+	"create table deleted_entries(" \
+		"id integer primary key," \
+		"deleted_at integer not null);" \
+	"create index deleted_entries_time on deleted_entries(deleted_at);" \
+	"create trigger entries_deleted after delete on entries begin " \
+		"insert or replace into deleted_entries(id, deleted_at) " \
+		"values(old.id, strftime('%s','now')); end;",
+
+	//4: Revision history. A revision holds the previous values of
+	//the changed fields only, the rest are NULL. Deleting an entry
+	//stores all of them. Settings hold the retention cap.
+	"create table settings(" \
+		"name text primary key," \
+		"value);" \
+	"insert into settings values('history_limit', 20);" \
+	"create table entry_history(" \
+		"id integer primary key autoincrement," \
+		"entry_id integer not null," \
+		"changed_at integer not null," \
+		"deleted integer not null default 0," \
+		"title text, user text, passphrase text, url text, notes text);" \
+	"create index entry_history_entry on entry_history(entry_id, id);" \
+	"create trigger entries_history_update after update of " \
+		"title,user,passphrase,url,notes on entries " \
+		"when old.title is not new.title or old.user is not new.user " \
+		"or old.passphrase is not new.passphrase " \
+		"or old.url is not new.url or old.notes is not new.notes begin " \
+		"insert into entry_history(entry_id, changed_at, title, user, " \
+		"passphrase, url, notes) values(old.id, strftime('%s','now'), " \
+		"nullif(old.title, new.title), nullif(old.user, new.user), " \
+		"nullif(old.passphrase, new.passphrase), " \
+		"nullif(old.url, new.url), nullif(old.notes, new.notes)); end;" \
+	"create trigger entries_history_delete after delete on entries begin " \
+		"insert into entry_history(entry_id, changed_at, deleted, title, " \
+		"user, passphrase, url, notes) values(old.id, " \
+		"strftime('%s','now'), 1, old.title, old.user, old.passphrase, " \
+		"old.url, old.notes); end;",
+
+	//5: Tags. Entries of a tag are found through the primary key
+	//of entry_tags, tags of an entry through entry_tags_entry.
+	"create table tags(" \
+		"id integer primary key," \
+		"name text not null unique collate nocase);" \
+	"create table entry_tags(" \
+		"tag_id integer not null," \
+		"entry_id integer not null," \
+		"primary key(tag_id, entry_id)) without rowid;" \
+	"create index entry_tags_entry on entry_tags(entry_id);" \
+	"create trigger entries_untag after delete on entries begin " \
+		"delete from entry_tags where entry_id=old.id; end;",
+
+	//6: Host of the url in reversed label form, for example
+	//"com.example.www", computed by steel_host().
+	"alter table entries add column host text;" \
+	"update entries set host=steel_host(url);" \
+	"create index entries_host on entries(host);" \
+	"create trigger entries_host_insert after insert on entries begin " \
+		"update entries set host=steel_host(new.url) " \
+		"where id=new.id; end;" \
+	"create trigger entries_host_update after update of url on entries " \
+		"begin update entries set host=steel_host(new.url) " \
+		"where id=new.id; end;",
+
+	//7: Secrets apart from the rest of the entries, so that listing
+	//and searching never read the pages of passphrases and notes.
+	//Triggers of the moved columns are split between the tables.
+	//Entries is rebuilt without the moved columns instead of dropping
+	//them, which older SQLite can't do. Its sequence is carried over
+	//so that ids are not reused, and its indexes and triggers made
+	//again.
+	"create table entry_secrets(" \
+		"id integer primary key," \
+		"passphrase text," \
+		"notes text);" \
+	"insert into entry_secrets select id, passphrase, notes from entries;" \
+	"create table entries_new(" \
+		"title TEXT," \
+		"user TEXT," \
+		"url TEXT," \
+		"id INTEGER PRIMARY KEY AUTOINCREMENT," \
+		"created_at integer not null default 0," \
+		"modified_at integer not null default 0," \
+		"host text);" \
+	"insert into entries_new select title, user, url, id, created_at, " \
+		"modified_at, host from entries;" \
+	"delete from sqlite_sequence where name='entries_new';" \
+	"update sqlite_sequence set name='entries_new' where name='entries';" \
+	"drop table entries;" \
+	"alter table entries_new rename to entries;" \
+	"create index entries_title on entries(title);" \
+	"create index entries_url on entries(url);" \
+	"create index entries_modified on entries(modified_at);" \
+	"create index entries_host on entries(host);" \
+	"create trigger entries_created after insert on entries begin " \
+		"update entries set created_at=strftime('%s','now')," \
+		"modified_at=strftime('%s','now') where id=new.id; end;" \
+	"create trigger entries_deleted after delete on entries begin " \
+		"insert or replace into deleted_entries(id, deleted_at) " \
+		"values(old.id, strftime('%s','now')); end;" \
+	"create trigger entries_untag after delete on entries begin " \
+		"delete from entry_tags where entry_id=old.id; end;" \
+	"create trigger entries_host_insert after insert on entries begin " \
+		"update entries set host=steel_host(new.url) " \
+		"where id=new.id; end;" \
+	"create trigger entries_host_update after update of url on entries " \
+		"begin update entries set host=steel_host(new.url) " \
+		"where id=new.id; end;" \
+	"create trigger entries_modified after update of title,user,url " \
+		"on entries begin update entries set " \
+		"modified_at=strftime('%s','now') where id=new.id; end;" \
+	"create trigger entry_secrets_modified after update of " \
+		"passphrase,notes on entry_secrets begin update entries set " \
+		"modified_at=strftime('%s','now') where id=new.id; end;" \
+	"create trigger entries_history_update after update of " \
+		"title,user,url on entries " \
+		"when old.title is not new.title or old.user is not new.user " \
+		"or old.url is not new.url begin " \
+		"insert into entry_history(entry_id, changed_at, title, user, " \
+		"url) values(old.id, strftime('%s','now'), " \
+		"nullif(old.title, new.title), nullif(old.user, new.user), " \
+		"nullif(old.url, new.url)); end;" \
+	"create trigger entry_secrets_history_update after update of " \
+		"passphrase,notes on entry_secrets " \
+		"when old.passphrase is not new.passphrase " \
+		"or old.notes is not new.notes begin " \
+		"insert into entry_history(entry_id, changed_at, passphrase, " \
+		"notes) values(old.id, strftime('%s','now'), " \
+		"nullif(old.passphrase, new.passphrase), " \
+		"nullif(old.notes, new.notes)); end;" \
+	"create trigger entries_history_delete after delete on entries begin " \
+		"insert into entry_history(entry_id, changed_at, deleted, title, " \
+		"user, passphrase, url, notes) select old.id, " \
+		"strftime('%s','now'), 1, old.title, old.user, passphrase, " \
+		"old.url, notes from entry_secrets where id=old.id;" \
+		"delete from entry_secrets where id=old.id; end;",
+
+	NULL
+};
+
+//Returns true if host is an IP address, which has no parent domains.
+bool db_host_is_address(const char *host, size_t len)
 {
-	sqlite3 *db;
-	char *error = NULL;
-	int retval;
-	char *sql;
+	const char *label = host + len;
 
-	if(db_file_exists(path)) {
-		fprintf(stderr, "File already exists.\n");
-		return false;
-	}
+	if(memchr(host, ':', len) != NULL)
+		return true;
 
-	retval = sqlite3_open(path, &db);
+	while(label > host && *(label - 1) != '.')
+		label--;
 
-	if(retval) {
-		fprintf(stderr, "Can't initialize: %s\n", sqlite3_errmsg(db));
+	if(label == host + len)
 		return false;
-	}
-
-	sql = "create table entries(" \
-		"title TEXT," \
-		"user  TEXT," \
-		"passphrase TEXT," \
-		"url TEXT," \
-		"notes TEXT," \
-		"id INTEGER PRIMARY KEY AUTOINCREMENT);";
-
-	retval = sqlite3_exec(db, sql, NULL, 0, &error);
 
-	if(retval != SQLITE_OK) {
-		fprintf(stderr, "SQL error: %s\n", error);
-		sqlite3_free(error);
-		sqlite3_close(db);
-		return false;
+	for(; label < host + len; label++) {
+		if(!isdigit((unsigned char)*label))
+			return false;
 	}
-	
-	sqlite3_close(db);
-	create_lockfile(path);
-	
+
 	return true;
 }
 
-//Decrypt the encrypted database pointed by path.
-//Returns true on success, false on failure.
-//Path is also written to the lock file.
-bool db_open(const char *path, const char *passphrase)
+//Extract host name from url to key in reversed label form, so that
+//"https://user@db01.Example.com:8080/path" becomes "com.example.db01".
+//Addresses are kept as they are. Key must hold DB_HOST_MAX + 1 bytes.
+//Returns false if the url has no host.
+bool db_host_key(const char *url, char *key)
 {
-	if(!db_file_exists(path)) {
-		fprintf(stderr, "%s: does not exists\n", path);
-		return false;
+	const char *host = url;
+	const char *end = NULL;
+	const char *scheme = strstr(url, "://");
+	const char *at = NULL;
+	size_t len;
+	size_t pos = 0;
+
+	if(scheme != NULL)
+		host = scheme + 3;
+
+	end = host + strcspn(host, "/?#");
+	at = memchr(host, '@', end - host);
+
+	if(at != NULL)
+		host = at + 1;
+
+	if(*host == '[') {
+		host++;
+		end = host + strcspn(host, "]");
 	}
-	
-	if(!decrypt_file(path, passphrase)) {
-		fprintf(stderr, "Decryption failed\n");
+	else
+		end = host + strcspn(host, ":/?#");
+
+	len = end - host;
+
+	while(len > 0 && host[len - 1] == '.')
+		len--;
+
+	if(len == 0 || len > DB_HOST_MAX)
 		return false;
+
+	if(db_host_is_address(host, len)) {
+
+		for(size_t i = 0; i < len; i++)
+			key[i] = tolower((unsigned char)host[i]);
+
+		key[len] = '\0';
+		return true;
 	}
 
-	//Write path as content to our lock file
-	//to determine what db file is open.
-	create_lockfile(path);
+	//Copy the labels starting from the last one
+	while(len > 0) {
+
+		size_t start = len;
+
+		while(start > 0 && host[start - 1] != '.')
+			start--;
+
+		if(pos > 0)
+			key[pos++] = '.';
+
+		for(size_t i = start; i < len; i++)
+			key[pos++] = tolower((unsigned char)host[i]);
+
+		len = (start > 0) ? start - 1 : 0;
+	}
+
+	key[pos] = '\0';
 
 	return true;
 }
 
-//Encrypt database file with passphrase and
-//remove lock file.
-void db_close(const char *passphrase)
-{	
-	char *path = NULL;
-	
-	path = read_path_from_lockfile();
-	
-	if(path == NULL) {
-		fprintf(stderr, "Failed to read the database path.\n");
-		return;
-	}
+//SQL function steel_host(url), returns the host of url in reversed
+//label form or NULL if it does not have one.
+static void db_sql_host(sqlite3_context *context, int argc,
+		sqlite3_value **argv)
+{
+	const char *url = (const char *)sqlite3_value_text(argv[0]);
+	char key[DB_HOST_MAX + 1];
 
-	if(!db_file_exists(path)) {
-		fprintf(stderr, "%s: does not exists\n", path);
-		free(path);
-		return;
-	}
-	
-	if(!encrypt_file(path, passphrase)) {
-		fprintf(stderr, "Encryption failed\n");
-		free(path);
+	if(url == NULL || !db_host_key(url, key)) {
+		sqlite3_result_null(context);
 		return;
 	}
 
-	db_remove_lockfile();
-	free(path);
+	sqlite3_result_text(context, key, -1, SQLITE_TRANSIENT);
 }
 
-//Add entry to the database.
-//Returns true on success, false on failure.
-bool db_add_entry(Entry_t *entry)
+//Register the SQL functions used by the schema. Must be done on every
+//connection before the entries are written. Returns false on failure.
+static bool db_register_functions(sqlite3 *db)
 {
 	int rc;
-	sqlite3 *db;
-	char *path = NULL;
-	char *filep = NULL;
-	char *error = NULL;
-	char *sql;
-
-	path = read_path_from_lockfile();
-	filep = path;
-	
-	if(!db_make_sanity_check(filep)) {
-		
-		if(path != NULL)
-			free(filep);
-		
-		return false;
-	}
 
-	rc = sqlite3_open(path, &db);
-
-	if(rc) {
-		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-		free(path);
-		return false;
-	}
-	
-	sql =
-	sqlite3_mprintf("insert into entries (title, user, passphrase, url, notes)" \
-			"values('%q','%q','%q','%q','%q')", entry->title, entry->user, 
-			entry->pwd, entry->url, entry->notes);
-	
-	rc = sqlite3_exec(db, sql, NULL, 0, &error);
+	rc = sqlite3_create_function(db, "steel_host", 1,
+		SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, db_sql_host, NULL, NULL);
 
 	if(rc != SQLITE_OK) {
-		fprintf(stderr, "Error: %s\n", error);
-		sqlite3_free(error);
-		sqlite3_free(sql);
-		free(path);
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db));
 		return false;
 	}
 
-	sqlite3_free(sql);
-	sqlite3_close(db);
-	free(path);
-	
 	return true;
 }
 
-//Returns a list of all the entries in the database.
-//First entry of the list contains initialization data,
-//which is in this case, the column names of the entries table.
-Entry_t *db_get_all_entries()
+//Returns value of an integer pragma, for example "pragma user_version;",
+//or -1 on failure.
+static int db_pragma_int(sqlite3 *db, const char *pragma)
 {
-	char *path = NULL;
-	sqlite3 *db;
-	int rc;
-	char *sql;
-	char *error = NULL;
-	Entry_t *list = NULL;
+	sqlite3_stmt *stmt = NULL;
+	int value = -1;
 
-	path = read_path_from_lockfile();
-	
-	if(!db_make_sanity_check(path)) {
-		
-		if(path != NULL)
-			free(path);
-		
-		return NULL;
+	if(sqlite3_prepare_v2(db, pragma, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db));
+		return -1;
 	}
 
-	rc = sqlite3_open(path, &db);
+	if(sqlite3_step(stmt) == SQLITE_ROW)
+		value = sqlite3_column_int(stmt, 0);
+	else
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db));
 
-	if(rc) {
-		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-		free(path);
-		return NULL;
-	}
-	
-	//First item in our list will be the column names. This makes there
-	//formatting easier during the output.
-	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
-	
-	sql = "select * from entries;";
-	rc = sqlite3_exec(db, sql, cb_get_entries, list, &error);
+	sqlite3_finalize(stmt);
 
-	if(rc != SQLITE_OK) {
-		fprintf(stderr, "Error: %s\n", error);
-		sqlite3_free(error);
-		free(path);
-		return NULL;
-	}
+	return value;
+}
 
-	sqlite3_close(db);
-	free(path);
+//Key of the sealed fields. It's derived from the master passphrase
+//and the secret_salt setting, separately from the key of the file, so
+//it can't be derived from a cached key of a paged database. Kept for
+//the rest of the run once unlocked.
+static Key_t secret_key;
+static bool secret_keyed = false;
 
-	return list;
+//Value sealed into the secret_check setting, used to verify the key
+#define DB_SECRET_CHECK "steel"
+
+//Returns true if the secret key is unlocked for db
+bool db_secrets_unlocked(Db_t *db)
+{
+	return secret_keyed && db->secret_salt != NULL &&
+		strncmp(secret_key.salt, db->secret_salt,
+			sizeof(secret_key.salt)) == 0;
 }
 
-//Get next available auto increment value of there
-//entries table. Functions reads the last used auto increment id
-//and adds 1 to it.
-int db_get_next_id()
+//Returns true if field, "passphrase" or "notes", is sealed in db
+bool db_is_sealed(Db_t *db, const char *field)
 {
-	char *path = NULL;
-	sqlite3 *db;
-	int rc;
-	char *sql;
-	char *error = NULL;
-	int id = -1;
+	if(field == NULL)
+		return false;
 
-	path = read_path_from_lockfile();
-	
-	if(!db_make_sanity_check(path)) {
-		
-		if(path != NULL)
-			free(path);
-		
-		return -1;
-	}
+	if(strcmp(field, "passphrase") == 0)
+		return (db->sealed & DB_SECRET_PASSPHRASE) != 0;
 
-	rc = sqlite3_open(path, &db);
+	if(strcmp(field, "notes") == 0)
+		return (db->sealed & DB_SECRET_NOTES) != 0;
 
-	if(rc) {
-		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-		free(path);
-		return -1;
+	return false;
+}
+
+//SQL function steel_seal(field, value). Returns value sealed if the
+//field is sealed in the database, otherwise value as it is.
+static void db_sql_seal(sqlite3_context *context, int argc,
+		sqlite3_value **argv)
+{
+	Db_t *db = sqlite3_user_data(context);
+	const char *field = (const char *)sqlite3_value_text(argv[0]);
+	char *sealed = NULL;
+	long len;
+
+	if(sqlite3_value_type(argv[1]) != SQLITE_TEXT || !db_is_sealed(db, field)) {
+		sqlite3_result_value(context, argv[1]);
+		return;
 	}
-	
-	//This will get us the last available auto increment id
-	sql = "select * from sqlite_sequence where name='entries';";
-	
-	rc = sqlite3_exec(db, sql, cb_get_next_id, &id, &error);
 
-	if(rc != SQLITE_OK) {
-		fprintf(stderr, "Error: %s\n", error);
-		sqlite3_free(error);
-		free(path);
-		return -1;
+	if(!db_secrets_unlocked(db)) {
+		sqlite3_result_error(context, "master passphrase is needed to " \
+			"write sealed fields", -1);
+		return;
 	}
 
-	sqlite3_close(db);
-	free(path);
+	sealed = seal_data((const char *)sqlite3_value_text(argv[1]),
+		sqlite3_value_bytes(argv[1]), secret_key, &len);
 
-	//Plus one to get the next one, not the last one.
-	return id + 1;
-}
+	if(sealed == NULL) {
+		sqlite3_result_error(context, "sealing failed", -1);
+		return;
+	}
+
+	sqlite3_result_blob(context, sealed, (int)len, free);
+}
+
+//SQL function steel_unseal(value). Returns sealed value decrypted, or
+//an empty string if the secret key is not unlocked. Other values are
+//returned as they are.
+static void db_sql_unseal(sqlite3_context *context, int argc,
+		sqlite3_value **argv)
+{
+	Db_t *db = sqlite3_user_data(context);
+	char *data = NULL;
+	long len;
+
+	if(sqlite3_value_type(argv[0]) != SQLITE_BLOB) {
+		sqlite3_result_value(context, argv[0]);
+		return;
+	}
+
+	if(!db_secrets_unlocked(db)) {
+		sqlite3_result_text(context, "", 0, SQLITE_STATIC);
+		return;
+	}
+
+	data = unseal_data(sqlite3_value_blob(argv[0]),
+		sqlite3_value_bytes(argv[0]), secret_key, &len);
+
+	if(data == NULL) {
+		sqlite3_result_error(context, "sealed field was tampered", -1);
+		return;
+	}
+
+	sqlite3_result_text(context, data, (int)len, free);
+}
+
+//SQL function steel_wanted(field). Returns true if field, "passphrase"
+//or "notes", is read with the entries, see db_read_secrets().
+static void db_sql_wanted(sqlite3_context *context, int argc,
+		sqlite3_value **argv)
+{
+	Db_t *db = sqlite3_user_data(context);
+	const char *field = (const char *)sqlite3_value_text(argv[0]);
+	int wanted = 0;
+
+	if(field != NULL && strcmp(field, "passphrase") == 0)
+		wanted = db->secrets & DB_SECRET_PASSPHRASE;
+	else if(field != NULL && strcmp(field, "notes") == 0)
+		wanted = db->secrets & DB_SECRET_NOTES;
+
+	sqlite3_result_int(context, wanted != 0);
+}
+
+//Read only the secret fields, DB_SECRET_PASSPHRASE and DB_SECRET_NOTES,
+//given with the entries from now on. The others are returned empty and
+//their pages are not read at all. By default both are read.
+void db_read_secrets(Db_t *db, int fields)
+{
+	db->secrets = fields;
+}
+
+//Read which fields are sealed and register the SQL functions sealing,
+//unsealing and selecting them. Returns false on failure.
+static bool db_load_secrets(Db_t *db)
+{
+	sqlite3_stmt *stmt = NULL;
+	const char *name = NULL;
+	char *sql = NULL;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db->sqlite, "select name, value from settings " \
+		"where name in ('sealed_fields', 'secret_salt');", -1, &stmt, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+
+		name = (const char *)sqlite3_column_text(stmt, 0);
+
+		if(strcmp(name, "sealed_fields") == 0)
+			db->sealed = sqlite3_column_int(stmt, 1);
+		else if(db->secret_salt == NULL)
+			db->secret_salt = strdup((const char *)sqlite3_column_text(stmt, 1));
+	}
+
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	//Databases sealed before the application id was set get it now
+	if(db->sealed != 0 && db_pragma_int(db->sqlite,
+		"pragma application_id;") != SEALED_APPLICATION_ID) {
+
+		sql = sqlite3_mprintf("pragma application_id=%d;",
+			SEALED_APPLICATION_ID);
+
+		if(sql == NULL || !db_exec(db, sql)) {
+			sqlite3_free(sql);
+			return false;
+		}
+
+		sqlite3_free(sql);
+	}
+
+	rc = sqlite3_create_function(db->sqlite, "steel_seal", 2, SQLITE_UTF8,
+		db, db_sql_seal, NULL, NULL);
+
+	if(rc == SQLITE_OK)
+		rc = sqlite3_create_function(db->sqlite, "steel_unseal", 1,
+			SQLITE_UTF8, db, db_sql_unseal, NULL, NULL);
+
+	if(rc == SQLITE_OK)
+		rc = sqlite3_create_function(db->sqlite, "steel_wanted", 1,
+			SQLITE_UTF8, db, db_sql_wanted, NULL, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	return true;
+}
+
+//Read a blob setting. Returns NULL if it's not found.
+//Caller must free the return value.
+static char *db_get_blob_setting(Db_t *db, const char *name, long *len)
+{
+	sqlite3_stmt *stmt = NULL;
+	char *value = NULL;
+
+	if(sqlite3_prepare_v2(db->sqlite, "select value from settings " \
+		"where name=?;", -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return NULL;
+	}
+
+	sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+
+	if(sqlite3_step(stmt) == SQLITE_ROW) {
+
+		*len = sqlite3_column_bytes(stmt, 0);
+		value = malloc(*len + 1);
+
+		if(value != NULL)
+			memcpy(value, sqlite3_column_blob(stmt, 0), *len);
+	}
+
+	sqlite3_finalize(stmt);
+
+	return value;
+}
+
+//Write a blob setting. Returns false on failure.
+static bool db_set_blob_setting(Db_t *db, const char *name,
+		const void *value, long len)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+
+	if(sqlite3_prepare_v2(db->sqlite, "insert or replace into settings " \
+		"values(?, ?);", -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+	sqlite3_bind_blob(stmt, 2, value, (int)len, SQLITE_STATIC);
+
+	rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	return true;
+}
+
+//Get the public key of the inbox of db, see inbox.c. The key pair is
+//created the first time, the secret key is kept in the settings and
+//is encrypted with the rest of the database. Returns false on failure.
+bool db_init_inbox(Db_t *db, unsigned char *public_key)
+{
+	unsigned char secret_key[BOX_KEY_SIZE];
+	bool success;
+
+	if(!db_has_sql(db))
+		return false;
+
+	if(db_get_inbox(db, secret_key, NULL)) {
+		x25519_base(public_key, secret_key);
+		memset(secret_key, 0, sizeof(secret_key));
+		return true;
+	}
+
+	if(!box_keypair(public_key, secret_key))
+		return false;
+
+	success = db_set_blob_setting(db, "inbox_secret", secret_key,
+		BOX_KEY_SIZE);
+	memset(secret_key, 0, sizeof(secret_key));
+
+	return success;
+}
+
+//Read the secret key of the inbox of db and, unless position is NULL,
+//the position DB_INBOX_POSITION_SIZE bytes stored with
+//db_set_inbox_position(), or zeros. Returns false if there's no inbox.
+bool db_get_inbox(Db_t *db, unsigned char *secret_key,
+		unsigned char *position)
+{
+	char *value = NULL;
+	long len;
+
+	if(db->backend != &db_sqlite_backend)
+		return false;
+
+	value = db_get_blob_setting(db, "inbox_secret", &len);
+
+	if(value == NULL || len != BOX_KEY_SIZE) {
+		free(value);
+		return false;
+	}
+
+	memcpy(secret_key, value, BOX_KEY_SIZE);
+	memset(value, 0, len);
+	free(value);
+
+	if(position == NULL)
+		return true;
+
+	memset(position, 0, DB_INBOX_POSITION_SIZE);
+	value = db_get_blob_setting(db, "inbox_position", &len);
+
+	if(value != NULL && len == DB_INBOX_POSITION_SIZE)
+		memcpy(position, value, len);
+
+	free(value);
+
+	return true;
+}
+
+//Store how far the inbox has been merged into db. Should be done in
+//the transaction adding the entries. Returns false on failure.
+bool db_set_inbox_position(Db_t *db, const unsigned char *position)
+{
+	return db_set_blob_setting(db, "inbox_position", position,
+		DB_INBOX_POSITION_SIZE);
+}
+
+//Unlock the sealed fields of db with the master passphrase they were
+//sealed with. Returns false if the passphrase is wrong.
+bool db_unlock_secrets(Db_t *db, const char *passphrase)
+{
+	char salt[sizeof(secret_key.salt)] = {0};
+	char *check = NULL;
+	char *data = NULL;
+	long len;
+	bool success;
+	Key_t key;
+
+	if(db->sealed == 0 || db_secrets_unlocked(db))
+		return true;
+
+	if(db->secret_salt == NULL)
+		return false;
+
+	strncpy(salt, db->secret_salt, sizeof(salt) - 1);
+	key = generate_key_salt(passphrase, salt, &success);
+
+	if(!success)
+		return false;
+
+	check = db_get_blob_setting(db, "secret_check", &len);
+
+	if(check != NULL)
+		data = unseal_data(check, len, key, &len);
+
+	success = (data != NULL && strcmp(data, DB_SECRET_CHECK) == 0);
+
+	if(success) {
+		secret_key = key;
+		secret_keyed = true;
+	}
+
+	free(check);
+	free(data);
+
+	return success;
+}
+
+//Seal fields, DB_SECRET_PASSPHRASE and optionally DB_SECRET_NOTES, of
+//all the entries and their revisions. Sealed fields are encrypted per
+//row with the secret key, so that reading the other fields never needs
+//the master passphrase. The first time the secret key is derived from
+//passphrase, after that the fields must be unlocked first. Should be
+//done in a transaction. Returns false on failure.
+bool db_seal_fields(Db_t *db, const char *passphrase, int fields)
+{
+	sqlite3_stmt *stmt = NULL;
+	char *check = NULL;
+	char *sql = NULL;
+	long len;
+	bool success;
+	int history;
+	Key_t key;
+
+	if(!db_has_sql(db))
+		return false;
+
+	if(db->sealed == 0) {
+
+		key = generate_key(passphrase, &success);
+
+		if(!success)
+			return false;
+
+		check = seal_data(DB_SECRET_CHECK, strlen(DB_SECRET_CHECK), key, &len);
+
+		if(check == NULL)
+			return false;
+
+		if(sqlite3_prepare_v2(db->sqlite, "insert or replace into settings " \
+			"values('secret_salt', ?1), ('secret_check', ?2);", -1, &stmt,
+			NULL) != SQLITE_OK) {
+			fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+			free(check);
+			return false;
+		}
+
+		sqlite3_bind_text(stmt, 1, key.salt, -1, SQLITE_STATIC);
+		sqlite3_bind_blob(stmt, 2, check, (int)len, free);
+
+		if(sqlite3_step(stmt) != SQLITE_DONE) {
+			fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+			sqlite3_finalize(stmt);
+			return false;
+		}
+
+		sqlite3_finalize(stmt);
+
+		db->secret_salt = strdup(key.salt);
+		secret_key = key;
+		secret_keyed = true;
+	}
+	else if(!db_secrets_unlocked(db)) {
+		fprintf(stderr, "Sealed fields are locked.\n");
+		return false;
+	}
+
+	db->sealed |= fields | DB_SECRET_PASSPHRASE;
+
+	//Sealing is not a change of the values, revisions the update
+	//would store are dropped.
+	history = db_pragma_int(db->sqlite,
+		"select ifnull(max(id), 0) from entry_history;");
+
+	if(history < 0)
+		return false;
+
+	//Application id in the header tells rekeying apart that the
+	//database has sealed fields, see rekey_file()
+	sql = sqlite3_mprintf("pragma application_id=%d;" \
+		"insert or replace into settings " \
+		"values('sealed_fields', %d);" \
+		"update entry_secrets set " \
+		"passphrase=steel_seal('passphrase', passphrase)," \
+		"notes=steel_seal('notes', notes);" \
+		"delete from entry_history where id > %d;" \
+		"update entry_history set " \
+		"passphrase=steel_seal('passphrase', passphrase)," \
+		"notes=steel_seal('notes', notes);", SEALED_APPLICATION_ID,
+		db->sealed, history);
+
+	if(sql == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return false;
+	}
+
+	success = db_exec(db, sql);
+	sqlite3_free(sql);
+
+	return success;
+}
+
+//Bring the schema of the database up to date by running the migrations
+//it does not have yet, all in one transaction. Returns false on failure,
+//in which case the database is left as it was.
+static bool db_migrate(sqlite3 *db)
+{
+	int latest = 0;
+	int version;
+	char *sql = NULL;
+	char *error = NULL;
+	int rc;
+
+	while(db_migrations[latest] != NULL)
+		latest++;
+
+	version = db_pragma_int(db, "pragma user_version;");
+
+	if(version == latest)
+		return true;
+
+	//Another process may be migrating at the same time,
+	//so check the version again once we have the write lock.
+	rc = sqlite3_exec(db, "begin immediate;", NULL, 0, &error);
+
+	if(rc == SQLITE_OK) {
+
+		version = db_pragma_int(db, "pragma user_version;");
+
+		if(version < 0) {
+			sqlite3_exec(db, "rollback;", NULL, 0, NULL);
+			return false;
+		}
+
+		if(version > latest) {
+			fprintf(stderr, "Database was created by a newer version " \
+				"of Steel.\n");
+			sqlite3_exec(db, "rollback;", NULL, 0, NULL);
+			return false;
+		}
+
+		while(rc == SQLITE_OK && version < latest)
+			rc = sqlite3_exec(db, db_migrations[version++], NULL, 0, &error);
+
+		if(rc == SQLITE_OK) {
+			sql = sqlite3_mprintf("pragma user_version=%d; commit;", latest);
+			rc = sqlite3_exec(db, sql, NULL, 0, &error);
+			sqlite3_free(sql);
+		}
+	}
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Migrating the database failed: %s\n", error);
+		sqlite3_free(error);
+		sqlite3_exec(db, "rollback;", NULL, 0, NULL);
+		return false;
+	}
+
+	return true;
+}
+
+//Open SQLite connection to the database in path. Paged databases
+//are opened through the encrypting VFS and must be unlocked first.
+//Returns false on failure.
+static bool db_open_file(const char *path, sqlite3 **db)
+{
+	int rc;
+
+	if(!is_file_paged(path)) {
+		rc = sqlite3_open(path, db);
+	}
+	else if(!vfs_is_unlocked(path)) {
+		fprintf(stderr, "%s: is locked\n", path);
+		*db = NULL;
+		return false;
+	}
+	else {
+		rc = sqlite3_open_v2(path, db,
+			SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, VFS_NAME);
+	}
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(*db));
+		sqlite3_close(*db);
+		*db = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+//Create the tables of a new SQLite database in path.
+//Returns false on failure.
+static bool db_sqlite_create(const char *path)
+{
+	sqlite3 *db;
+	char *error = NULL;
+	int retval;
+	char *sql;
+
+	if(!db_open_file(path, &db))
+		return false;
+
+	sql = "create table entries(" \
+		"title TEXT," \
+		"user TEXT," \
+		"passphrase TEXT," \
+		"url TEXT," \
+		"notes TEXT," \
+		"id INTEGER PRIMARY KEY AUTOINCREMENT);";
+
+	retval = sqlite3_exec(db, sql, NULL, 0, &error);
+
+	if(retval != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", error);
+		sqlite3_free(error);
+		sqlite3_close(db);
+		return false;
+	}
+	
+	if(!db_register_functions(db) || !db_migrate(db)) {
+		sqlite3_close(db);
+		return false;
+	}
+	
+	sqlite3_close(db);
+
+	return true;
+}
+
+//Returns true if the file in path is an SQLite database, plain or paged
+static bool db_sqlite_is_file(const char *path)
+{
+	char header[16];
+	FILE *fp = NULL;
+	bool match;
+
+	if(is_file_paged(path))
+		return true;
+
+	fp = fopen(path, "rb");
+
+	if(fp == NULL)
+		return false;
+
+	match = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+		memcmp(header, "SQLite format 3", sizeof(header)) == 0;
+
+	fclose(fp);
+
+	return match;
+}
+
+//Returns the backend of the database in path. Anything else is left
+//to SQLite, which tells if it's not a database either.
+static const Db_backend_t *db_backend_of(const char *path)
+{
+	for(int i = 0; db_backends[i] != NULL; i++) {
+		if(db_backends[i]->is_file(path))
+			return db_backends[i];
+	}
+
+	return &db_sqlite_backend;
+}
+
+//Initializes new Steel database to the path given.
+//If passphrase is given, the database is created as a paged database
+//encrypted with it, otherwise it's encrypted on close. If log is true,
+//entries are kept in an append-only log instead of SQLite, see logdb.c.
+//Returns true on success, false on failure. Function does not override
+//existing database in the path.
+bool db_init(const char *path, const char *passphrase, bool log)
+{
+	const Db_backend_t *backend = log ? &db_log_backend : &db_sqlite_backend;
+
+	if(db_file_exists(path)) {
+		fprintf(stderr, "File already exists.\n");
+		return false;
+	}
+
+	if(passphrase != NULL) {
+
+		if(log) {
+			fprintf(stderr, "Log databases can't be paged.\n");
+			return false;
+		}
+
+		if(!vfs_create(path, passphrase))
+			return false;
+	}
+
+	if(!backend->create(path)) {
+		if(passphrase != NULL)
+			remove(path);
+		return false;
+	}
+
+	create_lockfile(path);
+
+	if(passphrase != NULL)
+		create_keyfile();
+	
+	return true;
+}
+
+//Decrypt the encrypted database pointed by path.
+//Paged database is not decrypted, it's only unlocked.
+//Returns true on success, false on failure.
+//Path is also written to the lock file.
+bool db_open(const char *path, const char *passphrase)
+{
+	if(!db_file_exists(path)) {
+		fprintf(stderr, "%s: does not exists\n", path);
+		return false;
+	}
+	
+	if(is_file_paged(path)) {
+
+		if(!vfs_unlock(path, passphrase))
+			return false;
+
+		create_keyfile();
+	}
+	else if(!decrypt_file(path, passphrase)) {
+		fprintf(stderr, "Decryption failed\n");
+		return false;
+	}
+
+	//Write path as content to our lock file
+	//to determine what db file is open.
+	create_lockfile(path);
+
+	return true;
+}
+
+//Returns true if the database in path is a paged database which
+//must be unlocked with db_unlock() before connecting to it.
+bool db_is_locked(const char *path)
+{
+	return is_file_paged(path) && !vfs_is_unlocked(path) &&
+		!read_keyfile(path);
+}
+
+//Unlock the paged database in path with passphrase for this process.
+//Returns false if the passphrase is wrong.
+bool db_unlock(const char *path, const char *passphrase)
+{
+	return vfs_unlock(path, passphrase);
+}
+
+//Drop the oldest revisions of every entry beyond the history_limit
+//setting. Done once on close instead of on every write, so that the
+//write path only pays for the history insert.
+#define DB_PRUNE_HISTORY \
+	"delete from entry_history where id <= (" \
+		"select h.id from entry_history h " \
+		"where h.entry_id = entry_history.entry_id " \
+		"order by h.id desc limit 1 offset (" \
+			"select max(value, 0) from settings " \
+			"where name='history_limit'));"
+
+//Database is compacted on close when more than this share of its pages
+//are free, and there are at least DB_VACUUM_MIN_PAGES of them. Free
+//pages would otherwise be encrypted and authenticated on every close
+//and decrypted on every open.
+#define DB_VACUUM_THRESHOLD (0.25)
+#define DB_VACUUM_MIN_PAGES (16)
+
+//Rebuild the database without free pages if enough of them have piled
+//up from deletes and updates. Returns false on failure.
+static bool db_compact(sqlite3 *db)
+{
+	char *error = NULL;
+	int pages = db_pragma_int(db, "pragma page_count;");
+	int free_pages = db_pragma_int(db, "pragma freelist_count;");
+
+	if(pages <= 0 || free_pages < DB_VACUUM_MIN_PAGES
+		|| free_pages < pages * DB_VACUUM_THRESHOLD)
+		return pages > 0 && free_pages >= 0;
+
+	if(sqlite3_exec(db, "vacuum;", NULL, 0, &error) != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", error);
+		sqlite3_free(error);
+		return false;
+	}
+
+	return true;
+}
+
+//Prepare the database to be encrypted. Revisions beyond the retention
+//cap are dropped. Everything from the write-ahead log is written to
+//the database file and journal is switched back to a rollback journal,
+//so that the -wal and -shm files are removed and all the data is in
+//the file that gets encrypted. Finally the database is compacted if
+//needed. Returns false on failure.
+static bool db_sqlite_prepare_close(const char *path)
+{
+	sqlite3 *db;
+	char *error = NULL;
+	int rc;
+
+	if(!db_open_file(path, &db))
+		return false;
+
+	if(!db_register_functions(db) || !db_migrate(db)) {
+		sqlite3_close(db);
+		return false;
+	}
+
+	rc = sqlite3_exec(db, DB_PRUNE_HISTORY "pragma journal_mode=delete;",
+		NULL, 0, &error);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", error);
+		sqlite3_free(error);
+		sqlite3_close(db);
+		return false;
+	}
+
+	if(!db_compact(db)) {
+		sqlite3_close(db);
+		return false;
+	}
+
+	sqlite3_close(db);
+
+	return true;
+}
+
+//Copy the database in path into a new paged database encrypted with
+//passphrase, and replace the database with it. Plaintext database is
+//shredded. Returns false on failure.
+static bool db_convert_paged(const char *path, const char *passphrase)
+{
+	sqlite3 *source = NULL;
+	sqlite3 *dest = NULL;
+	sqlite3_backup *backup = NULL;
+	char *paged = NULL;
+	int rc = SQLITE_ERROR;
+
+	paged = malloc(strlen(path) + strlen(".steel") + 1);
+
+	if(paged == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return false;
+	}
+
+	strcpy(paged, path);
+	strcat(paged, ".steel");
+
+	if(!vfs_create(paged, passphrase)) {
+		free(paged);
+		return false;
+	}
+
+	if(db_open_file(path, &source) &&
+		db_open_file(paged, &dest)) {
+
+		backup = sqlite3_backup_init(dest, "main", source, "main");
+
+		if(backup != NULL) {
+			rc = sqlite3_backup_step(backup, -1);
+			sqlite3_backup_finish(backup);
+		}
+
+		if(rc != SQLITE_DONE)
+			fprintf(stderr, "Copying database failed: %s\n",
+				sqlite3_errmsg(dest));
+	}
+
+	sqlite3_close(source);
+	sqlite3_close(dest);
+
+	if(rc != SQLITE_DONE || !db_shred(path)) {
+		remove(paged);
+		free(paged);
+		return false;
+	}
+
+	if(rename(paged, path) != 0) {
+		fprintf(stderr, "Failed to rename %s\n", paged);
+		free(paged);
+		return false;
+	}
+
+	free(paged);
+
+	return true;
+}
+
+//Encrypt database file with passphrase and
+//remove lock file. Paged database is only checked and compacted, or
+//if paged is true, a decrypted database is converted into one.
+void db_close(const char *passphrase, bool paged)
+{	
+	char *path = NULL;
+	const Db_backend_t *backend = NULL;
+	bool encrypted;
+	
+	path = read_path_from_lockfile();
+	
+	if(path == NULL) {
+		fprintf(stderr, "Failed to read the database path.\n");
+		return;
+	}
+
+	if(!db_file_exists(path)) {
+		fprintf(stderr, "%s: does not exists\n", path);
+		free(path);
+		return;
+	}
+	
+	backend = db_backend_of(path);
+
+	if(paged && backend != &db_sqlite_backend) {
+		fprintf(stderr, "Log databases can't be paged.\n");
+		free(path);
+		return;
+	}
+	
+	if(is_file_paged(path)) {
+
+		if(!vfs_unlock(path, passphrase) || !backend->prepare_close(path)) {
+			free(path);
+			return;
+		}
+	}
+	else {
+
+		if(!backend->prepare_close(path)) {
+			free(path);
+			return;
+		}
+
+		if(paged)
+			encrypted = db_convert_paged(path, passphrase);
+		else
+			encrypted = encrypt_file(path, passphrase);
+
+		if(!encrypted) {
+			fprintf(stderr, "Encryption failed\n");
+			free(path);
+			return;
+		}
+	}
+
+	db_remove_lockfile();
+	free(path);
+}
+
+//Connection profile applied by db_connect(). The decrypted database only
+//lives until it's closed and encrypted again, so durability can be
+//traded for speed. With "safe" every commit is synced to disk with a
+//rollback journal, "normal" uses write-ahead logging which syncs only
+//on checkpoints and "fast" keeps the journal in memory and never syncs.
+//Log databases only sync with "safe".
+typedef struct Db_profile {
+
+	const char *name;
+	const char *pragmas;
+	bool sync;
+
+} Db_profile_t;
+
+#define DB_COMMON_PRAGMAS \
+	"pragma cache_size=-8192;" \
+	"pragma temp_store=memory;"
+
+static const Db_profile_t db_profiles[] = {
+	{"safe",
+		"pragma journal_mode=delete;" \
+		"pragma synchronous=full;" \
+		DB_COMMON_PRAGMAS,
+		true},
+	{"normal",
+		"pragma journal_mode=wal;" \
+		"pragma synchronous=normal;" \
+		"pragma mmap_size=67108864;" \
+		DB_COMMON_PRAGMAS,
+		false},
+	{"fast",
+		"pragma journal_mode=memory;" \
+		"pragma synchronous=off;" \
+		"pragma mmap_size=67108864;" \
+		DB_COMMON_PRAGMAS,
+		false},
+	{NULL, NULL, false}
+};
+
+static const Db_profile_t *profile = &db_profiles[1];
+
+//Select connection profile used by db_connect(). Name can be "safe",
+//"normal" (the default) or "fast". Returns false if there's no such
+//profile.
+bool db_set_profile(const char *name)
+{
+	for(int i = 0; db_profiles[i].name != NULL; i++) {
+
+		if(strcmp(db_profiles[i].name, name) == 0) {
+			profile = &db_profiles[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//Connect db to the SQLite database in db->path and bring its schema
+//up to date. Returns false on failure.
+static bool db_sqlite_open(Db_t *db)
+{
+	char *error = NULL;
+	int rc;
+
+	if(!db_open_file(db->path, &db->sqlite))
+		return false;
+
+	rc = sqlite3_exec(db->sqlite, profile->pragmas, NULL, 0, &error);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Can't apply profile %s: %s\n", profile->name, error);
+		sqlite3_free(error);
+		return false;
+	}
+
+	return db_register_functions(db->sqlite) && db_migrate(db->sqlite) &&
+		db_load_secrets(db);
+}
+
+static void db_sqlite_close(Db_t *db)
+{
+	sqlite3_close(db->sqlite);
+	db->sqlite = NULL;
+}
+
+//Open connection to the currently open database, or the one given
+//with db_set_path(). Backend is chosen by the header of the file.
+//Returns NULL on failure. Caller must close the connection
+//with db_disconnect().
+Db_t *db_connect()
+{
+	Db_t *db = NULL;
+	char *path = NULL;
+
+	path = db_get_path();
+	
+	//Sanity check frees the path on failure
+	if(!db_make_sanity_check(path))
+		return NULL;
+
+	db = calloc(1, sizeof(Db_t));
+
+	if(db == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		free(path);
+		return NULL;
+	}
+
+	db->path = path;
+	db->secrets = DB_SECRET_PASSPHRASE | DB_SECRET_NOTES;
+	db->sync = profile->sync;
+	db->backend = db_backend_of(path);
+
+	if(!db->backend->open(db)) {
+		db_disconnect(db);
+		return NULL;
+	}
+
+	return db;
+}
+
+//Close connection opened with db_connect().
+void db_disconnect(Db_t *db)
+{
+	if(db == NULL)
+		return;
+
+	db->backend->close(db);
+	free(db->path);
+	free(db->secret_salt);
+	free(db);
+}
+
+//Returns true if db is an SQLite database. Only the operations of
+//backend.h work with the others, the rest is built on SQL.
+static bool db_has_sql(Db_t *db)
+{
+	if(db->backend == &db_sqlite_backend)
+		return true;
+
+	fprintf(stderr, "Not supported by %s databases.\n", db->backend->name);
+
+	return false;
+}
+
+//Execute sql which does not return any rows on db.
+//Returns true on success.
+static bool db_exec(Db_t *db, const char *sql)
+{
+	char *error = NULL;
+	int rc;
+
+	rc = sqlite3_exec(db->sqlite, sql, NULL, 0, &error);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", error);
+		sqlite3_free(error);
+		return false;
+	}
+
+	return true;
+}
+
+//Write lock is taken immediately, so that the transaction
+//can't fail half way because of another writer.
+static bool db_sqlite_begin(Db_t *db)
+{
+	return db_exec(db, "begin immediate;");
+}
+
+static bool db_sqlite_commit(Db_t *db)
+{
+	return db_exec(db, "commit;");
+}
+
+static bool db_sqlite_rollback(Db_t *db)
+{
+	return db_exec(db, "rollback;");
+}
+
+//Start a transaction. Until db_commit() is called all the changes
+//made through db are kept in the journal and written to the database
+//with a single sync on commit.
+bool db_begin(Db_t *db)
+{
+	return db->backend->begin(db);
+}
+
+//Commit the transaction started with db_begin().
+bool db_commit(Db_t *db)
+{
+	return db->backend->commit(db);
+}
+
+//Discard all the changes made since db_begin().
+bool db_rollback(Db_t *db)
+{
+	return db->backend->rollback(db);
+}
+
+//Run sql with count text values bound to it.
+//Returns false on failure.
+static bool db_run_values(Db_t *db, const char *sql, const char **values,
+		int count)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	for(int i = 0; i < count; i++)
+		sqlite3_bind_text(stmt, i + 1, values[i], -1, SQLITE_STATIC);
+
+	rc = sqlite3_step(stmt);
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		sqlite3_finalize(stmt);
+		return false;
+	}
+
+	sqlite3_finalize(stmt);
+
+	return true;
+}
+
+static bool db_sqlite_put(Db_t *db, Entry_t *entry)
+{
+	const char *fields[] = {entry->title, entry->user, entry->url};
+	const char *secrets[] = {entry->pwd, entry->notes};
+	bool success;
+
+	//Both of the rows or neither
+	if(!db_exec(db, "savepoint add_entry;"))
+		return false;
+
+	success = db_run_values(db, "insert into entries (title, user, url) " \
+		"values(?,?,?);", fields, 3) &&
+		db_run_values(db, "insert into entry_secrets (id, passphrase, " \
+		"notes) values(last_insert_rowid(), steel_seal('passphrase',?), " \
+		"steel_seal('notes',?));", secrets, 2);
+
+	if(!success)
+		db_exec(db, "rollback to add_entry;");
+
+	return db_exec(db, "release add_entry;") && success;
+}
+
+//Add entry to the database.
+//Returns true on success, false on failure.
+bool db_add_entry(Db_t *db, Entry_t *entry)
+{
+	return db->backend->put(db, entry);
+}
+
+static Entry_t *db_sqlite_scan(Db_t *db)
+{
+	int rc;
+	char *sql;
+	char *error = NULL;
+	Entry_t *list = NULL;
+	Entry_t *tail = NULL;
+
+	//First item in our list will be the column names. This makes there
+	//formatting easier during the output.
+	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
+	tail = list;
+	
+	sql = "select " DB_ENTRY_COLUMNS " from entries;";
+	rc = sqlite3_exec(db->sqlite, sql, cb_get_entries, &tail, &error);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", error);
+		sqlite3_free(error);
+		list_free(list);
+		return NULL;
+	}
+
+	return list;
+}
+
+//Returns a list of all the entries in the database.
+//First entry of the list contains initialization data,
+//which is in this case, the column names of the entries table.
+Entry_t *db_get_all_entries(Db_t *db)
+{
+	return db->backend->scan(db);
+}
+
+//Get next available auto increment value of there
+//entries table. Functions reads the last used auto increment id
+//and adds 1 to it.
+static int db_sqlite_next_id(Db_t *db)
+{
+	int rc;
+	char *sql;
+	char *error = NULL;
+	int id = -1;
+
+	//This will get us the last available auto increment id
+	sql = "select * from sqlite_sequence where name='entries';";
+	
+	rc = sqlite3_exec(db->sqlite, sql, cb_get_next_id, &id, &error);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", error);
+		sqlite3_free(error);
+		return -1;
+	}
+
+	//Plus one to get the next one, not the last one.
+	return id + 1;
+}
+
+int db_get_next_id(Db_t *db)
+{
+	return db->backend->next_id(db);
+}
+
+//Get entry which has the want id. The actual data can be read
+//from entry->next. The head only contains initialization data.
+Entry_t *db_get_entry_by_id(Db_t *db, int id)
+{
+	return db->backend->get(db, &id, 1);
+}
+
+//Create new list entry from the current row of a statement
+//selecting all the columns of the entries table.
+//Returns NULL on failure.
+static Entry_t *db_entry_from_row(sqlite3_stmt *stmt)
+{
+	const char *columns[5];
+
+	//Columns are title, user, passphrase, url and notes,
+	//the sixth one is the id.
+	for(int i = 0; i < 5; i++) {
+
+		columns[i] = (const char *)sqlite3_column_text(stmt, i);
+
+		if(columns[i] == NULL)
+			columns[i] = "";
+	}
+
+	return list_create(columns[0], columns[1], columns[2], columns[3],
+			columns[4], sqlite3_column_int(stmt, 5), NULL);
+}
+
+//Maximum number of ids bound to a single select. SQLite limits the
+//number of host parameters in one statement, older versions to 999.
+#define IDS_PER_QUERY (500)
+
+//Ids are bound to "id in (...)" lists of at most IDS_PER_QUERY ids each
+static Entry_t *db_sqlite_get(Db_t *db, const int *ids, int count)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+	char *sql = NULL;
+	Entry_t *list = NULL;
+	Entry_t *tail = NULL;
+	int chunk = 0;
+	int len;
+
+	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
+	tail = list;
+
+	for(int done = 0; done < count; done += chunk) {
+
+		//Statement only needs to be prepared again when
+		//the number of ids changes, which is on the last round.
+		if(count - done < chunk || stmt == NULL) {
+
+			chunk = count - done;
+
+			if(chunk > IDS_PER_QUERY)
+				chunk = IDS_PER_QUERY;
+
+			sqlite3_finalize(stmt);
+			free(sql);
+
+			// "?," for each id
+			len = strlen("select " DB_ENTRY_COLUMNS " from entries where id in ();");
+			sql = malloc(len + chunk * 2 + 1);
+
+			if(sql == NULL) {
+				fprintf(stderr, "Malloc failed.\n");
+				list_free(list);
+				return NULL;
+			}
+
+			strcpy(sql, "select " DB_ENTRY_COLUMNS " from entries where id in (");
+
+			for(int i = 0; i < chunk; i++)
+				strcat(sql, i == 0 ? "?" : ",?");
+
+			strcat(sql, ");");
+
+			rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+
+			if(rc != SQLITE_OK) {
+				fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+				list_free(list);
+				free(sql);
+				return NULL;
+			}
+		}
+
+		for(int i = 0; i < chunk; i++)
+			sqlite3_bind_int(stmt, i + 1, ids[done + i]);
+
+		while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+
+			tail->next = db_entry_from_row(stmt);
+
+			if(tail->next == NULL)
+				break;
+
+			tail = tail->next;
+		}
+
+		if(rc != SQLITE_DONE) {
+			fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+			list_free(list);
+			sqlite3_finalize(stmt);
+			free(sql);
+			return NULL;
+		}
+
+		sqlite3_reset(stmt);
+	}
+
+	sqlite3_finalize(stmt);
+	free(sql);
+	
+	return list;
+}
+
+//Get entries which have one of the wanted ids. Entries are
+//not returned in any particular order and ids that were not found
+//are simply missing from the list. The head only contains
+//initialization data.
+Entry_t *db_get_entries_by_ids(Db_t *db, const int *ids, int count)
+{
+	return db->backend->get(db, ids, count);
+}
+
+//Get entries inserted or modified at or after time, seconds since
+//the epoch, in the order they were modified. Uses the index on
+//modified_at, so the cost depends on the number of changed entries
+//only. The head only contains initialization data.
+Entry_t *db_get_entries_changed_since(Db_t *db, long long time)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+	char *sql;
+	Entry_t *list = NULL;
+	Entry_t *tail = NULL;
+
+	if(!db_has_sql(db))
+		return NULL;
+
+	sql = "select " DB_ENTRY_COLUMNS " from entries where modified_at >= ? " \
+		"order by modified_at, id;";
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return NULL;
+	}
+
+	sqlite3_bind_int64(stmt, 1, time);
+
+	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
+	tail = list;
+
+	while(tail != NULL && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		tail->next = db_entry_from_row(stmt);
+		tail = tail->next;
+	}
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		list_free(list);
+		list = NULL;
+	}
+
+	sqlite3_finalize(stmt);
+
+	return list;
+}
+
+//Get ids of entries deleted at or after time, seconds since the epoch.
+//Number of ids is stored to count. Returns NULL on failure.
+//Caller must free the return value.
+int *db_get_deleted_since(Db_t *db, long long time, int *count)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+	char *sql;
+	int *ids = NULL;
+	int *tmp = NULL;
+	int size = 16;
+
+	*count = 0;
+
+	if(!db_has_sql(db))
+		return NULL;
+
+	sql = "select id from deleted_entries where deleted_at >= ? " \
+		"order by deleted_at, id;";
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return NULL;
+	}
+
+	sqlite3_bind_int64(stmt, 1, time);
+
+	ids = malloc(size * sizeof(int));
+
+	while(ids != NULL && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+
+		if(*count == size) {
+
+			size *= 2;
+			tmp = realloc(ids, size * sizeof(int));
+
+			if(tmp == NULL) {
+				free(ids);
+				ids = NULL;
+				break;
+			}
+
+			ids = tmp;
+		}
+
+		ids[(*count)++] = sqlite3_column_int(stmt, 0);
+	}
+
+	if(ids == NULL)
+		fprintf(stderr, "Malloc failed.\n");
+	else if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		free(ids);
+		ids = NULL;
+	}
+
+	sqlite3_finalize(stmt);
+
+	return ids;
+}
+
+//Get at most limit entries, or all if limit is negative, sorted by sort.
+//If after is not negative, the page starts after the entry with that id
+//in the sort order. Ties are broken by id, so the order is stable. Every
+//sort is served by an index, the pages are read with a seek and a scan
+//of limit rows, so a page costs the same anywhere in the list.
+//Returns NULL on failure. The head only contains initialization data.
+Entry_t *db_get_entries_page(Db_t *db, Db_sort_t sort, int after, int limit)
+{
+	static const char *columns[] = {
+		[DB_SORT_ID] = "id",
+		[DB_SORT_TITLE] = "title",
+		[DB_SORT_URL] = "url",
+		[DB_SORT_MODIFIED] = "modified_at"
+	};
+	const char *column = columns[sort];
+	sqlite3_stmt *stmt = NULL;
+	bool found = false;
+	int rc;
+	char *sql;
+	Entry_t *list = NULL;
+	Entry_t *tail = NULL;
+
+	if(!db_has_sql(db))
+		return NULL;
+
+	if(after >= 0) {
+
+		//Without the entry the page would silently be empty
+		rc = sqlite3_prepare_v2(db->sqlite, "select 1 from entries " \
+			"where id=?;", -1, &stmt, NULL);
+
+		if(rc == SQLITE_OK) {
+			sqlite3_bind_int(stmt, 1, after);
+			rc = sqlite3_step(stmt);
+			found = (rc == SQLITE_ROW);
+		}
+
+		sqlite3_finalize(stmt);
+
+		if(rc != SQLITE_ROW && rc != SQLITE_DONE) {
+			fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+			return NULL;
+		}
+
+		if(!found) {
+			fprintf(stderr, "No entry found with id %d.\n", after);
+			return NULL;
+		}
+
+		sql = sqlite3_mprintf("select " DB_ENTRY_COLUMNS " from entries " \
+			"where (%s, id) > " \
+			"(select %s, id from entries where id=?1) " \
+			"order by %s, id limit ?2;", column, column, column);
+	}
+	else {
+		sql = sqlite3_mprintf("select " DB_ENTRY_COLUMNS " from entries " \
+			"order by %s, id limit ?2;", column);
+	}
+
+	if(sql == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return NULL;
+	}
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+	sqlite3_free(sql);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return NULL;
+	}
+
+	if(after >= 0)
+		sqlite3_bind_int(stmt, 1, after);
+
+	sqlite3_bind_int(stmt, 2, limit);
+
+	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
+	tail = list;
+
+	while(tail != NULL && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		tail->next = db_entry_from_row(stmt);
+		tail = tail->next;
+	}
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		list_free(list);
+		list = NULL;
+	}
+
+	sqlite3_finalize(stmt);
+
+	return list;
+}
+
+//Get entries tagged with tag, ordered by id. Entries are found through
+//the indexes of tags and entry_tags, other entries are not read at all.
+//The head only contains initialization data.
+Entry_t *db_get_entries_by_tag(Db_t *db, const char *tag)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+	char *sql;
+	Entry_t *list = NULL;
+	Entry_t *tail = NULL;
+
+	if(!db_has_sql(db))
+		return NULL;
+
+	sql = "select " DB_ENTRY_COLUMNS " from tags " \
+		"join entry_tags on entry_tags.tag_id = tags.id " \
+		"join entries on entries.id = entry_tags.entry_id " \
+		"where tags.name = ? order by entry_tags.entry_id;";
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return NULL;
+	}
+
+	sqlite3_bind_text(stmt, 1, tag, -1, SQLITE_STATIC);
+
+	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
+	tail = list;
+
+	while(tail != NULL && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		tail->next = db_entry_from_row(stmt);
+		tail = tail->next;
+	}
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		list_free(list);
+		list = NULL;
+	}
+
+	sqlite3_finalize(stmt);
+
+	return list;
+}
+
+//Get entries whose url has host or one of its parent domains as the
+//host. For "db01.internal.example.com" the entries of
+//"db01.internal.example.com", "internal.example.com" and "example.com"
+//are returned, most specific host first. Each host is a seek on the
+//host index. The head only contains initialization data.
+Entry_t *db_get_entries_for_host(Db_t *db, const char *host)
+{
+	sqlite3_stmt *stmt = NULL;
+	char key[DB_HOST_MAX + 1];
+	char *sql = NULL;
+	bool parents;
+	int count = 0;
+	int rc;
+	Entry_t *list = NULL;
+	Entry_t *tail = NULL;
+
+	if(!db_has_sql(db))
+		return NULL;
+
+	if(!db_host_key(host, key)) {
+		fprintf(stderr, "Invalid host %s.\n", host);
+		return NULL;
+	}
+
+	//"com.example.db01" -> "com.example.db01", "com.example",
+	//top level domain alone is not matched. Addresses have no parents.
+	sql = sqlite3_mprintf("select " DB_ENTRY_COLUMNS " from entries " \
+		"where host in (?");
+	parents = !db_host_is_address(key, strlen(key));
+
+	for(char *dot = strchr(key, '.'); parents && dot != NULL && sql != NULL;
+		dot = strchr(dot + 1, '.')) {
+
+		if(count++ > 0)
+			sql = sqlite3_mprintf("%z,?", sql);
+	}
+
+	sql = sqlite3_mprintf("%z) order by length(host) desc, id;", sql);
+
+	if(sql == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return NULL;
+	}
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+	sqlite3_free(sql);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return NULL;
+	}
+
+	sqlite3_bind_text(stmt, 1, key, -1, SQLITE_TRANSIENT);
+
+	for(int i = 2; i <= count; i++) {
+
+		char *dot = strrchr(key, '.');
+
+		*dot = '\0';
+		sqlite3_bind_text(stmt, i, key, -1, SQLITE_TRANSIENT);
+	}
+
+	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
+	tail = list;
+
+	while(tail != NULL && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		tail->next = db_entry_from_row(stmt);
+		tail = tail->next;
+	}
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		list_free(list);
+		list = NULL;
+	}
+
+	sqlite3_finalize(stmt);
+
+	return list;
+}
+
+//Run sql, which has the tag and an entry id as parameters, once for
+//each id. Number of changed rows is stored to changes.
+//Returns false on failure.
+static bool db_run_for_ids(Db_t *db, const char *sql, const char *tag,
+		const int *ids, int count, int *changes)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+
+	*changes = 0;
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	sqlite3_bind_text(stmt, 1, tag, -1, SQLITE_STATIC);
+
+	for(int i = 0; i < count; i++) {
+
+		sqlite3_bind_int(stmt, 2, ids[i]);
+		rc = sqlite3_step(stmt);
+
+		if(rc != SQLITE_DONE) {
+			fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+			sqlite3_finalize(stmt);
+			return false;
+		}
+
+		*changes += sqlite3_changes(db->sqlite);
+		sqlite3_reset(stmt);
+	}
+
+	sqlite3_finalize(stmt);
+
+	return true;
+}
+
+//Tag entries with ids. The tag is created if it does not exist.
+//Ids which are not found or already have the tag are skipped.
+//Number of entries tagged is stored to changes.
+//Returns false on failure.
+bool db_tag_entries(Db_t *db, const char *tag, const int *ids, int count,
+		int *changes)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+
+	*changes = 0;
+
+	if(!db_has_sql(db))
+		return false;
+
+	rc = sqlite3_prepare_v2(db->sqlite, "insert or ignore into tags(name) " \
+		"values(?);", -1, &stmt, NULL);
+
+	if(rc == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, tag, -1, SQLITE_STATIC);
+		rc = sqlite3_step(stmt);
+	}
+
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	return db_run_for_ids(db, "insert or ignore into entry_tags" \
+		"(tag_id, entry_id) select tags.id, entries.id " \
+		"from tags, entries where tags.name=?1 and entries.id=?2;",
+		tag, ids, count, changes);
+}
+
+//Remove tag from entries with ids. Number of entries untagged is
+//stored to changes. Returns false on failure.
+bool db_untag_entries(Db_t *db, const char *tag, const int *ids, int count,
+		int *changes)
+{
+	if(!db_has_sql(db))
+		return false;
+
+	return db_run_for_ids(db, "delete from entry_tags where " \
+		"tag_id=(select id from tags where name=?1) and entry_id=?2;",
+		tag, ids, count, changes);
+}
+
+//Get revision history of entry id, newest revision first, to history.
+//History is NULL if the entry has no revisions. Returns false on
+//failure. Free the history with db_free_history().
+bool db_get_history(Db_t *db, int id, Revision_t **history)
+{
+	sqlite3_stmt *stmt = NULL;
+	Revision_t *revision = NULL;
+	Revision_t **tail = history;
+	const char *value = NULL;
+	int rc;
+	char *sql;
+
+	*history = NULL;
+
+	if(!db_has_sql(db))
+		return false;
+
+	sql = "select changed_at, deleted, title, user, " \
+		"steel_unseal(passphrase), url, steel_unseal(notes) " \
+		"from entry_history where entry_id=? order by id desc;";
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	sqlite3_bind_int(stmt, 1, id);
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+
+		revision = calloc(1, sizeof(Revision_t));
+
+		if(revision == NULL) {
+			fprintf(stderr, "Malloc failed.\n");
+			rc = SQLITE_NOMEM;
+			break;
+		}
 
-//Get entry which has the want id. The actual data can be read
-//from entry->next. The head only contains initialization data.
-Entry_t *db_get_entry_by_id(int id)
-{
-	char *path = NULL;
-	sqlite3 *db;
-	int rc;
-	char *sql;
-	char *error = NULL;
-	Entry_t *list = NULL;
-	
-	path = read_path_from_lockfile();
-	
-	if(!db_make_sanity_check(path)) {
-		
-		if(path != NULL)
-			free(path);
-		
-		return NULL;
+		revision->time = sqlite3_column_int64(stmt, 0);
+		revision->deleted = sqlite3_column_int(stmt, 1);
+
+		//Title, user, passphrase, url and notes
+		for(int i = 0; i < 5; i++) {
+
+			value = (const char *)sqlite3_column_text(stmt, i + 2);
+
+			if(value != NULL)
+				revision->values[i] = strdup(value);
+		}
+
+		*tail = revision;
+		tail = &revision->next;
 	}
-	
-	rc = sqlite3_open(path, &db);
 
-	if(rc) {
-		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-		free(path);
-		return NULL;
+	if(rc != SQLITE_DONE && rc != SQLITE_NOMEM)
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE) {
+		db_free_history(*history);
+		*history = NULL;
+		return false;
 	}
-	
-	sql =
-	sqlite3_mprintf("select * from entries where id=%d;", id);
 
-	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
-	
-	rc = sqlite3_exec(db, sql, cb_get_by_id, list, &error);
+	return true;
+}
+
+void db_free_history(Revision_t *history)
+{
+	Revision_t *next = NULL;
+
+	while(history != NULL) {
+
+		next = history->next;
+
+		for(int i = 0; i < 5; i++)
+			free(history->values[i]);
+
+		free(history);
+		history = next;
+	}
+}
+
+//Set how many revisions are kept for each entry. Older ones are
+//dropped when the database is closed. Returns false on failure.
+bool db_set_history_limit(Db_t *db, int limit)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+
+	if(!db_has_sql(db))
+		return false;
+
+	rc = sqlite3_prepare_v2(db->sqlite, "update settings set value=? " \
+		"where name='history_limit';", -1, &stmt, NULL);
 
 	if(rc != SQLITE_OK) {
-		fprintf(stderr, "Error: %s\n", error);
-		sqlite3_free(error);
-		sqlite3_free(sql);
-		free(path);
-		return NULL;
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
 	}
 
-	sqlite3_free(sql);
-	sqlite3_close(db);
-	free(path);
-	
-	return list;
+	sqlite3_bind_int(stmt, 1, limit);
+	rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		return false;
+	}
+
+	return true;
 }
 
-//Delete entry from the database by id. Returns true on success.
-//If true is returned but *success is set to false it means that
-//function was successful, but nothing was deleted (entry with wanted id
-//was not found)
-bool db_delete_entry_by_id(int id, bool *success)
+static bool db_sqlite_remove(Db_t *db, int id, bool *success)
 {
-	char *path = NULL;
-	sqlite3 *db;
 	int rc;
 	char *sql;
 	char *error = NULL;
 	int count;
 	
-	path = read_path_from_lockfile();
-	
-	if(!db_make_sanity_check(path)) {
-		
-		if(path != NULL)
-			free(path);
-		
-		return false;
-	}
-	
-	rc = sqlite3_open(path, &db);
+	*success = false;
 
-	if(rc) {
-		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-		free(path);
-		return false;
-	}
-	
 	sql =
 	sqlite3_mprintf("delete from entries where id=%d;", id);
 
-	rc = sqlite3_exec(db, sql, NULL, 0, &error);
+	rc = sqlite3_exec(db->sqlite, sql, NULL, 0, &error);
 
 	if(rc != SQLITE_OK) {
 		fprintf(stderr, "Error: %s\n", error);
 		sqlite3_free(error);
 		sqlite3_free(sql);
-		free(path);
 		return false;
 	}
 
-	count = sqlite3_changes(db);
+	count = sqlite3_changes(db->sqlite);
 	
 	if(count > 0)
 		*success = true;
 	
 	sqlite3_free(sql);
-	sqlite3_close(db);
-	free(path);
 	
 	return true;
 	
 }
 
+//Delete entry from the database by id. Returns true on success.
+//If true is returned but *success is set to false it means that
+//function was successful, but nothing was deleted (entry with wanted id
+//was not found)
+bool db_delete_entry_by_id(Db_t *db, int id, bool *success)
+{
+	return db->backend->remove(db, id, success);
+}
+
 //Updates an entry in the database.
 //Entry with given is is simply updated with 
 //new data from the parameter entry. Returns true on success.
-bool db_update_entry(int id, Entry_t *entry)
+bool db_update_entry(Db_t *db, int id, Entry_t *entry)
 {
-	char *path = NULL;
-	sqlite3 *db;
+	const char *fields[] = {"title", "user", "passphrase", "url", "notes"};
+	const char *values[] = {entry->title, entry->user, entry->pwd,
+				entry->url, entry->notes};
+	bool success;
+
+	return db_update_fields(db, id, fields, values, 5, &success);
+}
+
+//Returns the column of the entries table matching field, or NULL
+//if field can't be updated. Column names can't be bound to a
+//statement, so only these fixed names ever end up in the sql.
+static const char *db_column_name(const char *field)
+{
+	static const char *columns[] = {
+		"title", "user", "passphrase", "url", "notes", NULL
+	};
+
+	for(int i = 0; columns[i] != NULL; i++) {
+		if(strcmp(columns[i], field) == 0)
+			return columns[i];
+	}
+
+	return NULL;
+}
+
+//Returns true if column is kept in entry_secrets and can be sealed.
+static bool db_is_secret_column(const char *column)
+{
+	return strcmp(column, "passphrase") == 0 || strcmp(column, "notes") == 0;
+}
+
+//Update only one field of an entry. Field can be "title", "user",
+//"passphrase", "url" or "notes". Returns true on success.
+//If true is returned but *success is set to false it means that
+//entry with wanted id was not found.
+bool db_update_field(Db_t *db, int id, const char *field, const char *value,
+		bool *success)
+{
+	return db_update_fields(db, id, &field, &value, 1, success);
+}
+
+//Append the where clause matching all the conditions to sql.
+//Sql is freed. Returns the new sql or NULL on failure.
+static char *db_append_where(char *sql, const Db_condition_t *conditions,
+		int count)
+{
+	const char *column = NULL;
+
+	for(int i = 0; sql != NULL && i < count; i++) {
+
+		const char *glue = (i == 0) ? " where" : " and";
+
+		if(conditions[i].match == DB_MATCH_ID_RANGE) {
+			sql = sqlite3_mprintf("%z%s id between ? and ?", sql, glue);
+			continue;
+		}
+
+		if(conditions[i].match == DB_MATCH_MODIFIED_BEFORE) {
+			sql = sqlite3_mprintf("%z%s modified_at < ?", sql, glue);
+			continue;
+		}
+
+		column = db_column_name(conditions[i].field);
+
+		if(column == NULL) {
+			fprintf(stderr, "Unknown field %s.\n", conditions[i].field);
+			sqlite3_free(sql);
+			return NULL;
+		}
+
+		//Secrets are compared decrypted
+		if(db_is_secret_column(column))
+			column = sqlite3_mprintf("steel_unseal((select %s from " \
+				"entry_secrets where entry_secrets.id = entries.id))",
+				column);
+		else
+			column = sqlite3_mprintf("%s", column);
+
+		if(column == NULL) {
+			sqlite3_free(sql);
+			sql = NULL;
+			break;
+		}
+
+		if(conditions[i].match == DB_MATCH_EQUALS)
+			sql = sqlite3_mprintf("%z%s %s=?", sql, glue, column);
+		else
+			sql = sqlite3_mprintf("%z%s %s like ? escape '\\'", sql,
+				glue, column);
+
+		sqlite3_free((char *)column);
+	}
+
+	if(sql == NULL)
+		fprintf(stderr, "Malloc failed.\n");
+
+	return sql;
+}
+
+//Bind values of the conditions to stmt starting from parameter index.
+//Returns false on failure.
+static bool db_bind_where(sqlite3_stmt *stmt, int index,
+		const Db_condition_t *conditions, int count)
+{
+	char *pattern = NULL;
+	size_t len;
+	int j;
+
+	for(int i = 0; i < count; i++) {
+
+		switch(conditions[i].match) {
+		case DB_MATCH_ID_RANGE:
+			sqlite3_bind_int(stmt, index++, conditions[i].first);
+			sqlite3_bind_int(stmt, index++, conditions[i].last);
+			break;
+		case DB_MATCH_MODIFIED_BEFORE:
+			sqlite3_bind_int64(stmt, index++, conditions[i].time);
+			break;
+		case DB_MATCH_EQUALS:
+			sqlite3_bind_text(stmt, index++, conditions[i].text, -1,
+				SQLITE_STATIC);
+			break;
+		case DB_MATCH_CONTAINS:
+			//"%text%" with the wildcards of text escaped
+			len = strlen(conditions[i].text);
+			pattern = malloc(len * 2 + 3);
+
+			if(pattern == NULL) {
+				fprintf(stderr, "Malloc failed.\n");
+				return false;
+			}
+
+			j = 0;
+			pattern[j++] = '%';
+
+			for(size_t k = 0; k < len; k++) {
+
+				char c = conditions[i].text[k];
+
+				if(c == '%' || c == '_' || c == '\\')
+					pattern[j++] = '\\';
+
+				pattern[j++] = c;
+			}
+
+			pattern[j++] = '%';
+			pattern[j] = '\0';
+
+			sqlite3_bind_text(stmt, index++, pattern, -1, free);
+			break;
+		}
+	}
+
+	return true;
+}
+
+//Run sql, which has count condition values to bind after the first
+//values. Number of changed rows is stored to changes.
+//Sql is freed. Returns false on failure.
+static bool db_write_where(Db_t *db, char *sql, const char **values,
+		int nvalues, const Db_condition_t *conditions, int count,
+		int *changes)
+{
+	sqlite3_stmt *stmt = NULL;
 	int rc;
-	char *sql;
-	char *error = NULL;
-	
-	path = read_path_from_lockfile();
-	
-	if(!db_make_sanity_check(path)) {
-		
-		if(path != NULL)
-			free(path);
-		
+
+	*changes = 0;
+
+	sql = db_append_where(sql, conditions, count);
+
+	if(sql == NULL)
+		return false;
+
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+	sqlite3_free(sql);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
 		return false;
 	}
-	
-	rc = sqlite3_open(path, &db);
 
-	if(rc) {
-		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-		free(path);
+	for(int i = 0; i < nvalues; i++)
+		sqlite3_bind_text(stmt, i + 1, values[i], -1, SQLITE_STATIC);
+
+	if(!db_bind_where(stmt, nvalues + 1, conditions, count)) {
+		sqlite3_finalize(stmt);
 		return false;
 	}
-	
-	sql =
-	sqlite3_mprintf("update entries set title='%q',user='%q',passphrase='%q'" \
-		",url='%q',notes='%q' where id=%d;", entry->title, 
-		 entry->user, entry->pwd, entry->url, entry->notes, id);
-	
-	rc = sqlite3_exec(db, sql, NULL, 0, &error);
 
-	if(rc != SQLITE_OK) {
-		fprintf(stderr, "Error: %s\n", error);
-		sqlite3_free(error);
+	rc = sqlite3_step(stmt);
+
+	if(rc != SQLITE_DONE) {
+		fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db->sqlite));
+		sqlite3_finalize(stmt);
+		return false;
+	}
+
+	*changes = sqlite3_changes(db->sqlite);
+	sqlite3_finalize(stmt);
+
+	return true;
+}
+
+//Build "update table set field=?, ..." of count fields, sealing the
+//secret ones. Returns NULL on failure, caller must free the return
+//value with sqlite3_free().
+static char *db_update_sql(const char *table, const char **fields,
+		int count)
+{
+	char *sql = sqlite3_mprintf("update %s set", table);
+
+	for(int i = 0; sql != NULL && i < count; i++) {
+
+		if(db_is_secret_column(fields[i]))
+			sql = sqlite3_mprintf("%z%s %s=steel_seal('%s',?)", sql,
+				(i == 0) ? "" : ",", fields[i], fields[i]);
+		else
+			sql = sqlite3_mprintf("%z%s %s=?", sql, (i == 0) ? "" : ",",
+				fields[i]);
+	}
+
+	if(sql == NULL)
+		fprintf(stderr, "Malloc failed.\n");
+
+	return sql;
+}
+
+//Update count fields of all the entries matching every condition.
+//Only the given columns are written. Fields of the entries table
+//alone take a single update statement. Secrets are in entry_secrets,
+//so then the matching ids are collected first and both tables are
+//updated by them in one savepoint, that way the first update can't
+//change which entries the second one matches and a failure leaves
+//neither table changed. Number of updated entries is stored
+//to changes. Returns false on failure.
+bool db_update_where(Db_t *db, const Db_condition_t *conditions,
+		int ncond, const char **fields, const char **values, int count,
+		int *changes)
+{
+	const char *columns[count > 0 ? count : 1];
+	const char *secrets[count > 0 ? count : 1];
+	const char *column_values[count > 0 ? count : 1];
+	const char *secret_values[count > 0 ? count : 1];
+	int ncolumns = 0;
+	int nsecrets = 0;
+	char *sql = NULL;
+	bool success;
+
+	*changes = 0;
+
+	if(!db_has_sql(db))
+		return false;
+
+	if(count < 1)
+		return false;
+
+	for(int i = 0; i < count; i++) {
+
+		const char *column = db_column_name(fields[i]);
+
+		if(column == NULL) {
+			fprintf(stderr, "Unknown field %s.\n", fields[i]);
+			return false;
+		}
+
+		if(db_is_secret_column(column)) {
+			secrets[nsecrets] = column;
+			secret_values[nsecrets++] = values[i];
+		}
+		else {
+			columns[ncolumns] = column;
+			column_values[ncolumns++] = values[i];
+		}
+	}
+
+	if(nsecrets == 0) {
+
+		sql = db_update_sql("entries", columns, ncolumns);
+
+		if(sql == NULL)
+			return false;
+
+		return db_write_where(db, sql, column_values, ncolumns, conditions,
+			ncond, changes);
+	}
+
+	//Temporary tables live in memory, see DB_COMMON_PRAGMAS
+	if(!db_exec(db, "create temp table if not exists steel_matched(" \
+		"id integer primary key); delete from steel_matched;"))
+		return false;
+
+	sql = sqlite3_mprintf("insert into steel_matched select id from entries");
+
+	if(sql == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return false;
+	}
+
+	//Both of the tables or neither
+	if(!db_exec(db, "savepoint update_where;")) {
 		sqlite3_free(sql);
-		free(path);
 		return false;
 	}
-	
-	sqlite3_free(sql);
-	sqlite3_close(db);
-	free(path);
-	
+
+	success = db_write_where(db, sql, NULL, 0, conditions, ncond, changes);
+
+	if(success && ncolumns > 0) {
+
+		sql = db_update_sql("entries", columns, ncolumns);
+
+		if(sql != NULL)
+			sql = sqlite3_mprintf("%z where id in steel_matched;", sql);
+
+		success = (sql != NULL) &&
+			db_run_values(db, sql, column_values, ncolumns);
+		sqlite3_free(sql);
+	}
+
+	if(success) {
+
+		sql = db_update_sql("entry_secrets", secrets, nsecrets);
+
+		if(sql != NULL)
+			sql = sqlite3_mprintf("%z where id in steel_matched;", sql);
+
+		success = (sql != NULL) &&
+			db_run_values(db, sql, secret_values, nsecrets);
+		sqlite3_free(sql);
+	}
+
+	if(!success)
+		db_exec(db, "rollback to update_where;");
+
+	success = db_exec(db, "release update_where;") && success;
+
+	if(!success)
+		*changes = 0;
+
+	return success;
+}
+
+//Only the given columns are written with a single update statement,
+//rest of the entry is not read or touched.
+static bool db_sqlite_update(Db_t *db, int id, const char **fields,
+		const char **values, int count, bool *success)
+{
+	Db_condition_t by_id = {
+		.match = DB_MATCH_ID_RANGE,
+		.first = id,
+		.last = id
+	};
+	int changes;
+
+	*success = false;
+
+	if(!db_update_where(db, &by_id, 1, fields, values, count, &changes))
+		return false;
+
+	*success = (changes > 0);
+
 	return true;
 }
 
+//Update count fields of an entry. Returns true on success.
+//If true is returned but *success is set to false it means that
+//entry with wanted id was not found.
+bool db_update_fields(Db_t *db, int id, const char **fields,
+		const char **values, int count, bool *success)
+{
+	return db->backend->update(db, id, fields, values, count, success);
+}
+
+//Delete all the entries matching every condition with a single
+//delete statement. Number of deleted entries is stored to changes.
+//Returns false on failure.
+bool db_delete_where(Db_t *db, const Db_condition_t *conditions, int count,
+		int *changes)
+{
+	char *sql = NULL;
+
+	if(!db_has_sql(db))
+		return false;
+
+	//Never delete everything by accident
+	if(count < 1)
+		return false;
+
+	sql = sqlite3_mprintf("delete from entries");
+
+	if(sql == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return false;
+	}
+
+	return db_write_where(db, sql, NULL, 0, conditions, count, changes);
+}
+
 //Functions returns last modification time of a file pointed
 //by path. Function assumes that the file exists.
 char *db_last_modified(const char *path)
@@ -662,10 +3064,19 @@ bool db_shred(const char *path)
 //***********************************
 //Database actions callback functions
 //***********************************
-static int cb_get_entries(void *list, int argc, char **argv, char **column_name)
+static int cb_get_entries(void *tail, int argc, char **argv, char **column_name)
 {	
-	//Insert entries into the list
-	list_add(list, argv[0], argv[1], argv[2], argv[3], argv[4], atoi(argv[5]));
+	Entry_t **cursor = tail;
+
+	//Insert entries into the list. Append straight after the last
+	//entry, list_add() would walk through the whole list for every row.
+	(*cursor)->next = list_create(argv[0], argv[1], argv[2], argv[3], argv[4],
+				atoi(argv[5]), NULL);
+
+	if((*cursor)->next == NULL)
+		return 1;
+
+	*cursor = (*cursor)->next;
 
 	return 0;	
 }
@@ -681,14 +3092,24 @@ static int cb_get_next_id(void *id, int argc, char **argv, char **column_name)
 	
 	return 0;	
 }
-
-static int cb_get_by_id(void *list, int argc, char **argv, char **column_name)
-{
-	
-	list_add(list, argv[0], argv[1], argv[2], argv[3], argv[4], atoi(argv[5]));
-	
-	return 0;
-}
 //********************************
 //End database callback functions
 //********************************
+
+static const Db_backend_t db_sqlite_backend = {
+	.name = "SQLite",
+	.is_file = db_sqlite_is_file,
+	.create = db_sqlite_create,
+	.prepare_close = db_sqlite_prepare_close,
+	.open = db_sqlite_open,
+	.close = db_sqlite_close,
+	.get = db_sqlite_get,
+	.scan = db_sqlite_scan,
+	.put = db_sqlite_put,
+	.update = db_sqlite_update,
+	.remove = db_sqlite_remove,
+	.next_id = db_sqlite_next_id,
+	.begin = db_sqlite_begin,
+	.commit = db_sqlite_commit,
+	.rollback = db_sqlite_rollback
+};
@@ -23,18 +23,134 @@
 
 #include "entries.h"
 
-bool db_init(const char *path);
+struct sqlite3;
+struct Db_backend;
+struct Log;
+
+//Secret fields of an entry, stored apart from the rest of it.
+//See db_read_secrets() and db_seal_fields().
+#define DB_SECRET_PASSPHRASE (1)
+#define DB_SECRET_NOTES (2)
+
+//Length of the position stored with db_set_inbox_position()
+#define DB_INBOX_POSITION_SIZE (16)
+
+//Maximum length of a host name, see db_host_key()
+#define DB_HOST_MAX (255)
+
+//Handle to the currently open database. Operations taking a handle
+//all share the same connection. Get one with db_connect().
+typedef struct Db {
+
+	const struct Db_backend *backend;	//See backend.h
+	struct sqlite3 *sqlite;
+	struct Log *log;
+	bool sync;		//Sync every commit to disk
+	char *path;
+	int sealed;
+	int secrets;	//Secret fields read with the entries
+	char *secret_salt;
+
+} Db_t;
+
+//How a condition of db_update_where() and db_delete_where() matches
+typedef enum Db_match {
+
+	DB_MATCH_EQUALS,	//field is text
+	DB_MATCH_CONTAINS,	//field contains text, ignoring case
+	DB_MATCH_ID_RANGE,	//id is between first and last
+	DB_MATCH_MODIFIED_BEFORE	//entry was last modified before time
+
+} Db_match_t;
+
+typedef struct Db_condition {
+
+	Db_match_t match;
+	const char *field;
+	const char *text;
+	int first;
+	int last;
+	long long time;		//seconds since the epoch
+
+} Db_condition_t;
+
+//Orders of db_get_entries_page()
+typedef enum Db_sort {
+
+	DB_SORT_ID,
+	DB_SORT_TITLE,
+	DB_SORT_URL,
+	DB_SORT_MODIFIED
+
+} Db_sort_t;
+
+//One revision of an entry. Values hold the previous title, user,
+//passphrase, url and notes, or NULL for the fields which did not
+//change. Revision of a deleted entry has all the values.
+typedef struct Revision {
+
+	long long time;		//seconds since the epoch
+	bool deleted;
+	char *values[5];
+	struct Revision *next;
+
+} Revision_t;
+
+bool db_init(const char *path, const char *passphrase, bool log);
 bool db_open(const char *path, const char *passphrase);
-void db_close(const char *passphrase);
+void db_close(const char *passphrase, bool paged);
+bool db_is_locked(const char *path);
+bool db_unlock(const char *path, const char *passphrase);
+bool db_is_sealed(Db_t *db, const char *field);
+bool db_secrets_unlocked(Db_t *db);
+bool db_unlock_secrets(Db_t *db, const char *passphrase);
+bool db_seal_fields(Db_t *db, const char *passphrase, int fields);
+void db_read_secrets(Db_t *db, int fields);
+bool db_init_inbox(Db_t *db, unsigned char *public_key);
+bool db_get_inbox(Db_t *db, unsigned char *secret_key,
+		unsigned char *position);
+bool db_set_inbox_position(Db_t *db, const unsigned char *position);
 bool db_file_exists(const char *path);
 char *read_path_from_lockfile();
+bool db_set_path(const char *path);
+char *db_get_path();
 void db_remove_lockfile();
-int db_get_next_id();
-bool db_add_entry(Entry_t *entry);
-bool db_update_entry(int id, Entry_t *entry);
-Entry_t *db_get_all_entries();
-Entry_t *db_get_entry_by_id(int id);
-bool db_delete_entry_by_id(int id, bool *success);
+bool db_set_profile(const char *name);
+bool db_host_key(const char *url, char *key);
+bool db_host_is_address(const char *host, size_t len);
+Db_t *db_connect();
+void db_disconnect(Db_t *db);
+bool db_begin(Db_t *db);
+bool db_commit(Db_t *db);
+bool db_rollback(Db_t *db);
+int db_get_next_id(Db_t *db);
+bool db_add_entry(Db_t *db, Entry_t *entry);
+bool db_update_entry(Db_t *db, int id, Entry_t *entry);
+bool db_update_field(Db_t *db, int id, const char *field, const char *value,
+		bool *success);
+bool db_update_fields(Db_t *db, int id, const char **fields,
+		const char **values, int count, bool *success);
+Entry_t *db_get_all_entries(Db_t *db);
+Entry_t *db_get_entry_by_id(Db_t *db, int id);
+Entry_t *db_get_entries_by_ids(Db_t *db, const int *ids, int count);
+Entry_t *db_get_entries_changed_since(Db_t *db, long long time);
+int *db_get_deleted_since(Db_t *db, long long time, int *count);
+Entry_t *db_get_entries_page(Db_t *db, Db_sort_t sort, int after, int limit);
+Entry_t *db_get_entries_by_tag(Db_t *db, const char *tag);
+Entry_t *db_get_entries_for_host(Db_t *db, const char *host);
+bool db_tag_entries(Db_t *db, const char *tag, const int *ids, int count,
+		int *changes);
+bool db_untag_entries(Db_t *db, const char *tag, const int *ids, int count,
+		int *changes);
+bool db_get_history(Db_t *db, int id, Revision_t **history);
+void db_free_history(Revision_t *history);
+bool db_set_history_limit(Db_t *db, int limit);
+bool db_delete_entry_by_id(Db_t *db, int id, bool *success);
+bool db_update_where(Db_t *db, const Db_condition_t *conditions,
+		int ncond, const char **fields, const char **values, int count,
+		int *changes);
+bool db_delete_where(Db_t *db, const Db_condition_t *conditions, int count,
+		int *changes);
 
 char *db_last_modified(const char *path);
 bool db_shred(const char *path);
@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "entries.h"
+#include "output.h"
+#include "format.h"
 
 //This implements a simple, single linked list.
 //Not all of the functions are used in command line
@@ -226,50 +228,185 @@ void list_free(Entry_t *list)
 	}
 }
 
-//Method calculates longest string from
-//current list cursor and returns it.
-//If the cursor is null, -1 is returned.
-static int list_calculate_longest_str_cursor(Entry_t *entry)
+//Number of entries printed since list_print_begin().
+static size_t printed = 0;
+
+//Layout of the human readable output. Compiled on first use.
+#define TEXT_LAYOUT "Id\t\t{id}\nTitle\t\t{title}\nUsername\t{user}\n" \
+	"Passphrase\t{passphrase}\nAddress\t\t{url}\nNotes\t\t{notes}\n" \
+	"{separator}"
+
+static Format_t *text_format = NULL;
+
+//Method calculates field lengths of the current list cursor
+//into lengths and returns the longest one.
+static size_t list_calculate_lengths(Entry_t *cursor, Entry_lengths_t *lengths)
 {
-	int len;
-	Entry_t *cursor = entry;
-	
-	if(cursor == NULL)
-		return -1;
-	
-	len = strlen(cursor->title);
-		
-	if(len < strlen(cursor->user))
-		len = strlen(cursor->user);
-	if(len < strlen(cursor->pwd))
-		len = strlen(cursor->pwd);
-	if(len < strlen(cursor->url))
-		len = strlen(cursor->url);
-	if(len < strlen(cursor->notes))
-		len = strlen(cursor->notes);
-	
+	size_t len;
+
+	lengths->title = strlen(cursor->title);
+	lengths->user = strlen(cursor->user);
+	lengths->pwd = strlen(cursor->pwd);
+	lengths->url = strlen(cursor->url);
+	lengths->notes = strlen(cursor->notes);
+
+	len = lengths->title;
+
+	if(len < lengths->user)
+		len = lengths->user;
+	if(len < lengths->pwd)
+		len = lengths->pwd;
+	if(len < lengths->url)
+		len = lengths->url;
+	if(len < lengths->notes)
+		len = lengths->notes;
+
 	return len;
 }
 
-//Calculate longest string in the list.
-static int list_calculate_longest_str(Entry_t *list)
+//Write one entry using format, followed by a new line.
+//Lengths are only calculated if the format has a separator line,
+//as long as the longest string of the entry.
+static void list_write_format(Entry_t *cursor, Format_t *format)
 {
-	int len = 0;
-	int cursorlen = 0;
-	
-	Entry_t *cursor = list;
-	
-	while(cursor != NULL) {
-		
-		cursorlen = list_calculate_longest_str_cursor(cursor);
-		
-		if(len < cursorlen)
-			len = cursorlen;
-		
-		cursor = cursor->next;
+	Entry_lengths_t lengths;
+	size_t len;
+
+	if(format->has_separator) {
+		len = list_calculate_lengths(cursor, &lengths) + 18;
+		format_write(format, cursor, &lengths, len);
 	}
-	
-	return len;
+	else {
+		format_write(format, cursor, NULL, 0);
+	}
+
+	output_char('\n');
+}
+
+//Write one entry as a JSON object to the output buffer.
+static void list_write_json(Entry_t *cursor, Entry_lengths_t *lengths)
+{
+	OUTPUT_LITERAL("{\"id\":");
+	output_int(cursor->id);
+	OUTPUT_LITERAL(",\"title\":");
+	output_json_str(cursor->title, lengths->title);
+	OUTPUT_LITERAL(",\"user\":");
+	output_json_str(cursor->user, lengths->user);
+	OUTPUT_LITERAL(",\"passphrase\":");
+	output_json_str(cursor->pwd, lengths->pwd);
+	OUTPUT_LITERAL(",\"url\":");
+	output_json_str(cursor->url, lengths->url);
+	OUTPUT_LITERAL(",\"notes\":");
+	output_json_str(cursor->notes, lengths->notes);
+	output_char('}');
+}
+
+//Write one entry as a tab separated line to the output buffer.
+static void list_write_tsv(Entry_t *cursor, Entry_lengths_t *lengths)
+{
+	output_int(cursor->id);
+	output_char('\t');
+	output_tsv_str(cursor->title, lengths->title);
+	output_char('\t');
+	output_tsv_str(cursor->user, lengths->user);
+	output_char('\t');
+	output_tsv_str(cursor->pwd, lengths->pwd);
+	output_char('\t');
+	output_tsv_str(cursor->url, lengths->url);
+	output_char('\t');
+	output_tsv_str(cursor->notes, lengths->notes);
+	output_char('\n');
+}
+
+//Write one entry in the current output mode. Len is the
+//separator width used by the text output.
+static void list_write_entry(Entry_t *cursor, Entry_lengths_t *lengths,
+			size_t len)
+{
+	switch(output_get_mode()) {
+	case OUTPUT_TEXT:
+		format_write(text_format, cursor, lengths, len);
+		output_char('\n');
+		break;
+	case OUTPUT_JSON:
+		if(printed > 0)
+			output_char(',');
+
+		output_char('\n');
+		list_write_json(cursor, lengths);
+		break;
+	case OUTPUT_NDJSON:
+		list_write_json(cursor, lengths);
+		output_char('\n');
+		break;
+	case OUTPUT_TSV:
+		list_write_tsv(cursor, lengths);
+		break;
+	case OUTPUT_FORMAT:
+		list_write_format(cursor, output_get_format());
+		break;
+	}
+
+	printed++;
+}
+
+//Start printing a sequence of entries. Text output needs nothing
+//here, JSON output is an array and TSV output starts with a header.
+//Returns false on failure.
+bool list_print_begin()
+{
+	printed = 0;
+
+	if(text_format == NULL) {
+
+		text_format = format_compile(TEXT_LAYOUT);
+
+		if(text_format == NULL)
+			return false;
+	}
+
+	if(output_get_mode() == OUTPUT_JSON)
+		output_char('[');
+	else if(output_get_mode() == OUTPUT_TSV)
+		OUTPUT_LITERAL("id\ttitle\tuser\tpassphrase\turl\tnotes\n");
+
+	return true;
+}
+
+//Print one entry of a sequence started with list_print_begin().
+//In text mode each entry gets a separator as long as its own
+//longest string.
+void list_print_next(Entry_t *cursor)
+{
+	Entry_lengths_t lengths;
+	size_t len;
+
+	//Custom formats calculate only the lengths they need
+	if(output_get_mode() == OUTPUT_FORMAT) {
+		list_write_entry(cursor, NULL, 0);
+		return;
+	}
+
+	len = list_calculate_lengths(cursor, &lengths) + 18;
+
+	if(output_get_mode() == OUTPUT_TEXT)
+		output_char('\n');
+
+	list_write_entry(cursor, &lengths, len);
+}
+
+//Finish the sequence and write everything out.
+void list_print_end()
+{
+	if(output_get_mode() == OUTPUT_JSON) {
+
+		if(printed > 0)
+			output_char('\n');
+
+		OUTPUT_LITERAL("]\n");
+	}
+
+	output_flush();
 }
 
 //Print whole list from the cursor pointed by list.
@@ -279,53 +416,85 @@ void list_print(Entry_t *list)
 {
 	//Take copy of the head pointer.
 	Entry_t *tmp = list->next;
-	int len = list_calculate_longest_str(tmp) + 18;
-	
-	if(tmp != NULL)
-		printf("\n");
-	
+	Entry_lengths_t *lengths = NULL;
+	size_t count = 0;
+	size_t len = 0;
+	size_t cursorlen;
+	size_t i;
+
+	if(!list_print_begin())
+		return;
+
+	if(output_get_mode() != OUTPUT_TEXT) {
+
+		while(tmp != NULL) {
+			list_print_next(tmp);
+			tmp = tmp->next;
+		}
+
+		list_print_end();
+		return;
+	}
+
+	if(tmp == NULL)
+		return;
+
+	for(Entry_t *cursor = tmp; cursor != NULL; cursor = cursor->next)
+		count++;
+
+	lengths = malloc(count * sizeof(Entry_lengths_t));
+
+	if(lengths == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return;
+	}
+
+	//Separator line is as long as the longest string in the list,
+	//so we need to know all the lengths before printing anything.
+	i = 0;
+
+	for(Entry_t *cursor = tmp; cursor != NULL; cursor = cursor->next) {
+
+		cursorlen = list_calculate_lengths(cursor, &lengths[i++]);
+
+		if(len < cursorlen)
+			len = cursorlen;
+	}
+
+	len += 18;
+
+	output_char('\n');
+
+	i = 0;
+
 	while(tmp != NULL) {
-	
-		printf("%s\t\t%d\n", "Id", tmp->id);
-		printf("%s\t\t%s\n", "Title", tmp->title);
-		printf("%s\t%s\n", "Username", tmp->user);
-		printf("%s\t%s\n", "Passphrase", tmp->pwd);
-		printf("%s\t\t%s\n", "Address", tmp->url);
-		printf("%s\t\t%s\n", "Notes", tmp->notes);
-		
-		//Print separator line as long as the longest string
-		//in the list.
-		for(int i = 0; i < len; i++)
-			printf("-");
-		
-		printf("\n");
-		
+		list_write_entry(tmp, &lengths[i++], len);
 		tmp = tmp->next;
 	}
+
+	list_print_end();
+	free(lengths);
 }
 
 //Print current cursor.
 void list_print_one(Entry_t *cursor)
 {
-	int len = list_calculate_longest_str_cursor(cursor);
-	
-	len += 18;
-	
-	if(len == -1)
+	if(cursor == NULL)
 		return;
-	
-	printf("\n");
-	printf("%s\t\t%d\n", "Id", cursor->id);
-	printf("%s\t\t%s\n", "Title", cursor->title);
-	printf("%s\t%s\n", "Username", cursor->user);
-	printf("%s\t%s\n", "Passphrase", cursor->pwd);
-	printf("%s\t\t%s\n", "Address", cursor->url);
-	printf("%s\t\t%s\n", "Notes", cursor->notes);
-	
-	//Print separator line as long as the longest string in the current
-	//list cursor
-	for(int i = 0; i < len; i++)
-		printf("-");
-	
-	printf("\n");
+
+	if(!list_print_begin())
+		return;
+
+	list_print_next(cursor);
+	list_print_end();
+}
+
+//Print current cursor using format, regardless of the output mode.
+//Output is buffered, caller must call output_flush() when done.
+void list_print_format(Entry_t *cursor, Format_t *format)
+{
+	if(cursor == NULL)
+		return;
+
+	list_write_format(cursor, format);
 }
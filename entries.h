@@ -21,6 +21,9 @@
 #ifndef __ENTRIES_H
 #define __ENTRIES_H
 
+#include <stddef.h>
+#include <stdbool.h>
+
 typedef struct Entry {
 
 	char *title;
@@ -34,6 +37,19 @@ typedef struct Entry {
 
 } Entry_t;
 
+//Lengths of the printable fields of one entry.
+typedef struct Entry_lengths {
+
+	size_t title;
+	size_t user;
+	size_t pwd;
+	size_t url;
+	size_t notes;
+
+} Entry_lengths_t;
+
+struct Format;
+
 Entry_t *list_create(const char *title, const char *user,
 			const char *pass, const char *url, const char *notes,
                         int id, Entry_t *next);
@@ -50,5 +66,9 @@ Entry_t *list_remove(Entry_t *list, Entry_t *nd);
 void list_free(Entry_t *list);
 void list_print(Entry_t *list);
 void list_print_one(Entry_t *cursor);
+bool list_print_begin();
+void list_print_next(Entry_t *cursor);
+void list_print_end();
+void list_print_format(Entry_t *cursor, struct Format *format);
 
 #endif
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "format.h"
+#include "output.h"
+
+//Output formats, like "{id}\t{user}\t{url}", are compiled into a small
+//list of instructions once. Each instruction either writes a piece of
+//literal text or one field of an entry, so printing a row is just a
+//walk through the list. Fields which are not in the format are never
+//touched.
+
+typedef struct Format_name {
+
+	const char *name;
+	Format_field_t field;
+
+} Format_name_t;
+
+static const Format_name_t field_names[] = {
+	{"id",         FIELD_ID},
+	{"title",      FIELD_TITLE},
+	{"user",       FIELD_USER},
+	{"passphrase", FIELD_PASSPHRASE},
+	{"pass",       FIELD_PASSPHRASE},
+	{"url",        FIELD_URL},
+	{"notes",      FIELD_NOTES},
+	{"separator",  FIELD_SEPARATOR},
+	{NULL,         FIELD_LITERAL}
+};
+
+//Look up field by the name between the braces.
+//Returns false if there's no such field.
+static bool format_lookup_field(const char *name, size_t len,
+				Format_field_t *field)
+{
+	for(int i = 0; field_names[i].name != NULL; i++) {
+
+		if(strlen(field_names[i].name) == len &&
+			strncmp(field_names[i].name, name, len) == 0) {
+
+			*field = field_names[i].field;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//Compile template into a format. Fields are written as {name} and
+//\t, \n, \\ and \{ can be used in the literal text.
+//Returns NULL on failure. Caller must free the return value with
+//format_free().
+Format_t *format_compile(const char *template)
+{
+	Format_t *format = NULL;
+	size_t len = strlen(template);
+	const char *ptr = template;
+	const char *end;
+	char *text;
+	Format_op_t *op = NULL;
+	Format_field_t field;
+
+	format = calloc(1, sizeof(Format_t));
+
+	if(format == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return NULL;
+	}
+
+	//Unescaped text is never longer than the template, and
+	//there can't be more instructions than there are characters.
+	format->text = malloc(len + 1);
+	format->ops = malloc((len + 1) * sizeof(Format_op_t));
+
+	if(format->text == NULL || format->ops == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		format_free(format);
+		return NULL;
+	}
+
+	text = format->text;
+
+	while(*ptr != '\0') {
+
+		if(*ptr == '{') {
+
+			end = strchr(ptr, '}');
+
+			if(end == NULL) {
+				fprintf(stderr, "Missing } in format.\n");
+				format_free(format);
+				return NULL;
+			}
+
+			if(!format_lookup_field(ptr + 1, end - ptr - 1, &field)) {
+				fprintf(stderr, "Unknown field %.*s in format.\n",
+					(int)(end - ptr + 1), ptr);
+				format_free(format);
+				return NULL;
+			}
+
+			if(field == FIELD_SEPARATOR)
+				format->has_separator = true;
+
+			op = &format->ops[format->count++];
+			op->field = field;
+			op->text = NULL;
+			op->len = 0;
+
+			//Literal text after this starts a new instruction
+			op = NULL;
+			ptr = end + 1;
+			continue;
+		}
+
+		if(op == NULL) {
+			op = &format->ops[format->count++];
+			op->field = FIELD_LITERAL;
+			op->text = text;
+			op->len = 0;
+		}
+
+		if(*ptr == '\\' && ptr[1] != '\0') {
+
+			ptr++;
+
+			switch(*ptr) {
+			case 't':
+				*text = '\t';
+				break;
+			case 'n':
+				*text = '\n';
+				break;
+			case '\\':
+			case '{':
+				*text = *ptr;
+				break;
+			default:
+				//Not an escape, keep the backslash
+				*text++ = '\\';
+				op->len++;
+				*text = *ptr;
+				break;
+			}
+		}
+		else {
+			*text = *ptr;
+		}
+
+		text++;
+		op->len++;
+		ptr++;
+	}
+
+	return format;
+}
+
+void format_free(Format_t *format)
+{
+	if(format == NULL)
+		return;
+
+	free(format->ops);
+	free(format->text);
+	free(format);
+}
+
+//Returns true if format writes field.
+bool format_uses_field(Format_t *format, Format_field_t field)
+{
+	for(int i = 0; format != NULL && i < format->count; i++) {
+
+		if(format->ops[i].field == field)
+			return true;
+	}
+
+	return false;
+}
+
+//Write entry to the output buffer as described by format.
+//Lengths of the fields can be given if the caller already knows
+//them, otherwise lengths must be NULL. Width is the length of the
+//separator line.
+void format_write(Format_t *format, Entry_t *entry, Entry_lengths_t *lengths,
+		size_t width)
+{
+	Format_op_t *op = format->ops;
+	Format_op_t *end = format->ops + format->count;
+
+	for(; op < end; op++) {
+
+		switch(op->field) {
+		case FIELD_LITERAL:
+			output_write(op->text, op->len);
+			break;
+		case FIELD_ID:
+			output_int(entry->id);
+			break;
+		case FIELD_TITLE:
+			if(lengths != NULL)
+				output_write(entry->title, lengths->title);
+			else
+				output_str(entry->title);
+			break;
+		case FIELD_USER:
+			if(lengths != NULL)
+				output_write(entry->user, lengths->user);
+			else
+				output_str(entry->user);
+			break;
+		case FIELD_PASSPHRASE:
+			if(lengths != NULL)
+				output_write(entry->pwd, lengths->pwd);
+			else
+				output_str(entry->pwd);
+			break;
+		case FIELD_URL:
+			if(lengths != NULL)
+				output_write(entry->url, lengths->url);
+			else
+				output_str(entry->url);
+			break;
+		case FIELD_NOTES:
+			if(lengths != NULL)
+				output_write(entry->notes, lengths->notes);
+			else
+				output_str(entry->notes);
+			break;
+		case FIELD_SEPARATOR:
+			output_repeat('-', width);
+			break;
+		}
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __FORMAT_H
+#define __FORMAT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "entries.h"
+
+//What a single instruction of a compiled format writes.
+typedef enum Format_field {
+
+	FIELD_LITERAL,
+	FIELD_ID,
+	FIELD_TITLE,
+	FIELD_USER,
+	FIELD_PASSPHRASE,
+	FIELD_URL,
+	FIELD_NOTES,
+	FIELD_SEPARATOR
+
+} Format_field_t;
+
+typedef struct Format_op {
+
+	Format_field_t field;
+	const char *text; //Only used by FIELD_LITERAL
+	size_t len;
+
+} Format_op_t;
+
+typedef struct Format {
+
+	Format_op_t *ops;
+	int count;
+	char *text; //Literal text of the format, ops point into this
+	bool has_separator;
+
+} Format_t;
+
+Format_t *format_compile(const char *template);
+void format_free(Format_t *format);
+bool format_uses_field(Format_t *format, Format_field_t field);
+void format_write(Format_t *format, Entry_t *entry, Entry_lengths_t *lengths,
+		size_t width);
+
+#endif
@@ -0,0 +1,588 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "inbox.h"
+#include "crypto.h"
+#include "x25519.h"
+
+//Inbox of a database, <database>.inbox. Entries can be added to it
+//while the database is closed, without the master passphrase: each
+//one is sealed with box_seal() to the public key in the header of the
+//inbox and appended. The secret key is in the database, so the
+//entries are merged into it when it's next opened.
+//
+//Header is INBOX_MAGIC, a random generation and the public key.
+//A record is its length, 32 bits big-endian, the sealed entry and the
+//length again, so the last record can be checked without reading the
+//others. Sealed entry holds the title, user, passphrase, url and
+//notes, each terminated by a null byte.
+//
+//Merging stores the generation and the offset it got to in the same
+//transaction as the entries, and then replaces the inbox with an
+//empty one of a new generation. If it's interrupted in between, the
+//next merge skips what's already in the database.
+
+#define INBOX_MAGIC "SteelBox"
+#define INBOX_GENERATION_SIZE (8)
+#define INBOX_HEADER_SIZE (8 + INBOX_GENERATION_SIZE + BOX_KEY_SIZE)
+
+static uint32_t inbox_read32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void inbox_write32(unsigned char *p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+//Returns path of the inbox of the database in db_path.
+//Caller must free the return value.
+static char *inbox_path(const char *db_path)
+{
+	char *path = malloc(strlen(db_path) + strlen(".inbox") + 1);
+
+	if(path == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return NULL;
+	}
+
+	strcpy(path, db_path);
+	strcat(path, ".inbox");
+
+	return path;
+}
+
+//Returns true if the database in db_path has an inbox
+bool inbox_exists(const char *db_path)
+{
+	char *path = inbox_path(db_path);
+	struct stat st;
+	bool exists;
+
+	if(path == NULL)
+		return false;
+
+	exists = (stat(path, &st) == 0);
+	free(path);
+
+	return exists;
+}
+
+//Open the inbox in path and lock it. A merge may have replaced the
+//file while waiting for the lock, in which case the new one is opened.
+//Returns the descriptor, or -1 on failure.
+static int inbox_open(const char *path)
+{
+	struct stat opened, current;
+	int fd;
+
+	while(true) {
+
+		fd = open(path, O_RDWR);
+
+		if(fd < 0) {
+			fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+			return -1;
+		}
+
+		if(flock(fd, LOCK_EX) != 0 || fstat(fd, &opened) != 0) {
+			fprintf(stderr, "Error: %s\n", strerror(errno));
+			close(fd);
+			return -1;
+		}
+
+		if(stat(path, &current) == 0 && current.st_ino == opened.st_ino &&
+			current.st_dev == opened.st_dev)
+			return fd;
+
+		close(fd);
+	}
+}
+
+//Read exactly len bytes at offset. Returns false on failure.
+static bool inbox_pread(int fd, void *data, size_t len, off_t offset)
+{
+	ssize_t count;
+
+	for(size_t done = 0; done < len; done += count) {
+
+		count = pread(fd, (char *)data + done, len - done, offset + done);
+
+		if(count <= 0) {
+			fprintf(stderr, "Error: %s\n",
+				count < 0 ? strerror(errno) : "inbox is truncated");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//Write exactly len bytes. Returns false on failure.
+static bool inbox_write(int fd, const void *data, size_t len)
+{
+	ssize_t count;
+
+	for(size_t done = 0; done < len; done += count) {
+
+		count = write(fd, (const char *)data + done, len - done);
+
+		if(count < 0) {
+			fprintf(stderr, "Error: %s\n", strerror(errno));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//Write a new empty inbox with a new generation to path, through
+//a temporary file. Returns false on failure.
+static bool inbox_write_empty(const char *path, const unsigned char *public_key)
+{
+	unsigned char header[INBOX_HEADER_SIZE];
+	char *tmp = NULL;
+	int fd;
+	bool success;
+
+	tmp = malloc(strlen(path) + strlen(".tmp") + 1);
+
+	if(tmp == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return false;
+	}
+
+	strcpy(tmp, path);
+	strcat(tmp, ".tmp");
+
+	memcpy(header, INBOX_MAGIC, 8);
+	memcpy(header + 8 + INBOX_GENERATION_SIZE, public_key, BOX_KEY_SIZE);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if(fd < 0) {
+		fprintf(stderr, "Can't create %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		return false;
+	}
+
+	success = fill_random((char *)header + 8, INBOX_GENERATION_SIZE) &&
+		inbox_write(fd, header, sizeof(header));
+
+	if(success && (fsync(fd) != 0 || rename(tmp, path) != 0)) {
+		fprintf(stderr, "Can't create %s: %s\n", path, strerror(errno));
+		success = false;
+	}
+
+	close(fd);
+
+	if(!success)
+		remove(tmp);
+
+	free(tmp);
+
+	return success;
+}
+
+//Read and check the header of the inbox open in fd.
+//Returns false if it's not an inbox.
+static bool inbox_read_header(int fd, unsigned char *header)
+{
+	if(!inbox_pread(fd, header, INBOX_HEADER_SIZE, 0))
+		return false;
+
+	if(memcmp(header, INBOX_MAGIC, 8) != 0) {
+		fprintf(stderr, "Not an inbox.\n");
+		return false;
+	}
+
+	return true;
+}
+
+//Create the inbox of the database in db_path for public_key. An
+//existing inbox of the same key is kept with its entries.
+//Returns false on failure.
+bool inbox_create(const char *db_path, const unsigned char *public_key)
+{
+	unsigned char header[INBOX_HEADER_SIZE];
+	char *path = inbox_path(db_path);
+	bool success;
+	int fd;
+
+	if(path == NULL)
+		return false;
+
+	if(!inbox_exists(db_path)) {
+		success = inbox_write_empty(path, public_key);
+		free(path);
+		return success;
+	}
+
+	fd = inbox_open(path);
+	success = fd >= 0 && inbox_read_header(fd, header);
+
+	if(success && memcmp(header + 8 + INBOX_GENERATION_SIZE, public_key,
+		BOX_KEY_SIZE) != 0) {
+		fprintf(stderr, "%s belongs to another database.\n", path);
+		success = false;
+	}
+
+	if(fd >= 0)
+		close(fd);
+
+	free(path);
+
+	return success;
+}
+
+//Find the end of the last complete record of the inbox open in fd.
+//Returns false on failure.
+static bool inbox_find_end(int fd, off_t size, off_t *end)
+{
+	unsigned char length[4];
+	off_t offset = INBOX_HEADER_SIZE;
+	off_t next;
+
+	//Fast path, the last record is complete
+	if(size >= INBOX_HEADER_SIZE + 8) {
+
+		if(!inbox_pread(fd, length, 4, size - 4))
+			return false;
+
+		next = size - 8 - (off_t)inbox_read32(length);
+
+		if(next >= INBOX_HEADER_SIZE) {
+
+			unsigned char first[4];
+
+			if(!inbox_pread(fd, first, 4, next))
+				return false;
+
+			if(memcmp(first, length, 4) == 0) {
+				*end = size;
+				return true;
+			}
+		}
+	}
+
+	while(offset + 4 <= size) {
+
+		if(!inbox_pread(fd, length, 4, offset))
+			return false;
+
+		next = offset + 8 + (off_t)inbox_read32(length);
+
+		if(next > size)
+			break;
+
+		offset = next;
+	}
+
+	*end = offset;
+
+	return true;
+}
+
+//Seal entries, a list without a head, to the inbox of the database in
+//db_path and append them all with one write. The database can be
+//closed, no passphrase is needed. Returns false on failure.
+bool inbox_add(const char *db_path, Entry_t *entries)
+{
+	unsigned char header[INBOX_HEADER_SIZE];
+	unsigned char *records = NULL;
+	size_t len = 0;
+	Box_t box;
+	char *path = NULL;
+	struct stat st;
+	off_t end;
+	int fd = -1;
+	bool success = false;
+
+	path = inbox_path(db_path);
+
+	if(path == NULL)
+		return false;
+
+	fd = inbox_open(path);
+
+	//Entries added together share the ephemeral key
+	if(fd < 0 || !inbox_read_header(fd, header) ||
+		!box_seal_init(&box, header + 8 + INBOX_GENERATION_SIZE))
+		goto out;
+
+	for(Entry_t *entry = entries; entry != NULL; entry = entry->next) {
+
+		const char *fields[] = {entry->title, entry->user, entry->pwd,
+					entry->url, entry->notes};
+		char *plain = NULL;
+		char *sealed = NULL;
+		unsigned char *tmp = NULL;
+		size_t plain_len = 0;
+		long sealed_len;
+
+		for(int i = 0; i < 5; i++)
+			plain_len += strlen(fields[i]) + 1;
+
+		plain = malloc(plain_len);
+
+		if(plain == NULL) {
+			fprintf(stderr, "Malloc failed.\n");
+			goto out;
+		}
+
+		plain_len = 0;
+
+		for(int i = 0; i < 5; i++) {
+			strcpy(plain + plain_len, fields[i]);
+			plain_len += strlen(fields[i]) + 1;
+		}
+
+		sealed = box_seal(&box, plain, plain_len, &sealed_len);
+
+		memset(plain, 0, plain_len);
+		free(plain);
+
+		if(sealed != NULL)
+			tmp = realloc(records, len + 8 + sealed_len);
+
+		if(tmp == NULL) {
+			if(sealed != NULL)
+				fprintf(stderr, "Malloc failed.\n");
+			free(sealed);
+			goto out;
+		}
+
+		records = tmp;
+		inbox_write32(records + len, (uint32_t)sealed_len);
+		memcpy(records + len + 4, sealed, sealed_len);
+		inbox_write32(records + len + 4 + sealed_len, (uint32_t)sealed_len);
+		len += 8 + sealed_len;
+		free(sealed);
+	}
+
+	//Drop a record left incomplete by a crash, or it would swallow
+	//the new ones
+	if(fstat(fd, &st) != 0 || !inbox_find_end(fd, st.st_size, &end))
+		goto out;
+
+	if(end < st.st_size && ftruncate(fd, end) != 0) {
+		fprintf(stderr, "Error: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if(lseek(fd, end, SEEK_SET) < 0 || !inbox_write(fd, records, len))
+		goto out;
+
+	if(fdatasync(fd) != 0) {
+		fprintf(stderr, "Error: %s\n", strerror(errno));
+		goto out;
+	}
+
+	success = true;
+
+out:
+	if(fd >= 0)
+		close(fd);
+
+	memset(&box, 0, sizeof(box));
+	free(records);
+	free(path);
+
+	return success;
+}
+
+//Add the entry sealed in a record to db and count it. Damaged entries
+//are skipped, anyone who can write the inbox can append to it.
+//Returns false on failure.
+static bool inbox_add_to_db(Db_t *db, Box_t *box,
+		const unsigned char *sealed, long sealed_len,
+		const unsigned char *secret_key, int *count)
+{
+	const char *fields[5];
+	Entry_t *entry = NULL;
+	char *plain = NULL;
+	long len;
+	long pos = 0;
+	bool success;
+
+	plain = box_open(box, (const char *)sealed, sealed_len, secret_key, &len);
+
+	if(plain == NULL) {
+		fprintf(stderr, "Skipping a damaged entry of the inbox.\n");
+		return true;
+	}
+
+	for(int i = 0; i < 5; i++) {
+
+		fields[i] = plain + pos;
+		pos += strnlen(plain + pos, len - pos) + 1;
+
+		if(pos > len) {
+			fprintf(stderr, "Skipping a damaged entry of the inbox.\n");
+			memset(plain, 0, len);
+			free(plain);
+			return true;
+		}
+	}
+
+	entry = list_create(fields[0], fields[1], fields[2], fields[3],
+		fields[4], 0, NULL);
+
+	memset(plain, 0, len);
+	free(plain);
+
+	if(entry == NULL)
+		return false;
+
+	success = db_add_entry(db, entry);
+	list_free(entry);
+
+	if(success)
+		(*count)++;
+
+	return success;
+}
+
+//Add the entries of the inbox of the database in db_path to db, and
+//empty the inbox. Number of the added entries is stored to count.
+//Returns false on failure, in which case nothing is added.
+bool inbox_merge(const char *db_path, Db_t *db, int *count)
+{
+	unsigned char secret_key[BOX_KEY_SIZE];
+	unsigned char public_key[BOX_KEY_SIZE];
+	unsigned char position[DB_INBOX_POSITION_SIZE];
+	unsigned char *data = NULL;
+	Box_t box;
+	char *path = NULL;
+	struct stat st;
+	off_t offset = 0;
+	off_t end;
+	int fd = -1;
+	bool success = false;
+
+	*count = 0;
+	memset(&box, 0, sizeof(box));
+
+	path = inbox_path(db_path);
+
+	if(path == NULL)
+		return false;
+
+	fd = inbox_open(path);
+
+	if(fd < 0 || fstat(fd, &st) != 0 || st.st_size < INBOX_HEADER_SIZE)
+		goto out;
+
+	data = malloc(st.st_size);
+
+	if(data == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		goto out;
+	}
+
+	if(!inbox_pread(fd, data, st.st_size, 0) ||
+		!inbox_read_header(fd, data) ||
+		!inbox_find_end(fd, st.st_size, &end))
+		goto out;
+
+	if(!db_get_inbox(db, secret_key, position)) {
+		fprintf(stderr, "%s has no key for its inbox.\n", db_path);
+		goto out;
+	}
+
+	x25519_base(public_key, secret_key);
+
+	if(memcmp(data + 8 + INBOX_GENERATION_SIZE, public_key,
+		BOX_KEY_SIZE) != 0) {
+		fprintf(stderr, "%s belongs to another database.\n", path);
+		goto out;
+	}
+
+	//Skip what an interrupted merge already added
+	if(memcmp(position, data + 8, INBOX_GENERATION_SIZE) == 0) {
+		for(int i = 8; i < DB_INBOX_POSITION_SIZE; i++)
+			offset = offset << 8 | position[i];
+	}
+
+	if(offset < INBOX_HEADER_SIZE || offset > end)
+		offset = INBOX_HEADER_SIZE;
+
+	if(!db_begin(db))
+		goto out;
+
+	success = true;
+
+	while(success && offset < end) {
+
+		long len = inbox_read32(data + offset);
+
+		success = inbox_add_to_db(db, &box, data + offset + 4, len,
+			secret_key, count);
+		offset += 8 + len;
+	}
+
+	memcpy(position, data + 8, INBOX_GENERATION_SIZE);
+
+	for(int i = DB_INBOX_POSITION_SIZE - 1; i >= 8; i--) {
+		position[i] = offset & 0xff;
+		offset >>= 8;
+	}
+
+	if(success)
+		success = db_set_inbox_position(db, position) && db_commit(db);
+
+	if(!success) {
+		db_rollback(db);
+		*count = 0;
+		goto out;
+	}
+
+	//Entries are in the database, only the inbox is left to empty
+	success = inbox_write_empty(path, public_key);
+
+out:
+	if(fd >= 0)
+		close(fd);
+
+	memset(secret_key, 0, sizeof(secret_key));
+	memset(&box, 0, sizeof(box));
+	free(data);
+	free(path);
+
+	return success;
+}
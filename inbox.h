@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __INBOX_H
+#define __INBOX_H
+
+#include <stdbool.h>
+#include "database.h"
+
+bool inbox_exists(const char *db_path);
+bool inbox_create(const char *db_path, const unsigned char *public_key);
+bool inbox_add(const char *db_path, Entry_t *entries);
+bool inbox_merge(const char *db_path, Db_t *db, int *count);
+
+#endif
@@ -0,0 +1,955 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+//Log database. For small databases most of the time of a command goes
+//to opening SQLite and checking its schema, so these keep the entries
+//in a single append-only file instead. The file starts with a header
+//followed by records, each of which either puts the whole entry with
+//an id or deletes it. The newest record of an id wins. On connect the
+//file is read into memory once and indexed by id, after that every
+//read is served from memory and every write is one append.
+//
+//Header is LOG_MAGIC and a version, 32 bits big-endian. A record is
+//its type, the id and the length of the rest, then for puts the
+//length and the bytes of the title, user, passphrase, url and notes.
+//Records only count once they are followed by a commit record, which
+//has id and length 0. A write outside a transaction is appended with
+//its commit record, in a transaction the records are kept in memory
+//and appended with one commit record by db_commit(). Records without
+//one, left by a crash, are ignored and dropped on the next write.
+//
+//Readers hold a shared lock on the file, the first write of a
+//connection takes an exclusive one and keeps it until disconnect.
+//Records superseded by newer ones are dropped on close.
+
+#define LOG_MAGIC "SteelLog"
+#define LOG_VERSION (1)
+#define LOG_HEADER_SIZE (12)
+#define LOG_RECORD_HEADER (9)
+#define LOG_PUT 'P'
+#define LOG_DELETE 'D'
+#define LOG_COMMIT 'C'
+
+//Log is compacted on close when less than this share of it is live
+#define LOG_COMPACT_THRESHOLD (0.75)
+
+//One id of the index. Offset of a deleted entry is -1,
+//id 0 marks an empty slot.
+typedef struct Log_slot {
+
+	int id;
+	long long offset;
+
+} Log_slot_t;
+
+typedef struct Log {
+
+	int fd;
+	bool locked;		//Holds the exclusive lock
+	char *data;		//Contents of the file
+	size_t fill;		//Bytes of the file in data
+	size_t len;		//Bytes of committed records in data, and of
+				//the records of the transaction
+	size_t size;		//Allocated size of data
+	Log_slot_t *slots;	//Open addressing, size is a power of two
+	size_t slot_count;
+	size_t used;
+	int last_id;		//Highest id ever used, ids are never reused
+	size_t begin;		//Length at db_begin(), 0 outside transactions.
+				//Records after it are not written yet.
+
+} Log_t;
+
+static const char *log_fields[] = {
+	"title", "user", "passphrase", "url", "notes"
+};
+
+static uint32_t log_read32(const char *p)
+{
+	const unsigned char *u = (const unsigned char *)p;
+
+	return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 |
+		(uint32_t)u[2] << 8 | (uint32_t)u[3];
+}
+
+static void log_write32(char *p, uint32_t value)
+{
+	p[0] = (char)(value >> 24);
+	p[1] = (char)(value >> 16);
+	p[2] = (char)(value >> 8);
+	p[3] = (char)value;
+}
+
+//Returns the slot of id, or the empty slot where it would go
+static Log_slot_t *log_slot(Log_t *log, int id)
+{
+	size_t mask = log->slot_count - 1;
+	size_t i = ((uint32_t)id * 2654435761u) & mask;
+
+	while(log->slots[i].id != 0 && log->slots[i].id != id)
+		i = (i + 1) & mask;
+
+	return &log->slots[i];
+}
+
+//Point id to the record at offset, -1 if it was deleted.
+//Index is kept at most half full. Returns false on failure.
+static bool log_index(Log_t *log, int id, long long offset)
+{
+	Log_slot_t *slot;
+
+	if((log->used + 1) * 2 > log->slot_count) {
+
+		Log_slot_t *old = log->slots;
+		size_t count = log->slot_count;
+
+		log->slot_count = count ? count * 2 : 64;
+		log->slots = calloc(log->slot_count, sizeof(Log_slot_t));
+
+		if(log->slots == NULL) {
+			fprintf(stderr, "Malloc failed.\n");
+			log->slots = old;
+			log->slot_count = count;
+			return false;
+		}
+
+		for(size_t i = 0; i < count; i++) {
+			if(old[i].id != 0)
+				*log_slot(log, old[i].id) = old[i];
+		}
+
+		free(old);
+	}
+
+	slot = log_slot(log, id);
+
+	if(slot->id == 0) {
+		slot->id = id;
+		log->used++;
+	}
+
+	slot->offset = offset;
+
+	if(id > log->last_id)
+		log->last_id = id;
+
+	return true;
+}
+
+//Returns the offset of the record of id, or -1 if there's no such entry
+static long long log_find(Log_t *log, int id)
+{
+	Log_slot_t *slot;
+
+	if(id <= 0 || log->slot_count == 0)
+		return -1;
+
+	slot = log_slot(log, id);
+
+	return slot->id == id ? slot->offset : -1;
+}
+
+//Split the put record at offset into its five fields.
+//Returns false if the record is malformed.
+static bool log_parse(Log_t *log, size_t offset, const char **values,
+		uint32_t *lengths)
+{
+	const char *p = log->data + offset + LOG_RECORD_HEADER;
+	const char *end = p + log_read32(log->data + offset + 5);
+
+	for(int i = 0; i < 5; i++) {
+
+		if(end - p < 4)
+			return false;
+
+		lengths[i] = log_read32(p);
+		p += 4;
+
+		if((size_t)(end - p) < lengths[i])
+			return false;
+
+		values[i] = p;
+		p += lengths[i];
+	}
+
+	return p == end;
+}
+
+//Index the records from log->len up to the commit record ending at end
+static bool log_index_records(Log_t *log, size_t end)
+{
+	while(log->len < end) {
+
+		const char *record = log->data + log->len;
+		int id = (int)log_read32(record + 1);
+
+		if(record[0] != LOG_COMMIT &&
+			!log_index(log, id, record[0] == LOG_PUT ? (long long)log->len : -1))
+			return false;
+
+		log->len += LOG_RECORD_HEADER + log_read32(record + 5);
+	}
+
+	return true;
+}
+
+//Index the committed records from log->len to log->fill. Records
+//after the last commit record are left out. Returns false on failure.
+static bool log_scan_records(Log_t *log)
+{
+	const char *values[5];
+	uint32_t lengths[5];
+	size_t end = log->len;
+
+	while(log->fill - end >= LOG_RECORD_HEADER) {
+
+		const char *record = log->data + end;
+		int id = (int)log_read32(record + 1);
+		size_t length = log_read32(record + 5);
+		bool valid;
+
+		if(length > log->fill - end - LOG_RECORD_HEADER)
+			break;
+
+		if(record[0] == LOG_COMMIT)
+			valid = (id == 0 && length == 0);
+		else
+			valid = id > 0 &&
+				(record[0] == LOG_PUT || record[0] == LOG_DELETE) &&
+				(record[0] == LOG_DELETE || log_parse(log, end, values, lengths));
+
+		if(!valid) {
+			fprintf(stderr, "Log database is corrupted.\n");
+			return false;
+		}
+
+		end += LOG_RECORD_HEADER + length;
+
+		if(record[0] == LOG_COMMIT && !log_index_records(log, end))
+			return false;
+	}
+
+	return true;
+}
+
+//Forget the index and everything after length in data, and index
+//the log again. Returns false on failure.
+static bool log_reload(Log_t *log, size_t length)
+{
+	memset(log->slots, 0, log->slot_count * sizeof(Log_slot_t));
+	log->used = 0;
+	log->last_id = 0;
+	log->fill = length;
+	log->len = LOG_HEADER_SIZE;
+	log->begin = 0;
+
+	return log_scan_records(log);
+}
+
+//Make sure data can hold size bytes. Returns false on failure.
+static bool log_reserve(Log_t *log, size_t size)
+{
+	char *tmp;
+
+	if(size <= log->size)
+		return true;
+
+	if(size < log->size * 2)
+		size = log->size * 2;
+
+	tmp = realloc(log->data, size);
+
+	if(tmp == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return false;
+	}
+
+	log->data = tmp;
+	log->size = size;
+
+	return true;
+}
+
+//Read and index whatever other connections appended to the file since
+//it was last read. Returns false on failure.
+static bool log_refresh(Log_t *log)
+{
+	struct stat st;
+	ssize_t count;
+
+	if(fstat(log->fd, &st) != 0) {
+		fprintf(stderr, "Error: %s\n", strerror(errno));
+		return false;
+	}
+
+	if((size_t)st.st_size > log->fill) {
+
+		if(!log_reserve(log, st.st_size))
+			return false;
+
+		while(log->fill < (size_t)st.st_size) {
+
+			count = pread(log->fd, log->data + log->fill,
+				st.st_size - log->fill, log->fill);
+
+			if(count <= 0) {
+				fprintf(stderr, "Error: %s\n",
+					count < 0 ? strerror(errno) : "short read");
+				return false;
+			}
+
+			log->fill += count;
+		}
+	}
+
+	if(log->len == 0) {
+
+		if(log->fill < LOG_HEADER_SIZE ||
+			memcmp(log->data, LOG_MAGIC, strlen(LOG_MAGIC)) != 0) {
+			fprintf(stderr, "Not a log database.\n");
+			return false;
+		}
+
+		if(log_read32(log->data + strlen(LOG_MAGIC)) != LOG_VERSION) {
+			fprintf(stderr, "Log database was created by a newer " \
+				"version of Steel.\n");
+			return false;
+		}
+
+		log->len = LOG_HEADER_SIZE;
+	}
+
+	return log_scan_records(log);
+}
+
+static void log_free(Log_t *log)
+{
+	if(log == NULL)
+		return;
+
+	if(log->fd >= 0)
+		close(log->fd);
+
+	free(log->data);
+	free(log->slots);
+	free(log);
+}
+
+//Open and index the log in path. Returns NULL on failure.
+static Log_t *log_open(const char *path, int lock)
+{
+	Log_t *log = calloc(1, sizeof(Log_t));
+
+	if(log == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return NULL;
+	}
+
+	log->fd = open(path, O_RDWR);
+
+	if(log->fd < 0) {
+		fprintf(stderr, "Can't open database: %s\n", strerror(errno));
+		log_free(log);
+		return NULL;
+	}
+
+	if(flock(log->fd, lock) != 0 || !log_refresh(log)) {
+		log_free(log);
+		return NULL;
+	}
+
+	log->locked = (lock == LOCK_EX);
+
+	return log;
+}
+
+//Take the exclusive lock before the first write of the connection.
+//Locks can't be upgraded atomically, so whatever was appended
+//meanwhile is read in. Records without a commit record, left by a
+//crash, are dropped. Returns false on failure.
+static bool log_lock(Log_t *log)
+{
+	if(log->locked)
+		return true;
+
+	if(flock(log->fd, LOCK_EX) != 0) {
+		fprintf(stderr, "Error: %s\n", strerror(errno));
+		return false;
+	}
+
+	log->locked = true;
+
+	if(!log_refresh(log))
+		return false;
+
+	if(log->fill > log->len) {
+
+		if(ftruncate(log->fd, log->len) != 0) {
+			fprintf(stderr, "Error: %s\n", strerror(errno));
+			return false;
+		}
+
+		log->fill = log->len;
+	}
+
+	return true;
+}
+
+//Add a commit record after the records of data from offset to
+//log->len and append them to the file in one write, synced if sync
+//is true. On failure the file is cut back to offset and false is
+//returned.
+static bool log_write(Log_t *log, size_t offset, bool sync)
+{
+	char *p = log->data + log->len;
+	size_t length;
+
+	memset(p, 0, LOG_RECORD_HEADER);
+	p[0] = LOG_COMMIT;
+	length = log->len + LOG_RECORD_HEADER - offset;
+
+	for(size_t done = 0; done < length; ) {
+
+		ssize_t count = pwrite(log->fd, log->data + offset + done,
+			length - done, offset + done);
+
+		if(count < 0) {
+			fprintf(stderr, "Error: %s\n", strerror(errno));
+			//Drop what was written
+			if(ftruncate(log->fd, offset) != 0)
+				fprintf(stderr, "Error: %s\n", strerror(errno));
+			return false;
+		}
+
+		done += count;
+	}
+
+	if(sync && fdatasync(log->fd) != 0) {
+		fprintf(stderr, "Error: %s\n", strerror(errno));
+		return false;
+	}
+
+	log->len += LOG_RECORD_HEADER;
+	log->fill = log->len;
+
+	return true;
+}
+
+//Add a record of id to the log and index it. Outside a transaction
+//it's appended to the file right away, otherwise on commit. Values
+//are the five fields of a put, or NULL for a delete. Returns false
+//on failure.
+static bool log_append(Db_t *db, char type, int id, const char **values)
+{
+	Log_t *log = db->log;
+	size_t length = 0;
+	size_t offset;
+	char *p;
+
+	if(!log_lock(log))
+		return false;
+
+	offset = log->len;
+
+	if(values != NULL) {
+		for(int i = 0; i < 5; i++)
+			length += 4 + strlen(values[i] ? values[i] : "");
+	}
+
+	//Room for the commit record too
+	if(!log_reserve(log, log->len + LOG_RECORD_HEADER * 2 + length))
+		return false;
+
+	p = log->data + log->len;
+	p[0] = type;
+	log_write32(p + 1, (uint32_t)id);
+	log_write32(p + 5, (uint32_t)length);
+	p += LOG_RECORD_HEADER;
+
+	if(values != NULL) {
+		for(int i = 0; i < 5; i++) {
+
+			size_t len = strlen(values[i] ? values[i] : "");
+
+			log_write32(p, (uint32_t)len);
+			memcpy(p + 4, values[i] ? values[i] : "", len);
+			p += 4 + len;
+		}
+	}
+
+	log->len += LOG_RECORD_HEADER + length;
+
+	if(log->begin == 0) {
+
+		if(!log_write(log, offset, db->sync)) {
+			log->len = offset;
+			return false;
+		}
+	}
+
+	return log_index(log, id, type == LOG_PUT ? (long long)offset : -1);
+}
+
+//Add entry id with the fields of the record at offset to the end of
+//the list, after tail. Returns the new tail or NULL on failure.
+static Entry_t *log_add_to_list(Log_t *log, Entry_t *tail, int id,
+		long long offset)
+{
+	const char *values[5];
+	uint32_t lengths[5];
+	char *copies[5] = {NULL};
+
+	log_parse(log, offset, values, lengths);
+
+	for(int i = 0; i < 5; i++) {
+
+		copies[i] = strndup(values[i], lengths[i]);
+
+		if(copies[i] == NULL) {
+			fprintf(stderr, "Malloc failed.\n");
+			tail = NULL;
+			break;
+		}
+	}
+
+	if(tail != NULL)
+		tail->next = list_create(copies[0], copies[1], copies[2],
+			copies[3], copies[4], id, NULL);
+
+	for(int i = 0; i < 5; i++)
+		free(copies[i]);
+
+	return tail ? tail->next : NULL;
+}
+
+static bool log_is_file(const char *path)
+{
+	char header[LOG_HEADER_SIZE];
+	FILE *fp = fopen(path, "rb");
+	bool match;
+
+	if(fp == NULL)
+		return false;
+
+	match = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+		memcmp(header, LOG_MAGIC, strlen(LOG_MAGIC)) == 0;
+
+	fclose(fp);
+
+	return match;
+}
+
+//Write the header of a new log to fd. Returns false on failure.
+static bool log_write_header(int fd)
+{
+	char header[LOG_HEADER_SIZE];
+
+	memcpy(header, LOG_MAGIC, strlen(LOG_MAGIC));
+	log_write32(header + strlen(LOG_MAGIC), LOG_VERSION);
+
+	if(write(fd, header, sizeof(header)) != sizeof(header)) {
+		fprintf(stderr, "Error: %s\n", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static bool log_create(const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	bool success;
+
+	if(fd < 0) {
+		fprintf(stderr, "Can't initialize: %s\n", strerror(errno));
+		return false;
+	}
+
+	success = log_write_header(fd);
+	close(fd);
+
+	if(!success)
+		remove(path);
+
+	return success;
+}
+
+static int log_compare_ids(const void *a, const void *b)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+
+	return (x > y) - (x < y);
+}
+
+//Ids of the live entries of log in ascending order, count is set to
+//the number of them. Returns NULL on failure. Caller must free it.
+static int *log_live_ids(Log_t *log, int *count)
+{
+	int *ids = malloc((log->used + 1) * sizeof(int));
+
+	*count = 0;
+
+	if(ids == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		return NULL;
+	}
+
+	for(size_t i = 0; i < log->slot_count; i++) {
+		if(log->slots[i].id != 0 && log->slots[i].offset >= 0)
+			ids[(*count)++] = log->slots[i].id;
+	}
+
+	qsort(ids, *count, sizeof(int), log_compare_ids);
+
+	return ids;
+}
+
+//Rewrite the log with only the newest record of each live entry, if
+//enough of it is superseded. A delete of the highest id is kept, so
+//that the ids are not reused. Returns false on failure.
+static bool log_prepare_close(const char *path)
+{
+	Log_t *log = log_open(path, LOCK_EX);
+	char *tmp = NULL;
+	int *ids = NULL;
+	int count = 0;
+	size_t live = LOG_HEADER_SIZE;
+	int fd = -1;
+	bool success = false;
+
+	if(log == NULL)
+		return false;
+
+	ids = log_live_ids(log, &count);
+
+	if(ids == NULL)
+		goto out;
+
+	for(int i = 0; i < count; i++)
+		live += LOG_RECORD_HEADER +
+			log_read32(log->data + log_find(log, ids[i]) + 5);
+
+	if(log->fill == log->len && live >= log->len * LOG_COMPACT_THRESHOLD) {
+		success = true;
+		goto out;
+	}
+
+	tmp = malloc(strlen(path) + strlen(".tmp") + 1);
+
+	if(tmp == NULL) {
+		fprintf(stderr, "Malloc failed.\n");
+		goto out;
+	}
+
+	strcpy(tmp, path);
+	strcat(tmp, ".tmp");
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if(fd < 0) {
+		fprintf(stderr, "Can't compact the database: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if(!log_write_header(fd))
+		goto out;
+
+	for(int i = 0; i < count; i++) {
+
+		long long offset = log_find(log, ids[i]);
+		size_t length = LOG_RECORD_HEADER + log_read32(log->data + offset + 5);
+
+		if(write(fd, log->data + offset, length) != (ssize_t)length) {
+			fprintf(stderr, "Error: %s\n", strerror(errno));
+			goto out;
+		}
+	}
+
+	if(log->last_id > 0 && log_find(log, log->last_id) < 0) {
+
+		char record[LOG_RECORD_HEADER] = {LOG_DELETE};
+
+		log_write32(record + 1, (uint32_t)log->last_id);
+
+		if(write(fd, record, sizeof(record)) != sizeof(record)) {
+			fprintf(stderr, "Error: %s\n", strerror(errno));
+			goto out;
+		}
+	}
+
+	if(count > 0 || log->last_id > 0) {
+
+		char record[LOG_RECORD_HEADER] = {LOG_COMMIT};
+
+		if(write(fd, record, sizeof(record)) != sizeof(record)) {
+			fprintf(stderr, "Error: %s\n", strerror(errno));
+			goto out;
+		}
+	}
+
+	if(fsync(fd) != 0 || rename(tmp, path) != 0) {
+		fprintf(stderr, "Can't compact the database: %s\n", strerror(errno));
+		goto out;
+	}
+
+	success = true;
+
+out:
+	if(fd >= 0)
+		close(fd);
+
+	if(!success && tmp != NULL)
+		remove(tmp);
+
+	free(tmp);
+	free(ids);
+	log_free(log);
+
+	return success;
+}
+
+static bool log_db_open(Db_t *db)
+{
+	db->log = log_open(db->path, LOCK_SH);
+
+	return db->log != NULL;
+}
+
+static void log_db_close(Db_t *db)
+{
+	log_free(db->log);
+	db->log = NULL;
+}
+
+static Entry_t *log_get(Db_t *db, const int *ids, int count)
+{
+	Entry_t *list = NULL;
+	Entry_t *tail = NULL;
+
+	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1, NULL);
+	tail = list;
+
+	for(int i = 0; i < count && tail != NULL; i++) {
+
+		long long offset = log_find(db->log, ids[i]);
+
+		if(offset >= 0)
+			tail = log_add_to_list(db->log, tail, ids[i], offset);
+	}
+
+	if(tail == NULL) {
+		list_free(list);
+		return NULL;
+	}
+
+	return list;
+}
+
+static Entry_t *log_scan(Db_t *db)
+{
+	Entry_t *list = NULL;
+	int *ids = NULL;
+	int count;
+
+	ids = log_live_ids(db->log, &count);
+
+	if(ids == NULL)
+		return NULL;
+
+	list = log_get(db, ids, count);
+	free(ids);
+
+	return list;
+}
+
+static bool log_put(Db_t *db, Entry_t *entry)
+{
+	const char *values[] = {entry->title, entry->user, entry->pwd,
+				entry->url, entry->notes};
+
+	//Another connection may have added entries since
+	if(!log_lock(db->log))
+		return false;
+
+	return log_append(db, LOG_PUT, db->log->last_id + 1, values);
+}
+
+static bool log_update(Db_t *db, int id, const char **fields,
+		const char **values, int count, bool *success)
+{
+	const char *current[5];
+	uint32_t lengths[5];
+	char *copies[5] = {NULL};
+	long long offset;
+	bool ok = true;
+
+	*success = false;
+
+	if(count < 1 || !log_lock(db->log))
+		return false;
+
+	offset = log_find(db->log, id);
+
+	if(offset < 0)
+		return true;
+
+	log_parse(db->log, offset, current, lengths);
+
+	//Record is copied, appending may move the data
+	for(int i = 0; i < 5 && ok; i++) {
+
+		copies[i] = strndup(current[i], lengths[i]);
+
+		if(copies[i] == NULL) {
+			fprintf(stderr, "Malloc failed.\n");
+			ok = false;
+		}
+
+		current[i] = copies[i];
+	}
+
+	for(int i = 0; i < count && ok; i++) {
+
+		int field = 0;
+
+		while(field < 5 && strcmp(log_fields[field], fields[i]) != 0)
+			field++;
+
+		if(field == 5) {
+			fprintf(stderr, "Unknown field %s.\n", fields[i]);
+			ok = false;
+		}
+		else {
+			current[field] = values[i];
+		}
+	}
+
+	if(ok)
+		ok = log_append(db, LOG_PUT, id, current);
+
+	for(int i = 0; i < 5; i++)
+		free(copies[i]);
+
+	*success = ok;
+
+	return ok;
+}
+
+static bool log_remove(Db_t *db, int id, bool *success)
+{
+	*success = false;
+
+	if(!log_lock(db->log))
+		return false;
+
+	if(log_find(db->log, id) < 0)
+		return true;
+
+	*success = log_append(db, LOG_DELETE, id, NULL);
+
+	return *success;
+}
+
+static int log_next_id(Db_t *db)
+{
+	return db->log->last_id + 1;
+}
+
+static bool log_begin(Db_t *db)
+{
+	if(!log_lock(db->log))
+		return false;
+
+	db->log->begin = db->log->len;
+
+	return true;
+}
+
+//Append the records of the transaction with one commit record. If
+//that fails the transaction is rolled back.
+static bool log_commit(Db_t *db)
+{
+	Log_t *log = db->log;
+	size_t begin = log->begin;
+
+	if(begin == 0 || log->len == begin) {
+		log->begin = 0;
+		return true;
+	}
+
+	log->begin = 0;
+
+	//log_append() left room for the commit record
+	if(!log_write(log, begin, db->sync)) {
+		log_reload(log, begin);
+		return false;
+	}
+
+	return true;
+}
+
+//Forget the records of the transaction, which were never written,
+//and index the log again
+static bool log_rollback(Db_t *db)
+{
+	Log_t *log = db->log;
+
+	if(log->begin == 0) {
+		fprintf(stderr, "Error: no transaction is active\n");
+		return false;
+	}
+
+	return log_reload(log, log->begin);
+}
+
+const Db_backend_t db_log_backend = {
+	.name = "log",
+	.is_file = log_is_file,
+	.create = log_create,
+	.prepare_close = log_prepare_close,
+	.open = log_db_open,
+	.close = log_db_close,
+	.get = log_get,
+	.scan = log_scan,
+	.put = log_put,
+	.update = log_update,
+	.remove = log_remove,
+	.next_id = log_next_id,
+	.begin = log_begin,
+	.commit = log_commit,
+	.rollback = log_rollback
+};
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "output.h"
+
+//Output layer used when printing entries. Printing a big list with
+//printf means several library calls per entry and the separator line
+//was printed one character at a time. Here all the data is formatted
+//into one large buffer and written to stdout with as few write calls
+//as possible.
+
+static char buffer[OUTPUT_BUFFER_SIZE];
+static size_t used = 0;
+static Output_mode_t mode = OUTPUT_TEXT;
+static struct Format *format = NULL;
+
+//Set the output mode by name. Name can be "text", "json", "ndjson"
+//or "tsv". Returns false if the name is unknown.
+bool output_set_mode(const char *name)
+{
+	if(strcmp(name, "text") == 0)
+		mode = OUTPUT_TEXT;
+	else if(strcmp(name, "json") == 0)
+		mode = OUTPUT_JSON;
+	else if(strcmp(name, "ndjson") == 0)
+		mode = OUTPUT_NDJSON;
+	else if(strcmp(name, "tsv") == 0)
+		mode = OUTPUT_TSV;
+	else
+		return false;
+
+	return true;
+}
+
+//Print entries using a compiled format, see format.c.
+void output_set_format(struct Format *fmt)
+{
+	mode = OUTPUT_FORMAT;
+	format = fmt;
+}
+
+Output_mode_t output_get_mode()
+{
+	return mode;
+}
+
+//Returns the format set with output_set_format() or NULL.
+struct Format *output_get_format()
+{
+	return format;
+}
+
+//Write all len bytes of data to file descriptor fd.
+//Returns true on success, false on failure.
+static bool write_all(int fd, const char *data, size_t len)
+{
+	ssize_t ret;
+
+	while(len > 0) {
+
+		ret = write(fd, data, len);
+
+		if(ret < 0) {
+			if(errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		data += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+//Write everything buffered so far to stdout.
+//Anything printed with stdio before is flushed first, so that
+//the output stays in the same order it was produced.
+void output_flush()
+{
+	fflush(stdout);
+
+	if(used == 0)
+		return;
+
+	if(!write_all(STDOUT_FILENO, buffer, used))
+		fprintf(stderr, "Failed to write output\n");
+
+	used = 0;
+}
+
+//Append len bytes of data to the output buffer.
+void output_write(const char *data, size_t len)
+{
+	if(len > OUTPUT_BUFFER_SIZE - used) {
+
+		output_flush();
+
+		//Data does not fit into the buffer even when it's empty,
+		//so there's no point copying it. Write it directly.
+		if(len >= OUTPUT_BUFFER_SIZE) {
+			if(!write_all(STDOUT_FILENO, data, len))
+				fprintf(stderr, "Failed to write output\n");
+
+			return;
+		}
+	}
+
+	memcpy(buffer + used, data, len);
+	used += len;
+}
+
+//Append null terminated string to the output buffer.
+void output_str(const char *str)
+{
+	output_write(str, strlen(str));
+}
+
+//Append single character to the output buffer.
+void output_char(char ch)
+{
+	if(used == OUTPUT_BUFFER_SIZE)
+		output_flush();
+
+	buffer[used++] = ch;
+}
+
+//Append decimal representation of value to the output buffer.
+void output_int(int value)
+{
+	//Enough for any 64 bit integer and the sign
+	char digits[21];
+	char *ptr = digits + sizeof(digits);
+	unsigned int number = value;
+
+	if(value < 0)
+		number = -(unsigned int)value;
+
+	do {
+		*--ptr = '0' + (number % 10);
+		number /= 10;
+	} while(number > 0);
+
+	if(value < 0)
+		*--ptr = '-';
+
+	output_write(ptr, digits + sizeof(digits) - ptr);
+}
+
+//Append character ch count times to the output buffer.
+void output_repeat(char ch, size_t count)
+{
+	size_t len;
+
+	while(count > 0) {
+
+		if(used == OUTPUT_BUFFER_SIZE)
+			output_flush();
+
+		len = OUTPUT_BUFFER_SIZE - used;
+
+		if(len > count)
+			len = count;
+
+		memset(buffer + used, ch, len);
+		used += len;
+		count -= len;
+	}
+}
+
+//Append str as a quoted JSON string to the output buffer.
+//Characters are escaped while copying, runs of characters that
+//don't need escaping are copied as they are.
+void output_json_str(const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = str + len;
+	const char *run = str;
+	unsigned char ch;
+
+	output_char('"');
+
+	for(; str < end; str++) {
+
+		ch = *str;
+
+		if(ch >= 0x20 && ch != '"' && ch != '\\')
+			continue;
+
+		output_write(run, str - run);
+		run = str + 1;
+
+		switch(ch) {
+		case '"':
+			output_write("\\\"", 2);
+			break;
+		case '\\':
+			output_write("\\\\", 2);
+			break;
+		case '\n':
+			output_write("\\n", 2);
+			break;
+		case '\r':
+			output_write("\\r", 2);
+			break;
+		case '\t':
+			output_write("\\t", 2);
+			break;
+		default:
+			output_write("\\u00", 4);
+			output_char(hex[ch >> 4]);
+			output_char(hex[ch & 0x0f]);
+			break;
+		}
+	}
+
+	output_write(run, str - run);
+	output_char('"');
+}
+
+//Append str as a TSV field to the output buffer. Tabs, new lines
+//and backslashes are written as backslash escapes so that every
+//entry stays on its own line.
+void output_tsv_str(const char *str, size_t len)
+{
+	const char *end = str + len;
+	const char *run = str;
+
+	for(; str < end; str++) {
+
+		if(*str != '\t' && *str != '\n' && *str != '\r' && *str != '\\')
+			continue;
+
+		output_write(run, str - run);
+		run = str + 1;
+
+		switch(*str) {
+		case '\t':
+			output_write("\\t", 2);
+			break;
+		case '\n':
+			output_write("\\n", 2);
+			break;
+		case '\r':
+			output_write("\\r", 2);
+			break;
+		default:
+			output_write("\\\\", 2);
+			break;
+		}
+	}
+
+	output_write(run, str - run);
+}
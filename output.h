@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+//Size of the output buffer. Everything printed through the output
+//layer is collected here and written out with a single write call
+//when the buffer fills up or when output_flush() is called.
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+//Append string literal to the output buffer without calculating
+//its length at run time.
+#define OUTPUT_LITERAL(str) output_write(str, sizeof(str) - 1)
+
+//Format used when printing entries. OUTPUT_TEXT is the
+//traditional human readable output, the rest are meant for scripts.
+typedef enum Output_mode {
+
+	OUTPUT_TEXT,
+	OUTPUT_JSON,
+	OUTPUT_NDJSON,
+	OUTPUT_TSV,
+	OUTPUT_FORMAT
+
+} Output_mode_t;
+
+struct Format;
+
+bool output_set_mode(const char *name);
+void output_set_format(struct Format *format);
+Output_mode_t output_get_mode();
+struct Format *output_get_format();
+void output_write(const char *data, size_t len);
+void output_str(const char *str);
+void output_char(char ch);
+void output_int(int value);
+void output_repeat(char ch, size_t count);
+void output_json_str(const char *str, size_t len);
+void output_tsv_str(const char *str, size_t len);
+void output_flush();
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rekey.h"
+#include "crypto.h"
+#include "vfs.h"
+
+//Changing the master passphrase of a closed database. The database is
+//read once and re-encrypted with a new key to <database>.rekey, which
+//replaces the database only after it's complete and synced. Decrypted
+//data is only kept in memory, a chunk or a page at a time.
+//
+//Several databases are rekeyed concurrently, as most of the time goes
+//to bcrypt and the ciphers, which each run on one CPU.
+
+#define REKEY_EXT ".rekey"
+
+//Databases shared by the workers of rekey_databases(). Each worker
+//takes the next database until all are done.
+typedef struct Rekey_pool
+{
+	char **paths;
+	bool *results;
+	int count;
+	int next;
+	const char *old_passphrase;
+	const char *new_passphrase;
+	pthread_mutex_t lock;
+
+} Rekey_pool_t;
+
+//Returns true if the file path with ext appended exists
+static bool rekey_file_exists(const char *path, const char *ext)
+{
+	char name[strlen(path) + strlen(ext) + 1];
+	struct stat st;
+
+	strcpy(name, path);
+	strcat(name, ext);
+
+	return stat(name, &st) == 0;
+}
+
+//Change the master passphrase of the closed database in path, plain
+//encrypted or paged, from old_passphrase to new_passphrase. Returns
+//false on failure, the database is left as it was.
+bool rekey_database(const char *path, const char *old_passphrase,
+	const char *new_passphrase)
+{
+	char rekey_path[strlen(path) + strlen(REKEY_EXT) + 1];
+	FILE *fIn = NULL;
+	FILE *fOut = NULL;
+	struct stat st;
+	bool paged;
+	bool success;
+	int fd;
+
+	paged = is_file_paged(path);
+
+	if(!paged && !is_file_encrypted(path)) {
+		fprintf(stderr, "%s: is not a closed database\n", path);
+		return false;
+	}
+
+	//Journal of a paged database has blocks under the old key
+	if(paged && (rekey_file_exists(path, "-journal") ||
+		rekey_file_exists(path, "-wal"))) {
+		fprintf(stderr, "%s: has a journal. Use the database once " \
+			"to recover it first.\n", path);
+		return false;
+	}
+
+	fIn = fopen(path, "r");
+
+	if(fIn == NULL || fstat(fileno(fIn), &st) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+
+		if(fIn != NULL)
+			fclose(fIn);
+
+		return false;
+	}
+
+	strcpy(rekey_path, path);
+	strcat(rekey_path, REKEY_EXT);
+
+	fd = open(rekey_path, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+
+	if(fd < 0) {
+		fprintf(stderr, "%s: %s\n", rekey_path, strerror(errno));
+
+		if(errno == EEXIST)
+			fprintf(stderr, "Remove it if a rekey of %s was " \
+				"interrupted.\n", path);
+
+		fclose(fIn);
+		return false;
+	}
+
+	fOut = fdopen(fd, "w");
+
+	if(fOut == NULL) {
+		fprintf(stderr, "%s: %s\n", rekey_path, strerror(errno));
+		close(fd);
+		fclose(fIn);
+		remove(rekey_path);
+		return false;
+	}
+
+	if(paged)
+		success = vfs_rekey(fIn, fOut, old_passphrase, new_passphrase);
+	else
+		success = rekey_file(fIn, fOut, old_passphrase, new_passphrase);
+
+	fclose(fIn);
+
+	//Keep the permissions of the database
+	if(success && (fflush(fOut) != 0 ||
+		fchmod(fd, st.st_mode & 0777) != 0 || fsync(fd) != 0)) {
+		fprintf(stderr, "%s: %s\n", rekey_path, strerror(errno));
+		success = false;
+	}
+
+	if(fclose(fOut) != 0)
+		success = false;
+
+	if(success && rename(rekey_path, path) != 0) {
+		fprintf(stderr, "Failed to rename %s: %s\n", rekey_path,
+			strerror(errno));
+		success = false;
+	}
+
+	if(!success)
+		remove(rekey_path);
+
+	return success;
+}
+
+static void *rekey_worker(void *arg)
+{
+	Rekey_pool_t *pool = arg;
+	int i;
+
+	while(true) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if(i >= pool->count)
+			break;
+
+		pool->results[i] = rekey_database(pool->paths[i],
+			pool->old_passphrase, pool->new_passphrase);
+	}
+
+	return NULL;
+}
+
+//Change the master passphrase of count databases in paths with
+//rekey_database(), on as many threads as there are CPUs. Result of
+//each database is stored to results. Returns false if any failed.
+bool rekey_databases(char **paths, int count, const char *old_passphrase,
+	const char *new_passphrase, bool *results)
+{
+	Rekey_pool_t pool;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int workers = cpus < 1 ? 1 : (cpus < count ? cpus : count);
+	int started = 0;
+	bool success = true;
+
+	if(count < 1)
+		return true;
+
+	pthread_t threads[workers];
+
+	pool.paths = paths;
+	pool.results = results;
+	pool.count = count;
+	pool.next = 0;
+	pool.old_passphrase = old_passphrase;
+	pool.new_passphrase = new_passphrase;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	//This thread is one of the workers
+	while(started < workers - 1 &&
+		pthread_create(&threads[started], NULL, rekey_worker, &pool) == 0)
+		started++;
+
+	rekey_worker(&pool);
+
+	for(int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&pool.lock);
+
+	for(int i = 0; i < count; i++)
+		success = success && results[i];
+
+	return success;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __REKEY_H
+#define __REKEY_H
+
+#include <stdbool.h>
+
+bool rekey_database(const char *path, const char *old_passphrase,
+	const char *new_passphrase);
+bool rekey_databases(char **paths, int count, const char *old_passphrase,
+	const char *new_passphrase, bool *results);
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+//Rijndael-256 on AES-NI, for the cipher of encrypted files. libmcrypt
+//runs the same cipher a byte at a time with table lookups; here each
+//block is two AES states of 128 bits. AES instructions shift the rows
+//within their state, so before every round the bytes which Rijndael-256
+//moves across the halves are swapped with a blend and a shuffle, as
+//described by Intel in its AES-NI white paper.
+//
+//CFB mode of libmcrypt shifts one byte of ciphertext into the register
+//for each byte, so every byte takes a block encryption. Encryption
+//needs the previous byte first, but when decrypting the whole register
+//is known in advance and RIJNDAEL_LANES blocks are interleaved.
+//
+//Only x86 with AES-NI and SSE4.1 is supported, rijndael_available()
+//returns false elsewhere and the caller uses libmcrypt.
+
+#include <string.h>
+
+#include "rijndael.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RIJNDAEL_AESNI
+#include <immintrin.h>
+#define AESNI __attribute__((target("aes,sse4.1")))
+#endif
+
+//Bytes handled at once. The register and the ciphertext of a chunk
+//are kept in one buffer, where the register of each byte is the
+//RIJNDAEL_BLOCK_SIZE bytes before it.
+#define RIJNDAEL_CHUNK_SIZE (4096)
+
+//Blocks decrypted at once
+#define RIJNDAEL_LANES (4)
+
+static const unsigned char sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+//Expand key to the round keys of cfb, RIJNDAEL_BLOCK_SIZE bytes for
+//each round. Key has 8 words as does the block, so the key schedule
+//is the one of AES-256 continued to 120 words.
+static void rijndael_expand_key(Rijndael_cfb_t *cfb, const char *key)
+{
+	unsigned char *w = cfb->keys;
+	unsigned char rcon = 1;
+	unsigned char t[4];
+	int words = sizeof(cfb->keys) / 4;
+	int nk = RIJNDAEL_KEY_SIZE / 4;
+
+	memcpy(w, key, RIJNDAEL_KEY_SIZE);
+
+	for(int i = nk; i < words; i++) {
+		memcpy(t, w + 4 * (i - 1), 4);
+
+		if(i % nk == 0) {
+			unsigned char first = t[0];
+
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[first];
+
+			rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0);
+		}
+		else if(i % nk == 4) {
+
+			for(int j = 0; j < 4; j++)
+				t[j] = sbox[t[j]];
+		}
+
+		for(int j = 0; j < 4; j++)
+			w[4 * i + j] = w[4 * (i - nk) + j] ^ t[j];
+	}
+}
+
+#ifdef RIJNDAEL_AESNI
+
+//Encrypt RIJNDAEL_LANES blocks, or only the first one if one is true,
+//starting at in, in + 1 and so on. First byte of each is stored to out,
+//that's all CFB uses.
+AESNI static inline void rijndael_encrypt_lanes(const __m128i *keys,
+	const unsigned char *in, unsigned char *out, bool one)
+{
+	const __m128i blend = _mm_setr_epi8(0, -128, -128, -128, 0, 0, -128,
+		-128, 0, 0, -128, -128, 0, 0, 0, -128);
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 6, 7, 4, 5, 10, 11, 8, 9,
+		14, 15, 12, 13, 2, 3);
+	const int lanes = one ? 1 : RIJNDAEL_LANES;
+	__m128i lo[RIJNDAEL_LANES];
+	__m128i hi[RIJNDAEL_LANES];
+	__m128i t;
+
+	for(int i = 0; i < lanes; i++) {
+		lo[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + i)),
+			keys[0]);
+		hi[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + i + 16)),
+			keys[1]);
+	}
+
+	for(int r = 1; r < RIJNDAEL_ROUNDS; r++) {
+
+		for(int i = 0; i < lanes; i++) {
+			t = _mm_blendv_epi8(lo[i], hi[i], blend);
+			hi[i] = _mm_blendv_epi8(hi[i], lo[i], blend);
+			lo[i] = _mm_aesenc_si128(_mm_shuffle_epi8(t, shuffle),
+				keys[2 * r]);
+			hi[i] = _mm_aesenc_si128(_mm_shuffle_epi8(hi[i], shuffle),
+				keys[2 * r + 1]);
+		}
+	}
+
+	//First byte is in the first half
+	for(int i = 0; i < lanes; i++) {
+		t = _mm_blendv_epi8(lo[i], hi[i], blend);
+		t = _mm_aesenclast_si128(_mm_shuffle_epi8(t, shuffle),
+			keys[2 * RIJNDAEL_ROUNDS]);
+		out[i] = _mm_cvtsi128_si32(t) & 0xff;
+	}
+}
+
+AESNI static void rijndael_load_keys(Rijndael_cfb_t *cfb, __m128i *keys)
+{
+	for(int i = 0; i < 2 * (RIJNDAEL_ROUNDS + 1); i++)
+		keys[i] = _mm_loadu_si128((const __m128i *)(cfb->keys + 16 * i));
+}
+
+AESNI static void rijndael_aesni_encrypt(Rijndael_cfb_t *cfb,
+	unsigned char *data, long len)
+{
+	unsigned char buf[RIJNDAEL_BLOCK_SIZE + RIJNDAEL_CHUNK_SIZE];
+	__m128i keys[2 * (RIJNDAEL_ROUNDS + 1)];
+	unsigned char stream;
+	long n;
+
+	rijndael_load_keys(cfb, keys);
+
+	while(len > 0) {
+		n = len < RIJNDAEL_CHUNK_SIZE ? len : RIJNDAEL_CHUNK_SIZE;
+		memcpy(buf, cfb->reg, RIJNDAEL_BLOCK_SIZE);
+
+		for(long i = 0; i < n; i++) {
+			rijndael_encrypt_lanes(keys, buf + i, &stream, true);
+			data[i] ^= stream;
+			buf[RIJNDAEL_BLOCK_SIZE + i] = data[i];
+		}
+
+		memcpy(cfb->reg, buf + n, RIJNDAEL_BLOCK_SIZE);
+		data += n;
+		len -= n;
+	}
+
+	memset(buf, 0, sizeof(buf));
+}
+
+AESNI static void rijndael_aesni_decrypt(Rijndael_cfb_t *cfb,
+	unsigned char *data, long len)
+{
+	unsigned char buf[RIJNDAEL_BLOCK_SIZE + RIJNDAEL_CHUNK_SIZE];
+	__m128i keys[2 * (RIJNDAEL_ROUNDS + 1)];
+	unsigned char stream[RIJNDAEL_LANES];
+	long n;
+	long i;
+
+	rijndael_load_keys(cfb, keys);
+
+	while(len > 0) {
+		n = len < RIJNDAEL_CHUNK_SIZE ? len : RIJNDAEL_CHUNK_SIZE;
+		memcpy(buf, cfb->reg, RIJNDAEL_BLOCK_SIZE);
+		memcpy(buf + RIJNDAEL_BLOCK_SIZE, data, n);
+
+		for(i = 0; i + RIJNDAEL_LANES <= n; i += RIJNDAEL_LANES) {
+			rijndael_encrypt_lanes(keys, buf + i, stream, false);
+
+			for(int j = 0; j < RIJNDAEL_LANES; j++)
+				data[i + j] ^= stream[j];
+		}
+
+		for(; i < n; i++) {
+			rijndael_encrypt_lanes(keys, buf + i, stream, true);
+			data[i] ^= stream[0];
+		}
+
+		memcpy(cfb->reg, buf + n, RIJNDAEL_BLOCK_SIZE);
+		data += n;
+		len -= n;
+	}
+}
+
+#endif
+
+//Returns true if the CPU supports the instructions this needs
+bool rijndael_available()
+{
+#ifdef RIJNDAEL_AESNI
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse4.1");
+#else
+	return false;
+#endif
+}
+
+//Initialize cfb with RIJNDAEL_KEY_SIZE bytes of key and
+//RIJNDAEL_BLOCK_SIZE bytes of iv
+void rijndael_cfb_init(Rijndael_cfb_t *cfb, const char *key, const char *iv)
+{
+	rijndael_expand_key(cfb, key);
+	memcpy(cfb->reg, iv, RIJNDAEL_BLOCK_SIZE);
+}
+
+//Encrypt len bytes of data in place. Data can be given in pieces
+//of any size, the result is the same. Only to be called if
+//rijndael_available() is true.
+void rijndael_cfb_encrypt(Rijndael_cfb_t *cfb, char *data, long len)
+{
+#ifdef RIJNDAEL_AESNI
+	rijndael_aesni_encrypt(cfb, (unsigned char *)data, len);
+#endif
+}
+
+//Decrypt len bytes of data in place, as rijndael_cfb_encrypt()
+void rijndael_cfb_decrypt(Rijndael_cfb_t *cfb, char *data, long len)
+{
+#ifdef RIJNDAEL_AESNI
+	rijndael_aesni_decrypt(cfb, (unsigned char *)data, len);
+#endif
+}
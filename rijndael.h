@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __RIJNDAEL_H
+#define __RIJNDAEL_H
+
+#include <stdbool.h>
+
+#define RIJNDAEL_KEY_SIZE (32)
+#define RIJNDAEL_BLOCK_SIZE (32)
+#define RIJNDAEL_ROUNDS (14)
+
+//Rijndael with 256-bit key and block in 8-bit CFB mode, the same as
+//"rijndael-256" in "cfb" mode of libmcrypt
+typedef struct Rijndael_cfb
+{
+	unsigned char keys[RIJNDAEL_BLOCK_SIZE * (RIJNDAEL_ROUNDS + 1)];
+	unsigned char reg[RIJNDAEL_BLOCK_SIZE];
+
+} Rijndael_cfb_t;
+
+bool rijndael_available();
+void rijndael_cfb_init(Rijndael_cfb_t *cfb, const char *key, const char *iv);
+void rijndael_cfb_encrypt(Rijndael_cfb_t *cfb, char *data, long len);
+void rijndael_cfb_decrypt(Rijndael_cfb_t *cfb, char *data, long len);
+
+#endif
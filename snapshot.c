@@ -0,0 +1,684 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+//Read only snapshots of a database for hosts which only look up
+//entries. A snapshot is a single file with every entry sealed on its
+//own and a CDB style hash index on the id, title and host of the
+//entries, so a lookup is one probe into the index and one record to
+//decrypt. It's read through mmap without SQLite. The key is random and
+//kept in a key file, so opening a snapshot needs no key derivation.
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crypto.h"
+#include "database.h"
+#include "snapshot.h"
+
+//Layout of a snapshot, numbers are big endian:
+//header  magic (4), number of entries (4) and SNAPSHOT_TABLES times
+//        position (8) and number of slots (4) of a hash table
+//records length (4) and the entry sealed with seal_data()
+//tables  slots of hash (8) and position (8) of a record, position 0
+//        is an empty slot
+#define SNAPSHOT_MAGIC (0x33497547)
+#define SNAPSHOT_TABLES (256)
+#define SNAPSHOT_TABLE_SIZE (12)
+#define SNAPSHOT_HEADER_SIZE (8 + SNAPSHOT_TABLES * SNAPSHOT_TABLE_SIZE)
+#define SNAPSHOT_SLOT_SIZE (16)
+
+//Key file holds the key of the records and the key of the hashes
+#define SNAPSHOT_KEY_FILE_SIZE (2 * KEY_SIZE)
+
+//Longest id as a decimal string
+#define SNAPSHOT_ID_MAX (16)
+
+//Hash of one lookup key of a record
+typedef struct Snapshot_slot {
+
+	uint64_t hash;
+	uint64_t position;
+
+} Snapshot_slot_t;
+
+static void snapshot_put(unsigned char *p, uint64_t value, int size)
+{
+	for(int i = size - 1; i >= 0; i--) {
+		p[i] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+static uint64_t snapshot_get(const unsigned char *p, int size)
+{
+	uint64_t value = 0;
+
+	for(int i = 0; i < size; i++)
+		value = (value << 8) | p[i];
+
+	return value;
+}
+
+//Returns the path of the key file of the snapshot in path,
+//$STEEL_SNAPSHOT_KEY if it's set or else path with ".key" appended.
+//Caller must free the return value.
+static char *snapshot_key_path(const char *path)
+{
+	char *env = getenv("STEEL_SNAPSHOT_KEY");
+	char *keypath = NULL;
+
+	if(env != NULL && env[0] != '\0')
+		keypath = strdup(env);
+	else {
+		keypath = malloc(strlen(path) + strlen(".key") + 1);
+
+		if(keypath != NULL) {
+			strcpy(keypath, path);
+			strcat(keypath, ".key");
+		}
+	}
+
+	if(keypath == NULL)
+		fprintf(stderr, "Malloc failed\n");
+
+	return keypath;
+}
+
+//Read the keys of the snapshot in path to records and index. If
+//create is true and there's no key file yet, it's created with new
+//keys. An existing key file is reused, so that a snapshot compiled
+//again can be read with the key readers already have.
+//Returns false on failure.
+static bool snapshot_keys(const char *path, bool create, Key_t *records,
+		Key_t *index)
+{
+	unsigned char data[SNAPSHOT_KEY_FILE_SIZE];
+	char *keypath = snapshot_key_path(path);
+	bool success = false;
+	int fd;
+
+	if(keypath == NULL)
+		return false;
+
+	fd = open(keypath, O_RDONLY);
+
+	if(fd >= 0) {
+		success = (read(fd, data, sizeof(data)) == sizeof(data));
+		close(fd);
+
+		if(!success)
+			fprintf(stderr, "%s: is not a snapshot key\n", keypath);
+	}
+	else if(!create || errno != ENOENT) {
+		fprintf(stderr, "Cannot read snapshot key %s: %s\n", keypath,
+			strerror(errno));
+	}
+	else {
+		fd = open(keypath, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+
+		success = (fd >= 0 && fill_random((char *)data, sizeof(data)) &&
+			write(fd, data, sizeof(data)) == sizeof(data));
+
+		if(fd >= 0)
+			close(fd);
+
+		if(!success) {
+			fprintf(stderr, "Cannot create snapshot key %s\n", keypath);
+			remove(keypath);
+		}
+	}
+
+	free(keypath);
+
+	if(!success)
+		return false;
+
+	memset(records, 0, sizeof(Key_t));
+	memset(index, 0, sizeof(Key_t));
+	memcpy(records->data, data, KEY_SIZE);
+	memcpy(index->data, data + KEY_SIZE, KEY_SIZE);
+
+	return true;
+}
+
+//Keyed hash of a lookup key, so that the index doesn't reveal the
+//titles or hosts. Titles are hashed in lower case.
+//Returns false on failure.
+static bool snapshot_hash(Key_t key, Snapshot_key_t kind, const char *value,
+		uint64_t *hash)
+{
+	size_t len = strlen(value);
+	unsigned char *mac = NULL;
+	char *data = malloc(len + 1);
+
+	if(data == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return false;
+	}
+
+	data[0] = (char)kind;
+
+	for(size_t i = 0; i < len; i++) {
+
+		if(kind == SNAPSHOT_TITLE)
+			data[i + 1] = tolower((unsigned char)value[i]);
+		else
+			data[i + 1] = value[i];
+	}
+
+	mac = get_data_hmac(data, len + 1, key);
+	free(data);
+
+	if(mac == NULL)
+		return false;
+
+	*hash = snapshot_get(mac, 8);
+	free(mac);
+
+	return true;
+}
+
+//Returns true if titles a and b are equal, ignoring case.
+static bool snapshot_title_equals(const char *a, const char *b)
+{
+	while(*a != '\0' && tolower((unsigned char)*a) ==
+		tolower((unsigned char)*b)) {
+		a++;
+		b++;
+	}
+
+	return *a == *b;
+}
+
+//Add the lookup keys of entry, stored at position, to slots.
+//Returns false on failure.
+static bool snapshot_add_slots(Entry_t *entry, uint64_t position, Key_t key,
+		Snapshot_slot_t **slots, int *count, int *size)
+{
+	char id[SNAPSHOT_ID_MAX];
+	char host[DB_HOST_MAX + 1];
+	const char *values[3] = {id, entry->title, NULL};
+
+	snprintf(id, sizeof(id), "%d", entry->id);
+
+	if(db_host_key(entry->url, host))
+		values[SNAPSHOT_HOST] = host;
+
+	for(int i = SNAPSHOT_ID; i <= SNAPSHOT_HOST; i++) {
+
+		if(values[i] == NULL)
+			continue;
+
+		if(*count == *size) {
+
+			Snapshot_slot_t *tmp = realloc(*slots,
+				(*size * 2 + 64) * sizeof(Snapshot_slot_t));
+
+			if(tmp == NULL) {
+				fprintf(stderr, "Malloc failed\n");
+				return false;
+			}
+
+			*slots = tmp;
+			*size = *size * 2 + 64;
+		}
+
+		if(!snapshot_hash(key, i, values[i], &(*slots)[*count].hash))
+			return false;
+
+		(*slots)[*count].position = position;
+		(*count)++;
+	}
+
+	return true;
+}
+
+//Write entry to fp sealed with key as a record. Length of the record
+//is stored to len. Returns false on failure.
+static bool snapshot_write_record(FILE *fp, Entry_t *entry, Key_t key,
+		long *len)
+{
+	const char *fields[] = {
+		entry->title, entry->user, entry->pwd, entry->url, entry->notes
+	};
+	unsigned char length[4];
+	char *record = NULL;
+	char *sealed = NULL;
+	long size = 4;
+	long pos = 4;
+	bool success;
+
+	for(int i = 0; i < 5; i++)
+		size += strlen(fields[i]) + 1;
+
+	record = malloc(size);
+
+	if(record == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return false;
+	}
+
+	snapshot_put((unsigned char *)record, (uint32_t)entry->id, 4);
+
+	for(int i = 0; i < 5; i++) {
+		strcpy(record + pos, fields[i]);
+		pos += strlen(fields[i]) + 1;
+	}
+
+	sealed = seal_data(record, size, key, len);
+	free(record);
+
+	if(sealed == NULL)
+		return false;
+
+	snapshot_put(length, *len, 4);
+
+	success = (fwrite(length, 1, 4, fp) == 4 &&
+		fwrite(sealed, 1, *len, fp) == (size_t)*len);
+
+	free(sealed);
+	*len += 4;
+
+	return success;
+}
+
+//Write the hash tables of slots to fp, starting at position, and
+//their positions and sizes to header. Like in CDB, a table has twice
+//the slots it has keys, so probes are short.
+//Returns false on failure.
+static bool snapshot_write_tables(FILE *fp, unsigned char *header,
+		uint64_t position, const Snapshot_slot_t *slots, int count)
+{
+	unsigned char *table = NULL;
+	unsigned char *slot = NULL;
+	uint64_t nslots;
+	uint64_t j;
+	int keys;
+	bool success = true;
+
+	for(int t = 0; success && t < SNAPSHOT_TABLES; t++) {
+
+		keys = 0;
+
+		for(int i = 0; i < count; i++) {
+			if(slots[i].hash % SNAPSHOT_TABLES == (uint64_t)t)
+				keys++;
+		}
+
+		nslots = keys * 2;
+
+		snapshot_put(header + 8 + t * SNAPSHOT_TABLE_SIZE, position, 8);
+		snapshot_put(header + 8 + t * SNAPSHOT_TABLE_SIZE + 8, nslots, 4);
+
+		if(nslots == 0)
+			continue;
+
+		table = calloc(nslots, SNAPSHOT_SLOT_SIZE);
+
+		if(table == NULL) {
+			fprintf(stderr, "Malloc failed\n");
+			return false;
+		}
+
+		//Slots are filled in the order of the entries, so the entries
+		//of the same key are found in that order too
+		for(int i = 0; i < count; i++) {
+
+			if(slots[i].hash % SNAPSHOT_TABLES != (uint64_t)t)
+				continue;
+
+			j = (slots[i].hash >> 8) % nslots;
+
+			while(snapshot_get(table + j * SNAPSHOT_SLOT_SIZE + 8, 8) != 0)
+				j = (j + 1) % nslots;
+
+			slot = table + j * SNAPSHOT_SLOT_SIZE;
+			snapshot_put(slot, slots[i].hash, 8);
+			snapshot_put(slot + 8, slots[i].position, 8);
+		}
+
+		success = (fwrite(table, SNAPSHOT_SLOT_SIZE, nslots, fp) == nslots);
+		position += nslots * SNAPSHOT_SLOT_SIZE;
+		free(table);
+	}
+
+	return success;
+}
+
+//Compile entries of list, which starts with the head, to a snapshot in
+//path. The snapshot is written next to path and renamed over it, so
+//readers always see a whole snapshot. Returns false on failure.
+bool snapshot_compile(Entry_t *list, const char *path)
+{
+	unsigned char header[SNAPSHOT_HEADER_SIZE] = {0};
+	Snapshot_slot_t *slots = NULL;
+	uint64_t position = SNAPSHOT_HEADER_SIZE;
+	uint32_t entries = 0;
+	int count = 0;
+	int size = 0;
+	long len = 0;
+	char *tmp = NULL;
+	FILE *fp = NULL;
+	bool success;
+	Key_t key;
+	Key_t index;
+
+	if(!snapshot_keys(path, true, &key, &index))
+		return false;
+
+	tmp = malloc(strlen(path) + strlen(".tmp") + 1);
+
+	if(tmp == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		return false;
+	}
+
+	strcpy(tmp, path);
+	strcat(tmp, ".tmp");
+
+	fp = fopen(tmp, "w");
+
+	if(fp == NULL) {
+		fprintf(stderr, "Cannot write %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		return false;
+	}
+
+	//Header is written again when the tables are known
+	success = (fwrite(header, 1, sizeof(header), fp) == sizeof(header));
+
+	for(Entry_t *entry = list->next; success && entry != NULL;
+		entry = entry->next) {
+
+		success = snapshot_add_slots(entry, position, index, &slots,
+			&count, &size) && snapshot_write_record(fp, entry, key, &len);
+
+		position += len;
+		entries++;
+	}
+
+	if(success)
+		success = snapshot_write_tables(fp, header, position, slots, count);
+
+	free(slots);
+
+	if(success) {
+		snapshot_put(header, SNAPSHOT_MAGIC, 4);
+		snapshot_put(header + 4, entries, 4);
+
+		success = (fseek(fp, 0, SEEK_SET) == 0 &&
+			fwrite(header, 1, sizeof(header), fp) == sizeof(header));
+	}
+
+	success = (fflush(fp) == 0 && fsync(fileno(fp)) == 0) && success;
+	success = (fclose(fp) == 0) && success;
+
+	if(success && rename(tmp, path) != 0) {
+		fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+		success = false;
+	}
+
+	if(!success) {
+		fprintf(stderr, "Failed to compile the snapshot\n");
+		remove(tmp);
+	}
+
+	free(tmp);
+
+	return success;
+}
+
+//Decrypt the record at position of the snapshot in map to an entry.
+//Returns NULL on failure.
+static Entry_t *snapshot_read_record(const unsigned char *map, size_t size,
+		uint64_t position, Key_t key)
+{
+	char *fields[5];
+	Entry_t *entry = NULL;
+	char *data = NULL;
+	char *ptr = NULL;
+	uint64_t len;
+	long datalen;
+
+	if(position < SNAPSHOT_HEADER_SIZE || position > size - 4) {
+		fprintf(stderr, "Snapshot is corrupted\n");
+		return NULL;
+	}
+
+	len = snapshot_get(map + position, 4);
+
+	if(len > size - position - 4) {
+		fprintf(stderr, "Snapshot is corrupted\n");
+		return NULL;
+	}
+
+	data = unseal_data((const char *)map + position + 4, len, key, &datalen);
+
+	if(data == NULL) {
+		fprintf(stderr, "Snapshot was tampered or the key is wrong\n");
+		return NULL;
+	}
+
+	//Fields are null terminated, unseal_data() terminates the last one
+	ptr = data + 4;
+
+	for(int i = 0; i < 5; i++) {
+
+		if(ptr > data + datalen) {
+			fprintf(stderr, "Snapshot is corrupted\n");
+			free(data);
+			return NULL;
+		}
+
+		fields[i] = ptr;
+		ptr += strlen(ptr) + 1;
+	}
+
+	entry = list_create(fields[0], fields[1], fields[2], fields[3],
+		fields[4], (int)snapshot_get((unsigned char *)data, 4), NULL);
+
+	free(data);
+
+	return entry;
+}
+
+//Returns true if entry really has value as its key of kind, and not
+//only the same hash.
+static bool snapshot_matches(Entry_t *entry, Snapshot_key_t kind,
+		const char *value)
+{
+	char key[DB_HOST_MAX + 1];
+
+	switch(kind) {
+	case SNAPSHOT_ID:
+		snprintf(key, sizeof(key), "%d", entry->id);
+		return strcmp(key, value) == 0;
+	case SNAPSHOT_TITLE:
+		return snapshot_title_equals(entry->title, value);
+	case SNAPSHOT_HOST:
+		return db_host_key(entry->url, key) && strcmp(key, value) == 0;
+	}
+
+	return false;
+}
+
+//Look value of kind up from the snapshot in map with one probe of the
+//index, and append the matching entries to tail.
+//Returns the new tail, or NULL on failure.
+static Entry_t *snapshot_probe(const unsigned char *map, size_t size,
+		Key_t key, Key_t index, Snapshot_key_t kind, const char *value,
+		Entry_t *tail)
+{
+	const unsigned char *table = NULL;
+	const unsigned char *slot = NULL;
+	Entry_t *entry = NULL;
+	uint64_t hash;
+	uint64_t position;
+	uint64_t nslots;
+	uint64_t j;
+
+	if(!snapshot_hash(index, kind, value, &hash))
+		return NULL;
+
+	table = map + 8 + (hash % SNAPSHOT_TABLES) * SNAPSHOT_TABLE_SIZE;
+	position = snapshot_get(table, 8);
+	nslots = snapshot_get(table + 8, 4);
+
+	if(nslots == 0)
+		return tail;
+
+	if(position > size || nslots > (size - position) / SNAPSHOT_SLOT_SIZE) {
+		fprintf(stderr, "Snapshot is corrupted\n");
+		return NULL;
+	}
+
+	j = (hash >> 8) % nslots;
+
+	for(uint64_t i = 0; i < nslots; i++, j = (j + 1) % nslots) {
+
+		slot = map + position + j * SNAPSHOT_SLOT_SIZE;
+
+		if(snapshot_get(slot + 8, 8) == 0)
+			break;
+
+		if(snapshot_get(slot, 8) != hash)
+			continue;
+
+		entry = snapshot_read_record(map, size, snapshot_get(slot + 8, 8),
+			key);
+
+		if(entry == NULL)
+			return NULL;
+
+		if(snapshot_matches(entry, kind, value)) {
+			tail->next = entry;
+			tail = entry;
+		}
+		else
+			list_free(entry);
+	}
+
+	return tail;
+}
+
+//Look entries up from the snapshot in path by id, title or host. Title
+//is matched ignoring case. Host matches the entries of the host and of
+//its parent domains, most specific first, like db_get_entries_for_host().
+//Returns NULL on failure. The head only contains initialization data.
+Entry_t *snapshot_lookup(const char *path, Snapshot_key_t kind,
+		const char *value)
+{
+	char key[DB_HOST_MAX + 1];
+	unsigned char *map = NULL;
+	Entry_t *list = NULL;
+	Entry_t *tail = NULL;
+	struct stat st;
+	char *dot = NULL;
+	bool parents;
+	int fd;
+	Key_t records;
+	Key_t index;
+
+	if(kind == SNAPSHOT_HOST && !db_host_key(value, key)) {
+		fprintf(stderr, "Invalid host %s.\n", value);
+		return NULL;
+	}
+
+	if(kind == SNAPSHOT_ID)
+		snprintf(key, sizeof(key), "%d", atoi(value));
+	else if(kind == SNAPSHOT_TITLE)
+		key[0] = '\0';
+
+	if(!snapshot_keys(path, false, &records, &index))
+		return NULL;
+
+	fd = open(path, O_RDONLY);
+
+	if(fd < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if(fstat(fd, &st) != 0 || st.st_size < SNAPSHOT_HEADER_SIZE) {
+		fprintf(stderr, "%s: is not a snapshot\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "Cannot map %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if(snapshot_get(map, 4) != SNAPSHOT_MAGIC) {
+		fprintf(stderr, "%s: is not a snapshot\n", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	list = list_create("Title", "User", "Passphrase", "Address", "Id", -1,
+		NULL);
+	tail = list;
+
+	if(kind != SNAPSHOT_HOST) {
+		tail = snapshot_probe(map, st.st_size, records, index, kind,
+			kind == SNAPSHOT_TITLE ? value : key, tail);
+	}
+	else {
+		//"com.example.db01", then "com.example", top level domain
+		//alone is not matched. Addresses have no parents.
+		parents = !db_host_is_address(key, strlen(key));
+
+		while(tail != NULL) {
+
+			tail = snapshot_probe(map, st.st_size, records, index, kind,
+				key, tail);
+			dot = strrchr(key, '.');
+
+			if(!parents || dot == NULL || strchr(key, '.') == dot)
+				break;
+
+			*dot = '\0';
+		}
+	}
+
+	munmap(map, st.st_size);
+
+	if(tail == NULL) {
+		list_free(list);
+		return NULL;
+	}
+
+	return list;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <stdbool.h>
+#include "entries.h"
+
+//Keys entries can be looked up by in a snapshot
+typedef enum Snapshot_key {
+
+	SNAPSHOT_ID,
+	SNAPSHOT_TITLE,
+	SNAPSHOT_HOST
+
+} Snapshot_key_t;
+
+bool snapshot_compile(Entry_t *list, const char *path);
+Entry_t *snapshot_lookup(const char *path, Snapshot_key_t kind,
+		const char *value);
+
+#endif
@@ -23,10 +23,125 @@
 #include <stdbool.h>
 #include <string.h>
 #include <getopt.h>
+#include <limits.h>
 #include "cmd_ui.h"
+#include "database.h"
+#include "output.h"
+#include "format.h"
 
 #define VERSION 1.0
 
+//Short options of the commands. See long_options below.
+#define SHORT_OPTIONS "i:b:B:o:cs:g:a:d:r:f:lR:SVp:u:U:n:h"
+
+//Options without a short version
+enum {
+	OPT_OUTPUT = 256,
+	OPT_FORMAT,
+	OPT_IDS_FROM,
+	OPT_BATCH,
+	OPT_PASSPHRASE_FD,
+	OPT_DELETE_WHERE,
+	OPT_UPDATE_WHERE,
+	OPT_SET,
+	OPT_DB_PROFILE,
+	OPT_CHANGED_SINCE,
+	OPT_DELETED_SINCE,
+	OPT_HISTORY,
+	OPT_HISTORY_LIMIT,
+	OPT_TAG,
+	OPT_UNTAG,
+	OPT_FOR_HOST,
+	OPT_SORT,
+	OPT_LIMIT,
+	OPT_AFTER,
+	OPT_PAGED,
+	OPT_LOG,
+	OPT_SEAL,
+	OPT_DB,
+	OPT_COMPILE_SNAPSHOT,
+	OPT_SNAPSHOT_GET,
+	OPT_INBOX,
+	OPT_REKEY,
+	OPT_REKEY_ALL
+};
+
+static struct option long_options[] =
+{
+	{"init-new",               required_argument, 0, 'i'},
+	{"backup",                 required_argument, 0, 'b'},
+	{"import-backup",          required_argument, 0, 'B'},
+	{"open",                   required_argument, 0, 'o'},
+	{"close",                  no_argument,       0, 'c'},
+	{"show",                   required_argument, 0, 's'},
+	{"gen-pass",               required_argument, 0, 'g'},
+	{"add",                    required_argument, 0, 'a'},
+	{"delete",                 required_argument, 0, 'd'},
+	{"replace",                required_argument, 0, 'r'},
+	{"shred-db",               required_argument, 0, 'R'},
+	{"find",                   required_argument, 0, 'f'},
+	{"list-all",               no_argument,       0, 'l'},
+	{"show-status",            no_argument,       0, 'S'},
+	{"version",                no_argument,       0, 'V'},
+	{"help",                   no_argument,       0, 'h'},
+	{"show-passphrase",        required_argument, 0, 'p'},
+	{"show-username",          required_argument, 0, 'u'},
+	{"show-url",               required_argument, 0, 'U'},
+	{"show-notes",             required_argument, 0, 'n'},
+	{"output",                 required_argument, 0, OPT_OUTPUT},
+	{"format",                 required_argument, 0, OPT_FORMAT},
+	{"ids-from",               required_argument, 0, OPT_IDS_FROM},
+	{"batch",                  no_argument,       0, OPT_BATCH},
+	{"passphrase-fd",          required_argument, 0, OPT_PASSPHRASE_FD},
+	{"delete-where",           required_argument, 0, OPT_DELETE_WHERE},
+	{"update-where",           required_argument, 0, OPT_UPDATE_WHERE},
+	{"set",                    required_argument, 0, OPT_SET},
+	{"db-profile",             required_argument, 0, OPT_DB_PROFILE},
+	{"changed-since",          required_argument, 0, OPT_CHANGED_SINCE},
+	{"deleted-since",          required_argument, 0, OPT_DELETED_SINCE},
+	{"history",                required_argument, 0, OPT_HISTORY},
+	{"history-limit",          required_argument, 0, OPT_HISTORY_LIMIT},
+	{"tag",                    required_argument, 0, OPT_TAG},
+	{"untag",                  required_argument, 0, OPT_UNTAG},
+	{"for-host",               required_argument, 0, OPT_FOR_HOST},
+	{"sort",                   required_argument, 0, OPT_SORT},
+	{"limit",                  required_argument, 0, OPT_LIMIT},
+	{"after",                  required_argument, 0, OPT_AFTER},
+	{"paged",                  no_argument,       0, OPT_PAGED},
+	{"log",                    no_argument,       0, OPT_LOG},
+	{"seal",                   required_argument, 0, OPT_SEAL},
+	{"db",                     required_argument, 0, OPT_DB},
+	{"compile-snapshot",       required_argument, 0, OPT_COMPILE_SNAPSHOT},
+	{"snapshot-get",           required_argument, 0, OPT_SNAPSHOT_GET},
+	{"inbox",                  no_argument,       0, OPT_INBOX},
+	{"rekey",                  required_argument, 0, OPT_REKEY},
+	{"rekey-all",              no_argument,       0, OPT_REKEY_ALL},
+	{0, 0, 0, 0}
+
+};
+
+//Compiled --format, if given.
+static Format_t *format = NULL;
+
+//Tag given with --tag without ids, filters --list-all.
+static char *tag_filter = NULL;
+
+//Paging of --list-all given with --sort, --limit and --after.
+//Negative limit and after mean they were not given.
+static char *sort = NULL;
+static int limit = -1;
+static int after = -1;
+
+//Create or close the database as a paged database, --paged.
+static bool paged = false;
+
+//Create the database as an append-only log, --log.
+static bool log_db = false;
+
+//Assignments given with --set, used by --update-where.
+static char **assignments = NULL;
+static int assignment_count = 0;
+
 static void version_print()
 {
 	char *str = "This is free software; see the source for copying conditions.\n" \
@@ -50,25 +165,99 @@ OPTIONS\n\
 -i, --init-new          <path>                        Create a new database\n\
 -o, --open              <path>                        Decrypt existing database\n\
 -c, --close                                           Encrypt open database\n\
+    --paged                                           With --init-new or --close,\n\
+						      keep the database encrypted\n\
+						      page by page, so that it's\n\
+						      never decrypted on disk\n\
+    --log                                             With --init-new, keep the\n\
+						      entries in an append-only log,\n\
+						      faster for small databases\n\
+    --rekey             <path>                        Change the master passphrase\n\
+						      of a closed database without\n\
+						      decrypting it on disk\n\
+    --rekey-all                                       Change the master passphrase\n\
+						      of all the closed databases\n\
 -a, --add               <title> <user> <url> <notes>  Add new entry to database\n\
--s, --show              <id>                          Show entry by id\n\
+-s, --show              <id>[,<id>...]                Show entries by ids\n\
 -g, --gen-pass          <length> [count]              Generate secure password\n\
 -d, --delete            <id>                          Delete an entry by id\n\
 -r, --replace           <id> <what> [content]         Replace an entry data\n\
 						      <what> can be either \"user\",\n\
 						      \"title\", \"url\", \"notes\" or\n\
 					              \"passphrase\".\n\
+-r, --replace           <id> <field>=<value> ...      Replace several fields at once\n\
 -R, --shred-db          <path>                        Shred database\n\
 -f, --find              <search>                      Search database\n\
--l, --list-all                                        Show all entries\n\
+    --for-host          <host>                        Show entries for <host> and\n\
+						      its parent domains\n\
+-l, --list-all          [--tag <tag>]                 Show all entries, or only\n\
+						      entries tagged with <tag>\n\
+    --sort              <order>                       Sort --list-all by \"id\",\n\
+						      \"title\", \"url\" or \"modified\"\n\
+    --limit             <count>                       Show at most <count> entries\n\
+    --after             <id>                          Start --list-all after the\n\
+						      entry <id>, the last one of\n\
+						      the previous page\n\
+    --changed-since     <time>                        Show entries added or changed\n\
+						      at or after <time>\n\
+    --deleted-since     <time>                        Show ids of entries deleted\n\
+						      at or after <time>\n\
+    --history           <id>                          Show previous values of an\n\
+						      entry\n\
+    --history-limit     <count>                       Keep <count> revisions of\n\
+						      each entry, default 20\n\
+    --seal              <fields>                      Keep \"passphrase\" or\n\
+						      \"passphrase,notes\" encrypted\n\
+						      with the master passphrase\n\
+						      even when the database is open\n\
+    --tag               <tag> <id>[,<id>...]          Tag entries\n\
+    --untag             <tag> <id>[,<id>...]          Remove tag from entries\n\
+    --compile-snapshot  <path>                        Write a read only snapshot\n\
+						      of all the entries to <path>\n\
+    --snapshot-get      <path> <query>                Show entries of a snapshot\n\
+						      by id:<id>, title:<title> or\n\
+						      host:<host>\n\
+    --inbox                                           Let --add and --batch add\n\
+						      entries with --db while the\n\
+						      database is closed\n\
 -S, --show-status                                     Show database statuses\n\
 -b, --backup            <source> <destination>        Backup database\n\
 -B, --import-backup     <source> <destination>        Import database backup\n\
 -V, --version                                         Show program version\n\
--p, --show-passphrase   <id>                          Show an entry passphrase\n\
--u, --show-username     <id>                          Show an entry username\n\
--U, --show-url          <id>                          Show an entry url\n\
--n, --show-notes        <id>                          Show an entry notes\n\
+-p, --show-passphrase   <id>[,<id>...]                Show entry passphrases\n\
+-u, --show-username     <id>[,<id>...]                Show entry usernames\n\
+-U, --show-url          <id>[,<id>...]                Show entry urls\n\
+-n, --show-notes        <id>[,<id>...]                Show entry notes\n\
+    --ids-from          <path>                        Show entries by ids read from\n\
+						      <path>, \"-\" reads stdin\n\
+    --output            <format>                      Output format of list, show\n\
+						      and find. <format> can be\n\
+						      \"text\", \"json\", \"ndjson\"\n\
+						      or \"tsv\".\n\
+    --format            <format>                      Print list, show and find\n\
+						      output using <format>, e.g.\n\
+						      \"{id}\\t{user}\\t{url}\"\n\
+    --batch                                           Run add, replace, delete and\n\
+						      show commands read from stdin,\n\
+						      one per line, in a single\n\
+						      transaction\n\
+    --passphrase-fd     <fd>                          Read passphrases from <fd>\n\
+						      instead of the terminal\n\
+    --delete-where      <cond> [<cond>...]            Delete all entries matching\n\
+						      every condition. <cond> is\n\
+						      <field>=<text>, <field>~<text>\n\
+						      (contains), id=<first>-<last>\n\
+						      or modified<<time>\n\
+    --update-where      <cond> [<cond>...]            Replace fields given with\n\
+						      --set of all matching entries\n\
+    --set               <field>=<value>               Field to replace with\n\
+						      --update-where, can be repeated\n\
+    --db                <path>                        Use the paged database <path>\n\
+						      without opening it\n\
+    --db-profile        <profile>                     Database connection profile,\n\
+						      \"safe\", \"normal\" or \"fast\".\n\
+						      Default is $STEEL_DB_PROFILE\n\
+						      or \"normal\".\n\
 -h, --help                                            Show short help and exit.\n\
 \n\
 For more information and examples see man steel(1).\n\
@@ -82,47 +271,221 @@ http://www.gnu.org/licenses\n\
 	printf(HELP);
 }
 
+//Is the next argument a list of ids instead of an option.
+static bool has_ids(int argc, char *argv[])
+{
+	return optind < argc && argv[optind][0] != '-';
+}
+
+//Options which change how the commands work, like --output, are
+//handled here before running any of the commands. That way they can
+//be given in any order on the command line.
+//Returns false if an option has an invalid value.
+static bool parse_modifiers(int argc, char *argv[])
+{
+	int option;
+	bool has_output = false;
+	char *profile = getenv("STEEL_DB_PROFILE");
+
+	//Leading '-' keeps getopt from permuting argv, commands read
+	//their extra arguments straight from argv. Errors are reported
+	//when the commands are parsed.
+	opterr = 0;
+
+	while(true) {
+
+		option = getopt_long(argc, argv, "-" SHORT_OPTIONS,
+				     long_options, NULL);
+
+		if(option == -1)
+			break;
+
+		switch(option) {
+		case OPT_OUTPUT:
+			if(!output_set_mode(optarg)) {
+				fprintf(stderr, "Unknown output format %s. Use text, " \
+					"json, ndjson or tsv.\n", optarg);
+				return false;
+			}
+
+			has_output = true;
+			break;
+		case OPT_PASSPHRASE_FD: {
+			char *end = NULL;
+			long fd = strtol(optarg, &end, 10);
+
+			if(end == optarg || *end != '\0' || fd < 0 || fd > INT_MAX) {
+				fprintf(stderr, "Invalid file descriptor %s.\n", optarg);
+				return false;
+			}
+
+			if(!set_passphrase_fd((int)fd))
+				return false;
+
+			break;
+		}
+		case OPT_DB_PROFILE:
+			profile = optarg;
+			break;
+		case OPT_DB:
+			if(!db_set_path(optarg))
+				return false;
+			break;
+		case OPT_SORT:
+			sort = optarg;
+			break;
+		case OPT_PAGED:
+			paged = true;
+			break;
+		case OPT_LOG:
+			log_db = true;
+			break;
+		case OPT_LIMIT:
+		case OPT_AFTER: {
+			char *end = NULL;
+			long value = strtol(optarg, &end, 10);
+
+			if(end == optarg || *end != '\0' || value < 0
+				|| value > INT_MAX) {
+				fprintf(stderr, "Invalid number %s.\n", optarg);
+				return false;
+			}
+
+			if(option == OPT_LIMIT)
+				limit = (int)value;
+			else
+				after = (int)value;
+
+			break;
+		}
+		case OPT_TAG:
+			//With ids it's a command, see main()
+			if(!has_ids(argc, argv))
+				tag_filter = optarg;
+			break;
+		case OPT_SET: {
+			char **tmp = realloc(assignments,
+				(assignment_count + 1) * sizeof(char *));
+
+			if(tmp == NULL) {
+				fprintf(stderr, "Malloc failed.\n");
+				return false;
+			}
+
+			assignments = tmp;
+			assignments[assignment_count++] = optarg;
+			break;
+		}
+		case OPT_FORMAT:
+			format_free(format);
+			format = format_compile(optarg);
+
+			if(format == NULL)
+				return false;
+
+			break;
+		}
+	}
+
+	if(has_output && format != NULL) {
+		fprintf(stderr, "Use either --output or --format, not both.\n");
+		return false;
+	}
+
+	if(format != NULL)
+		output_set_format(format);
+
+	if(tag_filter != NULL && (sort != NULL || limit >= 0 || after >= 0)) {
+		fprintf(stderr, "--sort, --limit and --after can't be used " \
+			"with --tag.\n");
+		return false;
+	}
+
+	if(profile != NULL && !db_set_profile(profile)) {
+		fprintf(stderr, "Unknown database profile %s. Use safe, normal " \
+			"or fast.\n", profile);
+		return false;
+	}
+
+	//Zero forces getopt to start over for the commands.
+	opterr = 1;
+	optind = 0;
+
+	return true;
+}
+
+//Count the arguments following a command, up to the next option.
+static int count_arguments(int argc, char *argv[], int first)
+{
+	int count = 0;
+
+	while(first + count < argc && argv[first + count][0] != '-')
+		count++;
+
+	return count;
+}
+
+//Run --delete-where or --update-where. The first predicate is the
+//argument of the option, the rest follow it.
+static bool run_where(int option, char *first, char **rest, int count)
+{
+	char *predicates[count + 1];
+
+	predicates[0] = first;
+
+	for(int i = 0; i < count; i++)
+		predicates[i + 1] = rest[i];
+
+	if(option == OPT_DELETE_WHERE)
+		return delete_where(predicates, count + 1);
+
+	return update_where(predicates, count + 1, assignments,
+		assignment_count);
+}
+
+//Run show command selected by option for all the ids.
+//All the entries are read from the database at once.
+static void show_ids(int option, const int *ids, int count)
+{
+	switch(option) {
+	case 's':
+	case OPT_IDS_FROM:
+		show_entries(ids, count);
+		break;
+	case 'p':
+		show_passphrase_only(ids, count);
+		break;
+	case 'u':
+		show_username_only(ids, count);
+		break;
+	case 'U':
+		show_url_only(ids, count);
+		break;
+	case 'n':
+		show_notes_only(ids, count);
+		break;
+	}
+}
+
 //Program entry point.
 int main(int argc, char *argv[])
 {
 	int option;
+	int status = 0;
 
 	if(argc == 1) {
 		usage();
 		return 0;
 	}
 
-	while(true) {
+	if(!parse_modifiers(argc, argv))
+		return 1;
 
-		static struct option long_options[] =
-		{
-			{"init-new",               required_argument, 0, 'i'},
-			{"backup",                 required_argument, 0, 'b'},
-			{"import-backup",          required_argument, 0, 'B'},
-			{"open",                   required_argument, 0, 'o'},
-			{"close",                  no_argument,       0, 'c'},
-			{"show",                   required_argument, 0, 's'},
-			{"gen-pass",               required_argument, 0, 'g'},
-			{"add",                    required_argument, 0, 'a'},
-			{"delete",                 required_argument, 0, 'd'},
-			{"replace",                required_argument, 0, 'r'},
-			{"shred-db",               required_argument, 0, 'R'},
-			{"find",                   required_argument, 0, 'f'},
-			{"list-all",               no_argument,       0, 'l'},
-			{"show-status",            no_argument,       0, 'S'},
-			{"version",                no_argument,       0, 'V'},
-			{"help",                   no_argument,       0, 'h'},
-			{"show-passphrase",        required_argument, 0, 'p'},
-			{"show-username",          required_argument, 0, 'u'},
-			{"show-url",               required_argument, 0, 'U'},
-			{"show-notes",             required_argument, 0, 'n'},
-			{0, 0, 0, 0}
-
-		};
+	while(true) {
 
 		int option_index = 0;
 
-		option = getopt_long(argc, argv, "i:b:B:o:cs:g:a:d:r:f:lR:SVp:u:U:n:h",
+		option = getopt_long(argc, argv, SHORT_OPTIONS,
 				     long_options, &option_index);
 
 		if(option == -1)
@@ -130,7 +493,7 @@ int main(int argc, char *argv[])
 
 		switch(option) {
 		case 'i':
-			init_database(optarg);
+			init_database(optarg, paged, log_db);
 			break;
 		case 'b':
 			if(!argv[optind]) {
@@ -150,11 +513,29 @@ int main(int argc, char *argv[])
 			open_database(optarg);
 			break;
 		case 'c':
-			close_database();
+			close_database(paged);
 			break;
 		case 's':
-			show_one_entry(atoi(optarg));
+		case 'p':
+		case 'u':
+		case 'U':
+		case 'n':
+		case OPT_IDS_FROM: {
+			int count;
+			int *ids;
+
+			if(option == OPT_IDS_FROM)
+				ids = read_id_list(optarg, &count);
+			else
+				ids = parse_id_list(optarg, &count);
+
+			if(ids == NULL)
+				return 0;
+
+			show_ids(option, ids, count);
+			free(ids);
 			break;
+		}
 		case 'g': {
 			int count = 1;
 
@@ -190,7 +571,8 @@ int main(int argc, char *argv[])
 			char *url = argv[optind + 1];
 			char *note = argv[optind + 2];
 
-			add_new_entry(title, user, url, note);
+			if(!add_new_entry(title, user, url, note))
+				status = 1;
 
 			break;
 		}
@@ -203,6 +585,17 @@ int main(int argc, char *argv[])
 				return 0;
 			}
 
+			//Several fields at once: -r <id> user=john url=example.com
+			if(strchr(argv[optind], '=') != NULL
+				|| (strcmp(argv[optind], "passphrase") == 0
+				&& argv[optind + 1] != NULL
+				&& strchr(argv[optind + 1], '=') != NULL)) {
+				int count = count_arguments(argc, argv, optind);
+
+				replace_parts(atoi(optarg), &argv[optind], count);
+				break;
+			}
+
 			//Replacing passphrase does not need third argument
 			//It will be asked separately by replace_part()
 			if(strcmp(argv[optind], "passphrase") != 0) {
@@ -221,21 +614,58 @@ int main(int argc, char *argv[])
 		case 'f':
 			find_entries(optarg);
 			break;
-		case 'p':
-			show_passphrase_only(atoi(optarg));
+		case OPT_FOR_HOST:
+			show_entries_for_host(optarg);
 			break;
-		case 'u':
-			show_username_only(atoi(optarg));
+		case 'l':
+			if(sort != NULL || limit >= 0 || after >= 0)
+				show_entries_page(sort, after, limit);
+			else
+				show_all_entries(tag_filter);
 			break;
-		case 'U':
-			show_url_only(atoi(optarg));
+		case OPT_CHANGED_SINCE:
+			show_changed_since(optarg);
 			break;
-		case 'n':
-			show_notes_only(atoi(optarg));
+		case OPT_DELETED_SINCE:
+			show_deleted_since(optarg);
 			break;
-		case 'l':
-			show_all_entries();
+		case OPT_HISTORY:
+			show_history(atoi(optarg));
+			break;
+		case OPT_HISTORY_LIMIT:
+			set_history_limit(atoi(optarg));
+			break;
+		case OPT_SEAL:
+			if(!seal_fields(optarg))
+				status = 1;
+			break;
+		case OPT_TAG:
+		case OPT_UNTAG: {
+			int count;
+			int *ids;
+
+			//Plain --tag <tag> is a filter for --list-all
+			if(option == OPT_TAG && !has_ids(argc, argv))
+				break;
+
+			if(!has_ids(argc, argv)) {
+				fprintf(stderr, "Missing option <id>[,<id>...].\n");
+				return 0;
+			}
+
+			ids = parse_id_list(argv[optind], &count);
+
+			if(ids == NULL)
+				return 0;
+
+			if(option == OPT_TAG)
+				tag_entries(optarg, ids, count);
+			else
+				untag_entries(optarg, ids, count);
+
+			free(ids);
 			break;
+		}
 		case 'R':
 			remove_database(optarg);
 			break;
@@ -248,9 +678,60 @@ int main(int argc, char *argv[])
 		case 'h':
 			usage();
 			break;
+		case OPT_DELETE_WHERE:
+		case OPT_UPDATE_WHERE:
+			if(!run_where(option, optarg, &argv[optind],
+				count_arguments(argc, argv, optind)))
+				status = 1;
+			break;
+		case OPT_BATCH:
+			if(!run_batch())
+				status = 1;
+			break;
+		case OPT_COMPILE_SNAPSHOT:
+			if(!compile_snapshot(optarg))
+				status = 1;
+			break;
+		case OPT_INBOX:
+			if(!create_inbox())
+				status = 1;
+			break;
+		case OPT_REKEY:
+			if(!change_passphrase(optarg))
+				status = 1;
+			break;
+		case OPT_REKEY_ALL:
+			if(!change_passphrase(NULL))
+				status = 1;
+			break;
+		case OPT_SNAPSHOT_GET:
+			if(!argv[optind]) {
+				fprintf(stderr, "Missing option <query>.\n");
+				return 0;
+			}
+
+			if(!show_snapshot_entries(optarg, argv[optind]))
+				status = 1;
+			break;
+		case OPT_OUTPUT:
+		case OPT_FORMAT:
+		case OPT_PASSPHRASE_FD:
+		case OPT_SET:
+		case OPT_DB_PROFILE:
+		case OPT_SORT:
+		case OPT_LIMIT:
+		case OPT_AFTER:
+		case OPT_PAGED:
+		case OPT_LOG:
+		case OPT_DB:
+			//Already handled by parse_modifiers()
+			break;
 		}
 
 	}
 
-	return 0;
+	format_free(format);
+	free(assignments);
+
+	return status;
 }
@@ -0,0 +1,1400 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+//SQLite VFS of paged databases. Instead of decrypting the whole
+//database on open and encrypting it again on close, the database and
+//its journals are encrypted in blocks as SQLite reads and writes them.
+//The real files are handled by the default VFS.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "crypto.h"
+#include "vfs.h"
+
+//Files are stored in blocks of VFS_BLOCK_SIZE bytes, the same as the
+//page size of the database. On disk a block is a random IV, length of
+//the data in the block, the encrypted data padded to VFS_BLOCK_SIZE,
+//HMAC of all of them and the node of the block in the hash tree of the
+//database. Blocks of the database start after the header and state of
+//the paged file, blocks of journals at the beginning.
+#define VFS_BLOCK_SIZE (4096)
+#define VFS_LENGTH_SIZE (4)
+#define VFS_STORED_SIZE (IV_SIZE + VFS_LENGTH_SIZE + VFS_BLOCK_SIZE + \
+	HMAC_SIZE + HMAC_SIZE)
+
+//Number of the block and kind of the file are authenticated with the
+//block but not stored, so that blocks can't be moved around or from
+//a journal into the database.
+#define VFS_PREFIX_SIZE (9)
+
+//Offsets in Vfs_file_t block buffer
+#define VFS_IV_OFFSET (VFS_PREFIX_SIZE)
+#define VFS_LENGTH_OFFSET (VFS_IV_OFFSET + IV_SIZE)
+#define VFS_DATA_OFFSET (VFS_LENGTH_OFFSET + VFS_LENGTH_SIZE)
+#define VFS_MAC_OFFSET (VFS_DATA_OFFSET + VFS_BLOCK_SIZE)
+#define VFS_NODE_OFFSET (VFS_MAC_OFFSET + HMAC_SIZE)
+
+//Blocks of the database form a binary hash tree. Children of block i
+//are blocks 2i + 1 and 2i + 2, and the node of a block is HMAC of its
+//HMAC and the nodes of its children, zeros for children past the last
+//block. The root is the node of the first block. Reading a block
+//verifies the path from it up to the root and writing one updates the
+//path, so a block replaced with an older copy is found by reading two
+//stored values per level of the tree.
+//
+//State of the database follows the header of the paged file: a
+//generation counted up whenever the state is written, number of
+//blocks, whether the file is clean, the root and HMAC of these with the
+//header. The state is read when SQLite takes a shared lock on the
+//database, so no other connection writes it meanwhile, and written
+//only by a connection that wrote blocks, before it unlocks. File is
+//marked unclean, and the mark synced, before the first block is
+//written, and marked clean once the blocks are synced. A crash while
+//writing leaves it unclean. Blocks are then verified only one by one
+//until the database is next written, which rebuilds the tree.
+#define VFS_STATE_GENERATION (0)
+#define VFS_STATE_BLOCKS (8)
+#define VFS_STATE_CLEAN (16)
+#define VFS_STATE_ROOT (17)
+#define VFS_STATE_MAC (VFS_STATE_ROOT + HMAC_SIZE)
+#define VFS_STATE_SIZE (VFS_STATE_MAC + HMAC_SIZE)
+
+#ifndef SQLITE_IOERR_DATA
+#define SQLITE_IOERR_DATA (SQLITE_IOERR | (32 << 8))
+#endif
+
+typedef struct Vfs_file
+{
+	sqlite3_file base;
+	sqlite3_file *real; //File of the default VFS, follows this struct
+	sqlite3_int64 start; //Offset of the first block
+	unsigned char kind;
+	int lock; //Lock held on the real file
+
+	//State of the database read with the last shared lock, kept up to
+	//date by the writes through this file
+	sqlite3_uint64 generation;
+	sqlite3_int64 blocks;
+	unsigned char root[HMAC_SIZE];
+	bool trusted; //Tree matches the blocks, reads are verified with it
+	bool written; //Blocks were written and the state is unclean
+	bool warned;
+
+	unsigned char block[VFS_PREFIX_SIZE + VFS_STORED_SIZE];
+
+} Vfs_file_t;
+
+//Key of the unlocked database and its header. Only the database
+//with this header can be opened.
+static Key_t vfs_key;
+static char vfs_header[PAGED_HEADER_SIZE];
+static bool vfs_keyed = false;
+
+#define REAL_VFS(vfs) ((sqlite3_vfs *)(vfs)->pAppData)
+#define REAL_FILE(file) (((Vfs_file_t *)(file))->real)
+
+static void vfs_put_length(unsigned char *p, unsigned int length)
+{
+	for(int i = 0; i < VFS_LENGTH_SIZE; i++)
+		p[i] = (length >> (8 * (VFS_LENGTH_SIZE - 1 - i))) & 0xff;
+}
+
+static unsigned int vfs_get_length(const unsigned char *p)
+{
+	unsigned int length = 0;
+
+	for(int i = 0; i < VFS_LENGTH_SIZE; i++)
+		length = (length << 8) | p[i];
+
+	return length;
+}
+
+static void vfs_put_int64(unsigned char *p, sqlite3_uint64 value)
+{
+	for(int i = 0; i < 8; i++)
+		p[i] = (value >> (8 * (7 - i))) & 0xff;
+}
+
+static sqlite3_uint64 vfs_get_int64(const unsigned char *p)
+{
+	sqlite3_uint64 value = 0;
+
+	for(int i = 0; i < 8; i++)
+		value = (value << 8) | p[i];
+
+	return value;
+}
+
+//Offset of block index in the real file
+static sqlite3_int64 vfs_block_offset(Vfs_file_t *f, sqlite3_int64 index)
+{
+	return f->start + index * VFS_STORED_SIZE;
+}
+
+//Compute HMAC of block index of kind, in a buffer laid out like the
+//one of Vfs_file_t, with key and compare it to the stored one, or store
+//it if store is true. Returns false on failure or if the HMAC does not
+//match.
+static bool vfs_block_hmac(unsigned char *block, unsigned char kind,
+	sqlite3_int64 index, Key_t key, bool store)
+{
+	unsigned char *mac;
+	bool match = true;
+
+	vfs_put_int64(block, index);
+	block[8] = kind;
+
+	mac = get_data_hmac((char *)block, VFS_MAC_OFFSET, key);
+
+	if(mac == NULL)
+		return false;
+
+	if(store)
+		memcpy(block + VFS_MAC_OFFSET, mac, HMAC_SIZE);
+	else
+		match = verify_hmac(block + VFS_MAC_OFFSET, mac);
+
+	free(mac);
+
+	return match;
+}
+
+//Compute HMAC of state, laid out as on disk, of the database with
+//header and compare it to the one in state, or store it if store is
+//true. Returns false on failure or if it does not match.
+static bool vfs_state_hmac(const char *header, unsigned char *state,
+	Key_t key, bool store)
+{
+	char data[PAGED_HEADER_SIZE + VFS_STATE_MAC];
+	unsigned char *mac;
+	bool match = true;
+
+	memcpy(data, header, PAGED_HEADER_SIZE);
+	memcpy(data + PAGED_HEADER_SIZE, state, VFS_STATE_MAC);
+
+	mac = get_data_hmac(data, sizeof(data), key);
+
+	if(mac == NULL)
+		return false;
+
+	if(store)
+		memcpy(state + VFS_STATE_MAC, mac, HMAC_SIZE);
+	else
+		match = verify_hmac(state + VFS_STATE_MAC, mac);
+
+	free(mac);
+
+	return match;
+}
+
+//Compute the node of a block with HMAC mac and children with nodes
+//left and right to node, which may be one of them. Returns false on
+//failure.
+static bool vfs_node_hmac(const unsigned char *mac, const unsigned char *left,
+	const unsigned char *right, Key_t key, unsigned char *node)
+{
+	char data[3 * HMAC_SIZE];
+	unsigned char *result;
+
+	memcpy(data, mac, HMAC_SIZE);
+	memcpy(data + HMAC_SIZE, left, HMAC_SIZE);
+	memcpy(data + 2 * HMAC_SIZE, right, HMAC_SIZE);
+
+	result = get_data_hmac(data, sizeof(data), key);
+
+	if(result == NULL)
+		return false;
+
+	memcpy(node, result, HMAC_SIZE);
+	free(result);
+
+	return true;
+}
+
+//Replace the HMACs of count blocks in macs with their nodes, bottom up,
+//and store the root to root. Returns false on failure.
+static bool vfs_tree_root(unsigned char *macs, sqlite3_int64 count,
+	Key_t key, unsigned char *root)
+{
+	static const unsigned char none[HMAC_SIZE];
+	const unsigned char *left;
+	const unsigned char *right;
+
+	for(sqlite3_int64 i = count - 1; i >= 0; i--) {
+
+		left = (2 * i + 1 < count) ? macs + (2 * i + 1) * HMAC_SIZE : none;
+		right = (2 * i + 2 < count) ? macs + (2 * i + 2) * HMAC_SIZE : none;
+
+		if(!vfs_node_hmac(macs + i * HMAC_SIZE, left, right, key,
+			macs + i * HMAC_SIZE))
+			return false;
+	}
+
+	memcpy(root, count > 0 ? macs : none, HMAC_SIZE);
+
+	return true;
+}
+
+//Number of whole blocks in the real file of f
+static int vfs_block_count(Vfs_file_t *f, sqlite3_int64 *blocks)
+{
+	sqlite3_int64 real_size;
+	int rc;
+
+	rc = f->real->pMethods->xFileSize(f->real, &real_size);
+
+	if(rc != SQLITE_OK)
+		return rc;
+
+	//Partially written block at the end does not count
+	*blocks = 0;
+
+	if(real_size > f->start)
+		*blocks = (real_size - f->start) / VFS_STORED_SIZE;
+
+	return SQLITE_OK;
+}
+
+//Read the stored HMAC or node, as given by offset, of block index of f
+//to out. Node of a block past the last one is zeros. Returns SQLite
+//result code.
+static int vfs_read_field(Vfs_file_t *f, sqlite3_int64 index, int offset,
+	unsigned char *out)
+{
+	if(index >= f->blocks) {
+		memset(out, 0, HMAC_SIZE);
+		return SQLITE_OK;
+	}
+
+	return f->real->pMethods->xRead(f->real, out, HMAC_SIZE,
+		vfs_block_offset(f, index) + offset - VFS_PREFIX_SIZE);
+}
+
+//Compute the node of block index of f with HMAC mac from the stored
+//nodes of its children. Returns SQLite result code.
+static int vfs_compute_node(Vfs_file_t *f, sqlite3_int64 index,
+	const unsigned char *mac, unsigned char *node)
+{
+	unsigned char left[HMAC_SIZE];
+	unsigned char right[HMAC_SIZE];
+	int rc;
+
+	rc = vfs_read_field(f, 2 * index + 1, VFS_NODE_OFFSET, left);
+
+	if(rc == SQLITE_OK)
+		rc = vfs_read_field(f, 2 * index + 2, VFS_NODE_OFFSET, right);
+
+	if(rc == SQLITE_OK && !vfs_node_hmac(mac, left, right, vfs_key, node))
+		rc = SQLITE_IOERR;
+
+	return rc;
+}
+
+//Verify HMAC mac of block index of f against the root, with the stored
+//HMACs and nodes on the path between them. Returns SQLite result code,
+//SQLITE_IOERR_DATA if they don't match.
+static int vfs_verify_path(Vfs_file_t *f, sqlite3_int64 index,
+	const unsigned char *mac)
+{
+	unsigned char node[HMAC_SIZE];
+	unsigned char parent_mac[HMAC_SIZE];
+	unsigned char sibling[HMAC_SIZE];
+	sqlite3_int64 parent;
+	bool left;
+	int rc;
+
+	if(index >= f->blocks)
+		return SQLITE_IOERR_DATA;
+
+	rc = vfs_compute_node(f, index, mac, node);
+
+	while(rc == SQLITE_OK && index > 0) {
+
+		parent = (index - 1) / 2;
+		left = (index % 2 == 1);
+
+		rc = vfs_read_field(f, parent, VFS_MAC_OFFSET, parent_mac);
+
+		if(rc == SQLITE_OK)
+			rc = vfs_read_field(f, left ? index + 1 : index - 1,
+				VFS_NODE_OFFSET, sibling);
+
+		if(rc == SQLITE_OK && !vfs_node_hmac(parent_mac, left ? node : sibling,
+			left ? sibling : node, vfs_key, node))
+			rc = SQLITE_IOERR;
+
+		index = parent;
+	}
+
+	if(rc == SQLITE_IOERR_SHORT_READ ||
+		(rc == SQLITE_OK && !verify_hmac(f->root, node)))
+		rc = SQLITE_IOERR_DATA;
+
+	return rc;
+}
+
+//Update the nodes of block index of f and of the blocks above it, up to
+//the root, after the block or its children changed. Returns SQLite
+//result code.
+static int vfs_update_path(Vfs_file_t *f, sqlite3_int64 index)
+{
+	unsigned char mac[HMAC_SIZE];
+	unsigned char node[HMAC_SIZE];
+	int rc;
+
+	while(true) {
+
+		rc = vfs_read_field(f, index, VFS_MAC_OFFSET, mac);
+
+		if(rc == SQLITE_OK)
+			rc = vfs_compute_node(f, index, mac, node);
+
+		if(rc == SQLITE_OK)
+			rc = f->real->pMethods->xWrite(f->real, node, HMAC_SIZE,
+				vfs_block_offset(f, index) + VFS_NODE_OFFSET - VFS_PREFIX_SIZE);
+
+		if(rc != SQLITE_OK)
+			return rc;
+
+		if(index == 0)
+			break;
+
+		index = (index - 1) / 2;
+	}
+
+	memcpy(f->root, node, HMAC_SIZE);
+
+	return SQLITE_OK;
+}
+
+//Compute the nodes of all the blocks of f again, bottom up, when the
+//tree can't be trusted. Returns SQLite result code.
+static int vfs_rebuild_tree(Vfs_file_t *f)
+{
+	unsigned char mac[HMAC_SIZE];
+	unsigned char node[HMAC_SIZE];
+	int rc;
+
+	memset(f->root, 0, HMAC_SIZE);
+
+	for(sqlite3_int64 i = f->blocks - 1; i >= 0; i--) {
+
+		rc = vfs_read_field(f, i, VFS_MAC_OFFSET, mac);
+
+		if(rc == SQLITE_OK)
+			rc = vfs_compute_node(f, i, mac, node);
+
+		if(rc == SQLITE_OK)
+			rc = f->real->pMethods->xWrite(f->real, node, HMAC_SIZE,
+				vfs_block_offset(f, i) + VFS_NODE_OFFSET - VFS_PREFIX_SIZE);
+
+		if(rc != SQLITE_OK)
+			return rc;
+	}
+
+	if(f->blocks > 0)
+		memcpy(f->root, node, HMAC_SIZE);
+
+	return SQLITE_OK;
+}
+
+//Read the state of the database f when a shared lock is taken. Clean
+//state must match the number of blocks, then the tree is trusted.
+//Returns SQLite result code.
+static int vfs_read_state(Vfs_file_t *f)
+{
+	unsigned char state[VFS_STATE_SIZE];
+	sqlite3_int64 blocks;
+	int rc;
+
+	rc = f->real->pMethods->xRead(f->real, state, VFS_STATE_SIZE,
+		PAGED_HEADER_SIZE);
+
+	if(rc == SQLITE_OK)
+		rc = vfs_block_count(f, &blocks);
+
+	if(rc == SQLITE_OK && !vfs_state_hmac(vfs_header, state, vfs_key, false))
+		rc = SQLITE_IOERR_DATA;
+
+	if(rc == SQLITE_OK && state[VFS_STATE_CLEAN] &&
+		vfs_get_int64(state + VFS_STATE_BLOCKS) != (sqlite3_uint64)blocks)
+		rc = SQLITE_IOERR_DATA;
+
+	if(rc == SQLITE_IOERR_SHORT_READ || rc == SQLITE_IOERR_DATA) {
+		fprintf(stderr, "Data was tampered or corrupted.\n");
+		return SQLITE_IOERR_DATA;
+	}
+
+	if(rc != SQLITE_OK)
+		return rc;
+
+	f->generation = vfs_get_int64(state + VFS_STATE_GENERATION);
+	f->blocks = blocks;
+	memcpy(f->root, state + VFS_STATE_ROOT, HMAC_SIZE);
+	f->trusted = state[VFS_STATE_CLEAN];
+
+	if(!f->trusted && !f->warned) {
+		fprintf(stderr, "Warning: database was not synced after it was " \
+			"last written, it can't be verified.\n");
+		f->warned = true;
+	}
+
+	return SQLITE_OK;
+}
+
+//Write the state of the database f with the next generation, clean if
+//clean is true. Returns SQLite result code.
+static int vfs_write_state(Vfs_file_t *f, bool clean)
+{
+	unsigned char state[VFS_STATE_SIZE];
+
+	f->generation++;
+
+	vfs_put_int64(state + VFS_STATE_GENERATION, f->generation);
+	vfs_put_int64(state + VFS_STATE_BLOCKS, f->blocks);
+	state[VFS_STATE_CLEAN] = clean;
+	memcpy(state + VFS_STATE_ROOT, f->root, HMAC_SIZE);
+
+	if(!vfs_state_hmac(vfs_header, state, vfs_key, true))
+		return SQLITE_IOERR_WRITE;
+
+	return f->real->pMethods->xWrite(f->real, state, VFS_STATE_SIZE,
+		PAGED_HEADER_SIZE);
+}
+
+//Mark the database f unclean before the first of its blocks is written
+//after it was clean. SQLite writes the database only under an exclusive
+//lock. The mark is synced, so that it's on disk before any of the
+//blocks. Returns SQLite result code.
+static int vfs_mark_dirty(Vfs_file_t *f)
+{
+	int rc;
+
+	if(f->kind != 1 || f->written)
+		return SQLITE_OK;
+
+	rc = vfs_write_state(f, false);
+
+	if(rc == SQLITE_OK)
+		rc = f->real->pMethods->xSync(f->real, SQLITE_SYNC_NORMAL);
+
+	if(rc == SQLITE_OK)
+		f->written = true;
+
+	return rc;
+}
+
+//Mark the database f clean after blocks were written through f, with
+//the tree rebuilt if it was not trusted. If sync is true the blocks are
+//synced first, so that the clean state never covers blocks which are
+//not on disk. On failure the state is left unclean. Returns SQLite
+//result code.
+static int vfs_mark_clean(Vfs_file_t *f, bool sync)
+{
+	int rc = SQLITE_OK;
+
+	if(!f->written)
+		return SQLITE_OK;
+
+	if(sync)
+		rc = f->real->pMethods->xSync(f->real, SQLITE_SYNC_NORMAL);
+
+	if(rc == SQLITE_OK && !f->trusted) {
+		rc = vfs_block_count(f, &f->blocks);
+
+		if(rc == SQLITE_OK)
+			rc = vfs_rebuild_tree(f);
+	}
+
+	if(rc == SQLITE_OK)
+		rc = vfs_write_state(f, true);
+
+	f->written = false;
+	f->trusted = (rc == SQLITE_OK);
+
+	return rc;
+}
+
+//Read block index to the buffer of f, verify it and decrypt it. Length
+//of the data is set to length, block past the end of file has no data.
+//Returns SQLite result code.
+static int vfs_load_block(Vfs_file_t *f, sqlite3_int64 index, int *length)
+{
+	int rc;
+
+	rc = f->real->pMethods->xRead(f->real, f->block + VFS_PREFIX_SIZE,
+		VFS_STORED_SIZE, vfs_block_offset(f, index));
+
+	if(rc == SQLITE_IOERR_SHORT_READ) {
+		*length = 0;
+		return SQLITE_OK;
+	}
+
+	if(rc != SQLITE_OK)
+		return rc;
+
+	*length = vfs_get_length(f->block + VFS_LENGTH_OFFSET);
+
+	if(*length > VFS_BLOCK_SIZE || !vfs_block_hmac(f->block, f->kind, index, vfs_key, false)) {
+		fprintf(stderr, "Data was tampered or corrupted.\n");
+		return SQLITE_IOERR_DATA;
+	}
+
+	//Tree is only known while the database is locked
+	if(f->kind == 1 && f->trusted && f->lock >= SQLITE_LOCK_SHARED) {
+		rc = vfs_verify_path(f, index, f->block + VFS_MAC_OFFSET);
+
+		if(rc == SQLITE_IOERR_DATA)
+			fprintf(stderr, "Data was tampered or corrupted.\n");
+
+		if(rc != SQLITE_OK)
+			return rc;
+	}
+
+	if(!crypt_data((char *)f->block + VFS_DATA_OFFSET, *length,
+		(char *)f->block + VFS_IV_OFFSET, vfs_key, true))
+		return SQLITE_IOERR_READ;
+
+	return SQLITE_OK;
+}
+
+//Encrypt length bytes of data in the buffer of f with a new IV and
+//write it as block index. Blocks of the database are written in order,
+//index is at most the number of blocks. Returns SQLite result code.
+static int vfs_store_block(Vfs_file_t *f, sqlite3_int64 index, int length)
+{
+	char *data = (char *)f->block + VFS_DATA_OFFSET;
+	char *iv = (char *)f->block + VFS_IV_OFFSET;
+	int rc;
+
+	memset(data + length, 0, VFS_BLOCK_SIZE - length);
+	memset(f->block + VFS_NODE_OFFSET, 0, HMAC_SIZE);
+	vfs_put_length(f->block + VFS_LENGTH_OFFSET, length);
+
+	if(!fill_random(iv, IV_SIZE) ||
+		!crypt_data(data, length, iv, vfs_key, false) ||
+		!vfs_block_hmac(f->block, f->kind, index, vfs_key, true))
+		return SQLITE_IOERR_WRITE;
+
+	rc = f->real->pMethods->xWrite(f->real, f->block + VFS_PREFIX_SIZE,
+		VFS_STORED_SIZE, vfs_block_offset(f, index));
+
+	if(rc != SQLITE_OK || f->kind != 1)
+		return rc;
+
+	if(index >= f->blocks)
+		f->blocks = index + 1;
+
+	//Untrusted tree is rebuilt when the database is marked clean
+	if(f->trusted)
+		rc = vfs_update_path(f, index);
+
+	return rc;
+}
+
+//Size of the data in f. Only the length of the last block is read,
+//it's verified when the block itself is read.
+static int vfs_size(Vfs_file_t *f, sqlite3_int64 *size)
+{
+	sqlite3_int64 blocks;
+	unsigned char length[VFS_LENGTH_SIZE];
+	int rc;
+
+	rc = vfs_block_count(f, &blocks);
+
+	if(rc != SQLITE_OK)
+		return rc;
+
+	if(blocks == 0) {
+		*size = 0;
+		return SQLITE_OK;
+	}
+
+	rc = f->real->pMethods->xRead(f->real, length, VFS_LENGTH_SIZE,
+		vfs_block_offset(f, blocks - 1) + IV_SIZE);
+
+	if(rc != SQLITE_OK)
+		return rc;
+
+	*size = (blocks - 1) * VFS_BLOCK_SIZE;
+	*size += vfs_get_length(length) > VFS_BLOCK_SIZE ?
+		VFS_BLOCK_SIZE : vfs_get_length(length);
+
+	return SQLITE_OK;
+}
+
+//Write amount bytes from data to offset of f, or zeros if data is
+//NULL. Blocks written only partially are read and decrypted first.
+static int vfs_write_data(Vfs_file_t *f, const char *data, sqlite3_int64 amount,
+	sqlite3_int64 offset)
+{
+	char *block = (char *)f->block + VFS_DATA_OFFSET;
+	sqlite3_int64 index;
+	int start;
+	int count;
+	int length;
+	int rc;
+
+	while(amount > 0) {
+
+		index = offset / VFS_BLOCK_SIZE;
+		start = offset % VFS_BLOCK_SIZE;
+		count = VFS_BLOCK_SIZE - start;
+
+		if(count > amount)
+			count = amount;
+
+		length = 0;
+
+		if(count < VFS_BLOCK_SIZE) {
+			rc = vfs_load_block(f, index, &length);
+
+			if(rc != SQLITE_OK)
+				return rc;
+		}
+
+		if(start > length)
+			memset(block + length, 0, start - length);
+
+		if(data != NULL)
+			memcpy(block + start, data, count);
+		else
+			memset(block + start, 0, count);
+
+		if(length < start + count)
+			length = start + count;
+
+		rc = vfs_store_block(f, index, length);
+
+		if(rc != SQLITE_OK)
+			return rc;
+
+		if(data != NULL)
+			data += count;
+
+		offset += count;
+		amount -= count;
+	}
+
+	return SQLITE_OK;
+}
+
+static int vfs_close(sqlite3_file *file)
+{
+	return REAL_FILE(file)->pMethods->xClose(REAL_FILE(file));
+}
+
+static int vfs_read(sqlite3_file *file, void *buffer, int amount,
+	sqlite3_int64 offset)
+{
+	Vfs_file_t *f = (Vfs_file_t *)file;
+	char *block = (char *)f->block + VFS_DATA_OFFSET;
+	char *out = buffer;
+	int start;
+	int count;
+	int length;
+	int rc;
+
+	while(amount > 0) {
+
+		start = offset % VFS_BLOCK_SIZE;
+		count = VFS_BLOCK_SIZE - start;
+
+		if(count > amount)
+			count = amount;
+
+		rc = vfs_load_block(f, offset / VFS_BLOCK_SIZE, &length);
+
+		if(rc != SQLITE_OK)
+			return rc;
+
+		//End of file, SQLite expects rest of the buffer zeroed
+		if(length < start + count) {
+
+			if(length > start) {
+				memcpy(out, block + start, length - start);
+				out += length - start;
+				amount -= length - start;
+			}
+
+			memset(out, 0, amount);
+
+			return SQLITE_IOERR_SHORT_READ;
+		}
+
+		memcpy(out, block + start, count);
+		out += count;
+		offset += count;
+		amount -= count;
+	}
+
+	return SQLITE_OK;
+}
+
+static int vfs_write(sqlite3_file *file, const void *buffer, int amount,
+	sqlite3_int64 offset)
+{
+	Vfs_file_t *f = (Vfs_file_t *)file;
+	sqlite3_int64 size;
+	int rc;
+
+	rc = vfs_mark_dirty(f);
+
+	if(rc == SQLITE_OK)
+		rc = vfs_size(f, &size);
+
+	if(rc != SQLITE_OK)
+		return rc;
+
+	//Blocks between the end of file and offset are filled with
+	//zeros, they must exist to be authenticated.
+	if(size < offset) {
+		rc = vfs_write_data(f, NULL, offset - size, size);
+
+		if(rc != SQLITE_OK)
+			return rc;
+	}
+
+	return vfs_write_data(f, buffer, amount, offset);
+}
+
+static int vfs_truncate(sqlite3_file *file, sqlite3_int64 size)
+{
+	Vfs_file_t *f = (Vfs_file_t *)file;
+	sqlite3_int64 current;
+	sqlite3_int64 blocks;
+	sqlite3_int64 last;
+	int length;
+	int rc;
+
+	rc = vfs_mark_dirty(f);
+
+	if(rc == SQLITE_OK)
+		rc = vfs_size(f, &current);
+
+	if(rc != SQLITE_OK)
+		return rc;
+
+	if(size >= current)
+		return vfs_write_data(f, NULL, size - current, current);
+
+	blocks = (size + VFS_BLOCK_SIZE - 1) / VFS_BLOCK_SIZE;
+
+	//The last block that's left is shortened
+	if(size % VFS_BLOCK_SIZE != 0) {
+		rc = vfs_load_block(f, blocks - 1, &length);
+
+		if(rc == SQLITE_OK)
+			rc = vfs_store_block(f, blocks - 1, size % VFS_BLOCK_SIZE);
+
+		if(rc != SQLITE_OK)
+			return rc;
+	}
+
+	rc = f->real->pMethods->xTruncate(f->real, vfs_block_offset(f, blocks));
+
+	if(rc != SQLITE_OK || f->kind != 1 || blocks >= f->blocks)
+		return rc;
+
+	//Blocks which lost children are the parents of the cut ones
+	last = (f->blocks - 2) / 2;
+	f->blocks = blocks;
+
+	if(!f->trusted)
+		return SQLITE_OK;
+
+	if(blocks == 0)
+		memset(f->root, 0, HMAC_SIZE);
+
+	for(sqlite3_int64 i = last < blocks - 1 ? last : blocks - 1;
+		rc == SQLITE_OK && i >= (blocks - 1) / 2 && i >= 0; i--)
+		rc = vfs_update_path(f, i);
+
+	return rc;
+}
+
+//Database written through this file is marked clean once its blocks
+//are synced
+static int vfs_sync(sqlite3_file *file, int flags)
+{
+	Vfs_file_t *f = (Vfs_file_t *)file;
+	int rc;
+
+	if(f->kind == 1) {
+		rc = vfs_mark_clean(f, true);
+
+		if(rc != SQLITE_OK)
+			return rc;
+	}
+
+	return f->real->pMethods->xSync(f->real, flags);
+}
+
+static int vfs_file_size(sqlite3_file *file, sqlite3_int64 *size)
+{
+	return vfs_size((Vfs_file_t *)file, size);
+}
+
+//State of the database is read when a shared lock is taken. Others
+//can't write the database until it's released.
+static int vfs_lock(sqlite3_file *file, int lock)
+{
+	Vfs_file_t *f = (Vfs_file_t *)file;
+	int rc;
+
+	rc = f->real->pMethods->xLock(f->real, lock);
+
+	if(rc != SQLITE_OK)
+		return rc;
+
+	if(f->kind == 1 && f->lock == SQLITE_LOCK_NONE) {
+		rc = vfs_read_state(f);
+
+		if(rc != SQLITE_OK) {
+			f->real->pMethods->xUnlock(f->real, SQLITE_LOCK_NONE);
+			return rc;
+		}
+	}
+
+	f->lock = lock;
+
+	return SQLITE_OK;
+}
+
+//Database written without a sync, as with synchronous=off, is marked
+//clean before the lock it was written under is released
+static int vfs_unlock_file(sqlite3_file *file, int lock)
+{
+	Vfs_file_t *f = (Vfs_file_t *)file;
+	int clean_rc = SQLITE_OK;
+	int rc;
+
+	if(f->kind == 1 && lock < SQLITE_LOCK_EXCLUSIVE)
+		clean_rc = vfs_mark_clean(f, false);
+
+	rc = f->real->pMethods->xUnlock(f->real, lock);
+
+	if(rc == SQLITE_OK)
+		f->lock = lock;
+
+	return rc == SQLITE_OK ? clean_rc : rc;
+}
+
+static int vfs_check_reserved_lock(sqlite3_file *file, int *result)
+{
+	return REAL_FILE(file)->pMethods->xCheckReservedLock(REAL_FILE(file),
+		result);
+}
+
+static int vfs_file_control(sqlite3_file *file, int op, void *arg)
+{
+	//Size hints would grow the real file without blocks
+	if(op == SQLITE_FCNTL_SIZE_HINT || op == SQLITE_FCNTL_CHUNK_SIZE)
+		return SQLITE_OK;
+
+	return REAL_FILE(file)->pMethods->xFileControl(REAL_FILE(file), op, arg);
+}
+
+static int vfs_sector_size(sqlite3_file *file)
+{
+	return VFS_BLOCK_SIZE;
+}
+
+//Writes are not atomic and a partial write damages the whole block
+static int vfs_device_characteristics(sqlite3_file *file)
+{
+	return 0;
+}
+
+//Version 1 has no shared memory, so SQLite uses a rollback journal
+//instead of a write-ahead log: checkpoints would write the database
+//while others read it, with the tree changing under them. Nor memory
+//mapping, pages must always be decrypted.
+static const sqlite3_io_methods vfs_io_methods = {
+	1,
+	vfs_close,
+	vfs_read,
+	vfs_write,
+	vfs_truncate,
+	vfs_sync,
+	vfs_file_size,
+	vfs_lock,
+	vfs_unlock_file,
+	vfs_check_reserved_lock,
+	vfs_file_control,
+	vfs_sector_size,
+	vfs_device_characteristics,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+static int vfs_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *file,
+	int flags, int *out_flags)
+{
+	Vfs_file_t *f = (Vfs_file_t *)file;
+	char header[PAGED_HEADER_SIZE];
+	int rc;
+
+	if(!vfs_keyed)
+		return SQLITE_CANTOPEN;
+
+	f->real = (sqlite3_file *)&f[1];
+	f->start = 0;
+	f->lock = SQLITE_LOCK_NONE;
+	f->blocks = 0;
+	f->trusted = false;
+	f->written = false;
+	f->warned = false;
+
+	if(flags & SQLITE_OPEN_MAIN_DB)
+		f->kind = 1;
+	else if(flags & SQLITE_OPEN_WAL)
+		f->kind = 2;
+	else
+		f->kind = 3;
+
+	rc = REAL_VFS(vfs)->xOpen(REAL_VFS(vfs), name, f->real, flags,
+		out_flags);
+
+	if(rc != SQLITE_OK) {
+
+		if(f->real->pMethods != NULL)
+			f->real->pMethods->xClose(f->real);
+
+		return rc;
+	}
+
+	//Only the database that was unlocked can be opened
+	if(flags & SQLITE_OPEN_MAIN_DB) {
+		rc = f->real->pMethods->xRead(f->real, header, PAGED_HEADER_SIZE, 0);
+
+		if(rc != SQLITE_OK ||
+			memcmp(header, vfs_header, PAGED_HEADER_SIZE) != 0) {
+			f->real->pMethods->xClose(f->real);
+			return SQLITE_CANTOPEN;
+		}
+
+		f->start = PAGED_HEADER_SIZE + VFS_STATE_SIZE;
+	}
+
+	f->base.pMethods = &vfs_io_methods;
+
+	return SQLITE_OK;
+}
+
+static int vfs_delete(sqlite3_vfs *vfs, const char *name, int sync)
+{
+	return REAL_VFS(vfs)->xDelete(REAL_VFS(vfs), name, sync);
+}
+
+static int vfs_access(sqlite3_vfs *vfs, const char *name, int flags,
+	int *result)
+{
+	return REAL_VFS(vfs)->xAccess(REAL_VFS(vfs), name, flags, result);
+}
+
+static int vfs_full_pathname(sqlite3_vfs *vfs, const char *name, int size,
+	char *out)
+{
+	return REAL_VFS(vfs)->xFullPathname(REAL_VFS(vfs), name, size, out);
+}
+
+static void *vfs_dl_open(sqlite3_vfs *vfs, const char *path)
+{
+	return REAL_VFS(vfs)->xDlOpen(REAL_VFS(vfs), path);
+}
+
+static void vfs_dl_error(sqlite3_vfs *vfs, int size, char *message)
+{
+	REAL_VFS(vfs)->xDlError(REAL_VFS(vfs), size, message);
+}
+
+static void (*vfs_dl_sym(sqlite3_vfs *vfs, void *handle,
+	const char *symbol))(void)
+{
+	return REAL_VFS(vfs)->xDlSym(REAL_VFS(vfs), handle, symbol);
+}
+
+static void vfs_dl_close(sqlite3_vfs *vfs, void *handle)
+{
+	REAL_VFS(vfs)->xDlClose(REAL_VFS(vfs), handle);
+}
+
+static int vfs_randomness(sqlite3_vfs *vfs, int size, char *out)
+{
+	return REAL_VFS(vfs)->xRandomness(REAL_VFS(vfs), size, out);
+}
+
+static int vfs_sleep(sqlite3_vfs *vfs, int microseconds)
+{
+	return REAL_VFS(vfs)->xSleep(REAL_VFS(vfs), microseconds);
+}
+
+static int vfs_current_time(sqlite3_vfs *vfs, double *time)
+{
+	return REAL_VFS(vfs)->xCurrentTime(REAL_VFS(vfs), time);
+}
+
+static int vfs_get_last_error(sqlite3_vfs *vfs, int size, char *message)
+{
+	return REAL_VFS(vfs)->xGetLastError(REAL_VFS(vfs), size, message);
+}
+
+static int vfs_current_time_int64(sqlite3_vfs *vfs, sqlite3_int64 *time)
+{
+	return REAL_VFS(vfs)->xCurrentTimeInt64(REAL_VFS(vfs), time);
+}
+
+//Register the VFS on top of the default one, once.
+//Returns false on failure.
+static bool vfs_register()
+{
+	static sqlite3_vfs vfs;
+	sqlite3_vfs *real;
+
+	if(sqlite3_vfs_find(VFS_NAME) != NULL)
+		return true;
+
+	real = sqlite3_vfs_find(NULL);
+
+	if(real == NULL || real->iVersion < 2) {
+		fprintf(stderr, "No default SQLite VFS available\n");
+		return false;
+	}
+
+	vfs.iVersion = 2;
+	vfs.szOsFile = sizeof(Vfs_file_t) + real->szOsFile;
+	vfs.mxPathname = real->mxPathname;
+	vfs.zName = VFS_NAME;
+	vfs.pAppData = real;
+	vfs.xOpen = vfs_open;
+	vfs.xDelete = vfs_delete;
+	vfs.xAccess = vfs_access;
+	vfs.xFullPathname = vfs_full_pathname;
+	vfs.xDlOpen = vfs_dl_open;
+	vfs.xDlError = vfs_dl_error;
+	vfs.xDlSym = vfs_dl_sym;
+	vfs.xDlClose = vfs_dl_close;
+	vfs.xRandomness = vfs_randomness;
+	vfs.xSleep = vfs_sleep;
+	vfs.xCurrentTime = vfs_current_time;
+	vfs.xGetLastError = vfs_get_last_error;
+	vfs.xCurrentTimeInt64 = vfs_current_time_int64;
+
+	if(sqlite3_vfs_register(&vfs, 0) != SQLITE_OK) {
+		fprintf(stderr, "Failed to register SQLite VFS\n");
+		return false;
+	}
+
+	return true;
+}
+
+//Read header of the paged file in path to header.
+//Returns false on failure.
+static bool vfs_read_header(const char *path, char *header)
+{
+	FILE *fp = NULL;
+	size_t count;
+
+	fp = fopen(path, "r");
+
+	if(fp == NULL)
+		return false;
+
+	count = fread(header, 1, PAGED_HEADER_SIZE, fp);
+	fclose(fp);
+
+	return count == PAGED_HEADER_SIZE;
+}
+
+//Create a new paged database to path, encrypted with passphrase, and
+//unlock it. Returns false on failure.
+bool vfs_create(const char *path, const char *passphrase)
+{
+	unsigned char state[VFS_STATE_SIZE] = {0};
+	char header[PAGED_HEADER_SIZE];
+	Key_t key;
+	FILE *fp = NULL;
+	bool success;
+
+	if(!vfs_register() || !init_paged_file(path, passphrase, &key))
+		return false;
+
+	//No blocks yet, the state is clean and the root zeros
+	state[VFS_STATE_CLEAN] = 1;
+
+	success = vfs_read_header(path, header) &&
+		vfs_state_hmac(header, state, key, true);
+
+	if(success) {
+		fp = fopen(path, "r+");
+		success = fp != NULL && fseek(fp, PAGED_HEADER_SIZE, SEEK_SET) == 0 &&
+			fwrite(state, 1, VFS_STATE_SIZE, fp) == VFS_STATE_SIZE;
+
+		if(fp != NULL && fclose(fp) != 0)
+			success = false;
+	}
+
+	if(!success) {
+		fprintf(stderr, "Failed to write %s\n", path);
+		remove(path);
+		return false;
+	}
+
+	memcpy(vfs_header, header, PAGED_HEADER_SIZE);
+	vfs_key = key;
+	vfs_keyed = true;
+
+	return true;
+}
+
+//Unlock the paged database in path with passphrase. After this
+//the database can be opened with VFS_NAME, until another database
+//is unlocked. Returns false on failure or if passphrase is wrong.
+bool vfs_unlock(const char *path, const char *passphrase)
+{
+	Key_t key;
+
+	if(!vfs_register())
+		return false;
+
+	if(!get_paged_key(path, passphrase, &key))
+		return false;
+
+	if(!vfs_read_header(path, vfs_header)) {
+		fprintf(stderr, "Failed to read %s\n", path);
+		vfs_keyed = false;
+		return false;
+	}
+
+	vfs_key = key;
+	vfs_keyed = true;
+
+	return true;
+}
+
+//Unlock the paged database in path with key got earlier from
+//vfs_get_key(). Returns false if it's not the key of the database.
+bool vfs_unlock_key(const char *path, Key_t key)
+{
+	char header[PAGED_HEADER_SIZE];
+
+	if(!vfs_register())
+		return false;
+
+	if(!vfs_read_header(path, header) || !is_paged_key(header, key))
+		return false;
+
+	memcpy(vfs_header, header, PAGED_HEADER_SIZE);
+	vfs_key = key;
+	vfs_keyed = true;
+
+	return true;
+}
+
+//Get the key of the unlocked database to key.
+//Returns false if there's none.
+bool vfs_get_key(Key_t *key)
+{
+	if(!vfs_keyed)
+		return false;
+
+	*key = vfs_key;
+
+	return true;
+}
+
+//Returns true if the paged database in path is unlocked.
+bool vfs_is_unlocked(const char *path)
+{
+	char header[PAGED_HEADER_SIZE];
+
+	if(!vfs_keyed || !vfs_read_header(path, header))
+		return false;
+
+	return memcmp(header, vfs_header, PAGED_HEADER_SIZE) == 0;
+}
+
+//Re-encrypt the paged database fIn, encrypted with old_passphrase, to
+//fOut with a new key from new_passphrase. Blocks are verified and
+//re-encrypted one by one, without unlocking the database for this
+//process. The tree is computed in memory from the HMACs of the blocks,
+//with both keys: the old root must be the one of the state, and the new
+//nodes are written once all the blocks are. Journals are not handled,
+//the database must not have one and it must be clean. Returns false on
+//failure.
+bool vfs_rekey(FILE *fIn, FILE *fOut, const char *old_passphrase,
+	const char *new_passphrase)
+{
+	unsigned char block[VFS_PREFIX_SIZE + VFS_STORED_SIZE];
+	char *data = (char *)block + VFS_DATA_OFFSET;
+	char *iv = (char *)block + VFS_IV_OFFSET;
+	char header[PAGED_HEADER_SIZE];
+	char new_header[PAGED_HEADER_SIZE];
+	unsigned char state[VFS_STATE_SIZE];
+	unsigned char root[HMAC_SIZE];
+	unsigned char *old_macs = NULL;
+	unsigned char *new_macs = NULL;
+	Key_t old_key;
+	Key_t new_key;
+	sqlite3_int64 blocks;
+	sqlite3_int64 index = 0;
+	unsigned char kind = 1; //Main database, see vfs_open()
+	unsigned int length;
+	bool success = true;
+	size_t count;
+
+	if(fread(header, PAGED_HEADER_SIZE, 1, fIn) != 1 ||
+		fread(state, VFS_STATE_SIZE, 1, fIn) != 1) {
+		fprintf(stderr, "Failed to read file\n");
+		return false;
+	}
+
+	if(!state[VFS_STATE_CLEAN]) {
+		fprintf(stderr, "Database was not synced after it was last " \
+			"written, open it first.\n");
+		return false;
+	}
+
+	if(!rekey_paged_header(header, old_passphrase, new_passphrase,
+		new_header, &old_key, &new_key))
+		return false;
+
+	blocks = vfs_get_int64(state + VFS_STATE_BLOCKS);
+
+	if(!vfs_state_hmac(header, state, old_key, false) || blocks < 0) {
+		fprintf(stderr, "Data was tampered or corrupted.\n");
+		success = false;
+		goto out;
+	}
+
+	old_macs = malloc(blocks * HMAC_SIZE + 1);
+	new_macs = malloc(blocks * HMAC_SIZE + 1);
+
+	if(old_macs == NULL || new_macs == NULL) {
+		fprintf(stderr, "Malloc failed\n");
+		success = false;
+		goto out;
+	}
+
+	//State is written once the blocks are done
+	fwrite(new_header, 1, PAGED_HEADER_SIZE, fOut);
+	fwrite(state, 1, VFS_STATE_SIZE, fOut);
+
+	while(success) {
+		count = fread(block + VFS_PREFIX_SIZE, 1, VFS_STORED_SIZE, fIn);
+
+		if(count == 0 && feof(fIn))
+			break;
+
+		length = vfs_get_length(block + VFS_LENGTH_OFFSET);
+
+		if(index >= blocks || count != VFS_STORED_SIZE ||
+			length > VFS_BLOCK_SIZE ||
+			!vfs_block_hmac(block, kind, index, old_key, false)) {
+			fprintf(stderr, "Data was tampered or corrupted.\n");
+			success = false;
+			break;
+		}
+
+		memcpy(old_macs + index * HMAC_SIZE, block + VFS_MAC_OFFSET,
+			HMAC_SIZE);
+
+		if(!crypt_data(data, length, iv, old_key, true)) {
+			success = false;
+			break;
+		}
+
+		//First block has the header of the database
+		if(index == 0 && is_sealed_database(data, length)) {
+			fprintf(stderr, "Database has sealed fields, which can't " \
+				"be rekeyed.\n");
+			success = false;
+			break;
+		}
+
+		success = fill_random(iv, IV_SIZE) &&
+			crypt_data(data, length, iv, new_key, false) &&
+			vfs_block_hmac(block, kind, index, new_key, true);
+
+		if(success) {
+			memcpy(new_macs + index * HMAC_SIZE, block + VFS_MAC_OFFSET,
+				HMAC_SIZE);
+			memset(block + VFS_NODE_OFFSET, 0, HMAC_SIZE);
+			fwrite(block + VFS_PREFIX_SIZE, 1, VFS_STORED_SIZE, fOut);
+		}
+
+		index++;
+	}
+
+	//Tree of the blocks that were read must be the one of the state
+	if(success) {
+		success = index == blocks &&
+			vfs_tree_root(old_macs, blocks, old_key, root) &&
+			verify_hmac(state + VFS_STATE_ROOT, root);
+
+		if(!success)
+			fprintf(stderr, "Data was tampered or corrupted.\n");
+	}
+
+	if(success)
+		success = vfs_tree_root(new_macs, blocks, new_key, root);
+
+	for(sqlite3_int64 i = 0; success && i < blocks; i++) {
+		success = fseek(fOut, PAGED_HEADER_SIZE + VFS_STATE_SIZE +
+			i * VFS_STORED_SIZE + VFS_NODE_OFFSET - VFS_PREFIX_SIZE,
+			SEEK_SET) == 0 &&
+			fwrite(new_macs + i * HMAC_SIZE, 1, HMAC_SIZE, fOut) == HMAC_SIZE;
+	}
+
+	//Generation goes on
+	if(success) {
+		vfs_put_int64(state + VFS_STATE_GENERATION,
+			vfs_get_int64(state + VFS_STATE_GENERATION) + 1);
+		memcpy(state + VFS_STATE_ROOT, root, HMAC_SIZE);
+
+		success = vfs_state_hmac(new_header, state, new_key, true) &&
+			fseek(fOut, PAGED_HEADER_SIZE, SEEK_SET) == 0 &&
+			fwrite(state, 1, VFS_STATE_SIZE, fOut) == VFS_STATE_SIZE;
+	}
+
+out:
+	free(old_macs);
+	free(new_macs);
+
+	memset(block, 0, sizeof(block));
+	memset(&old_key, 0, sizeof(old_key));
+	memset(&new_key, 0, sizeof(new_key));
+
+	if(success && ferror(fOut)) {
+		fprintf(stderr, "Failed to write file\n");
+		success = false;
+	}
+
+	return success;
+}
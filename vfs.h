@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VFS_H
+#define __VFS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "crypto.h"
+
+//Name of the SQLite VFS used for paged databases
+#define VFS_NAME "steel"
+
+bool vfs_create(const char *path, const char *passphrase);
+bool vfs_unlock(const char *path, const char *passphrase);
+bool vfs_unlock_key(const char *path, Key_t key);
+bool vfs_get_key(Key_t *key);
+bool vfs_is_unlocked(const char *path);
+bool vfs_rekey(FILE *fIn, FILE *fOut, const char *old_passphrase,
+	const char *new_passphrase);
+
+#endif
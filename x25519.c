@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2015 Niko Rosvall <niko@byteptr.com>
+ *
+ * This file is part of Steel.
+ *
+ * Steel is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Steel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Steel.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include "x25519.h"
+
+//X25519 Diffie-Hellman function of RFC 7748, used to seal entries to
+//the public key of a closed database, see box_seal(). Field elements
+//are 16 limbs of 16 bits, kept in 64 bit integers so that products can
+//be summed before carrying. Everything runs in constant time, the only
+//branches are on the loop counters.
+
+typedef long long Field_t[16];
+
+//(A - 2) / 4 of curve25519
+static const Field_t a24 = {0xdb41, 1};
+
+static void field_carry(Field_t o)
+{
+	long long c;
+
+	for(int i = 0; i < 16; i++) {
+
+		o[i] += 1LL << 16;
+		c = o[i] >> 16;
+
+		//2^256 = 38 modulo 2^255 - 19
+		if(i < 15)
+			o[i + 1] += c - 1;
+		else
+			o[0] += 38 * (c - 1);
+
+		o[i] -= c * (1LL << 16);
+	}
+}
+
+//Swap p and q if bit is 1
+static void field_swap(Field_t p, Field_t q, int bit)
+{
+	long long mask = ~((long long)bit - 1);
+	long long t;
+
+	for(int i = 0; i < 16; i++) {
+		t = mask & (p[i] ^ q[i]);
+		p[i] ^= t;
+		q[i] ^= t;
+	}
+}
+
+static void field_add(Field_t o, const Field_t a, const Field_t b)
+{
+	for(int i = 0; i < 16; i++)
+		o[i] = a[i] + b[i];
+}
+
+static void field_sub(Field_t o, const Field_t a, const Field_t b)
+{
+	for(int i = 0; i < 16; i++)
+		o[i] = a[i] - b[i];
+}
+
+static void field_mul(Field_t o, const Field_t a, const Field_t b)
+{
+	long long t[31] = {0};
+
+	for(int i = 0; i < 16; i++) {
+		for(int j = 0; j < 16; j++)
+			t[i + j] += a[i] * b[j];
+	}
+
+	for(int i = 0; i < 15; i++)
+		t[i] += 38 * t[i + 16];
+
+	for(int i = 0; i < 16; i++)
+		o[i] = t[i];
+
+	field_carry(o);
+	field_carry(o);
+}
+
+//o = i^(p - 2), the inverse of i
+static void field_invert(Field_t o, const Field_t i)
+{
+	Field_t c;
+
+	memcpy(c, i, sizeof(Field_t));
+
+	for(int a = 253; a >= 0; a--) {
+
+		field_mul(c, c, c);
+
+		if(a != 2 && a != 4)
+			field_mul(c, c, i);
+	}
+
+	memcpy(o, c, sizeof(Field_t));
+}
+
+static void field_unpack(Field_t o, const unsigned char *n)
+{
+	for(int i = 0; i < 16; i++)
+		o[i] = n[2 * i] + ((long long)n[2 * i + 1] << 8);
+
+	o[15] &= 0x7fff;
+}
+
+//Write n fully reduced modulo 2^255 - 19 as 32 little-endian bytes
+static void field_pack(unsigned char *o, const Field_t n)
+{
+	Field_t m, t;
+	int borrow;
+
+	memcpy(t, n, sizeof(Field_t));
+
+	field_carry(t);
+	field_carry(t);
+	field_carry(t);
+
+	for(int j = 0; j < 2; j++) {
+
+		m[0] = t[0] - 0xffed;
+
+		for(int i = 1; i < 15; i++) {
+			m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+			m[i - 1] &= 0xffff;
+		}
+
+		m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+		borrow = (m[15] >> 16) & 1;
+		m[14] &= 0xffff;
+
+		//Keep t - p unless it went negative
+		field_swap(t, m, 1 - borrow);
+	}
+
+	for(int i = 0; i < 16; i++) {
+		o[2 * i] = t[i] & 0xff;
+		o[2 * i + 1] = t[i] >> 8;
+	}
+}
+
+//Multiply point, the u-coordinate of a point, by scalar with the
+//Montgomery ladder and write the u-coordinate of the result to out.
+void x25519(unsigned char *out, const unsigned char *scalar,
+	const unsigned char *point)
+{
+	unsigned char z[32];
+	Field_t x, a, b, c, d, e, f;
+	int bit;
+
+	memcpy(z, scalar, 32);
+	z[31] = (z[31] & 127) | 64;
+	z[0] &= 248;
+
+	field_unpack(x, point);
+
+	memset(a, 0, sizeof(Field_t));
+	memset(c, 0, sizeof(Field_t));
+	memset(d, 0, sizeof(Field_t));
+	memcpy(b, x, sizeof(Field_t));
+	a[0] = 1;
+	d[0] = 1;
+
+	for(int i = 254; i >= 0; i--) {
+
+		bit = (z[i >> 3] >> (i & 7)) & 1;
+
+		field_swap(a, b, bit);
+		field_swap(c, d, bit);
+
+		field_add(e, a, c);
+		field_sub(a, a, c);
+		field_add(c, b, d);
+		field_sub(b, b, d);
+		field_mul(d, e, e);
+		field_mul(f, a, a);
+		field_mul(a, c, a);
+		field_mul(c, b, e);
+		field_add(e, a, c);
+		field_sub(a, a, c);
+		field_mul(b, a, a);
+		field_sub(c, d, f);
+		field_mul(a, c, a24);
+		field_add(a, a, d);
+		field_mul(c, c, a);
+		field_mul(a, d, f);
+		field_mul(d, b, x);
+		field_mul(b, e, e);
+
+		field_swap(a, b, bit);
+		field_swap(c, d, bit);
+	}
+
+	field_invert(c, c);
+	field_mul(a, a, c);
+	field_pack(out, a);
+
+	memset(z, 0, sizeof(z));
+}
+
+//Public key of the secret key scalar
+void x25519_base(unsigned char *out, const unsigned char *scalar)
+{
+	static const unsigned char base[32] = {9};
+
+	x25519(out, scalar, base);
+}